@@ -274,6 +274,7 @@ typedef uint32_t    km_core_status;      // Status return code.
 //
 typedef struct km_core_keyboard    km_core_keyboard;
 typedef struct km_core_state       km_core_state;
+typedef struct km_core_snapshot    km_core_snapshot;
 typedef struct km_core_options     km_core_options;
 
 /*
@@ -1140,6 +1141,135 @@ km_core_keyboard_load(km_core_path_name kb_path,
 
 -------------------------------------------------------------------------------
 
+# km_core_keyboard_load_from_blob()
+
+## Description
+
+Parse and load a keyboard from a buffer holding the contents of a .kmx file,
+and return a pointer to the loaded keyboard in the out parameter. Use this
+where the keyboard file is not available on the filesystem, or has already
+been read by the engine.
+
+## Specification
+
+```c */
+KMN_API
+km_core_status
+km_core_keyboard_load_from_blob(km_core_path_name kb_name,
+                                void const *blob,
+                                size_t blob_size,
+                                km_core_keyboard **keyboard);
+
+/*
+```
+
+## Parameters
+
+`kb_name`
+: On Windows, a UTF-16 string; on other platforms, a C string:
+  the name of the keyboard, in the same form as a path passed to
+  [km_core_keyboard_load]. The keyboard id reported in its attributes is
+  taken from this name; it is not opened.
+
+`blob`
+: The keyboard file data. This is copied, so the caller may free it once
+  this call returns.
+
+`blob_size`
+: The size of `blob`, in bytes.
+
+`keyboard`
+: A pointer to result variable: A pointer to the opaque keyboard
+  object returned by the Processor. This memory must be freed with a
+  call to [km_core_keyboard_dispose].
+
+## Returns
+
+`KM_CORE_STATUS_OK`
+: On success.
+
+`KM_CORE_STATUS_NO_MEM`
+: In the event an internal memory allocation fails.
+
+`KM_CORE_STATUS_INVALID_ARGUMENT`
+: In the event `kb_name`, `blob` or `keyboard` is null, or `blob_size` is 0.
+
+`KM_CORE_STATUS_INVALID_KEYBOARD`
+: In the event the data is not a valid keyboard.
+
+-------------------------------------------------------------------------------
+
+# km_core_keyboard_load_flags enum
+
+## Description
+
+Bit flags to be used with the `flags` parameter of
+[km_core_keyboard_load_with_flags]. They control how the transforms of an
+LDML keyboard are prepared, and are ignored for other keyboards.
+
+## Specification
+
+```c */
+enum km_core_keyboard_load_flags {
+  KM_CORE_KEYBOARD_LOAD_DEFAULT = 0,
+  KM_CORE_KEYBOARD_LOAD_PARALLEL = 1,
+  KM_CORE_KEYBOARD_LOAD_LAZY = 2,
+};
+
+/*
+```
+## Values
+
+`KM_CORE_KEYBOARD_LOAD_DEFAULT`
+: prepare all transforms while loading, on the calling thread
+
+`KM_CORE_KEYBOARD_LOAD_PARALLEL`
+: prepare all transforms while loading, spread over a few threads
+
+`KM_CORE_KEYBOARD_LOAD_LAZY`
+: prepare each transform when it is first needed, so that loading is
+  quicker. Errors in a transform are then not reported by the load; the
+  transform just never matches. Takes precedence over
+  `KM_CORE_KEYBOARD_LOAD_PARALLEL`.
+
+-------------------------------------------------------------------------------
+
+# km_core_keyboard_load_with_flags()
+
+## Description
+
+As [km_core_keyboard_load], with flags to control how the keyboard is
+prepared.
+
+## Specification
+
+```c */
+KMN_API
+km_core_status
+km_core_keyboard_load_with_flags(km_core_path_name kb_path,
+                                 uint32_t flags,
+                                 km_core_keyboard **keyboard);
+
+/*
+```
+
+## Parameters
+
+`kb_path`
+: As for [km_core_keyboard_load].
+
+`flags`
+: A combination of [km_core_keyboard_load_flags].
+
+`keyboard`
+: As for [km_core_keyboard_load].
+
+## Returns
+
+As for [km_core_keyboard_load].
+
+-------------------------------------------------------------------------------
+
 # km_core_keyboard_dispose()
 
 ## Description
@@ -1442,6 +1572,116 @@ km_core_state_clone(km_core_state const *state,
 
 -------------------------------------------------------------------------------
 
+# km_core_state_snapshot()
+
+## Description
+
+Save the contexts of a state, and the keyboard option values and other data
+that the keyboard processor keeps for it, so that the state can be returned to
+them later with [km_core_state_restore]. This allows an engine to find out
+what a keystroke would produce, by processing it with [km_core_process_event]
+and then restoring the state, at less cost than processing it on a clone of
+the state.
+
+## Specification
+
+```c */
+KMN_API
+km_core_status
+km_core_state_snapshot(km_core_state const *state,
+                       km_core_snapshot **out);
+
+/*
+```
+## Parameters
+
+`state`
+: A pointer to the opaque state object to be saved.
+
+`out`
+: A pointer to result variable: A pointer to the opaque snapshot object. This
+  must be disposed of by a call to [km_core_snapshot_dispose].
+
+## Returns
+
+`KM_CORE_STATUS_OK`
+: On success.
+
+`KM_CORE_STATUS_NO_MEM`
+: In the event memory is unavailable to allocate a snapshot object.
+
+`KM_CORE_STATUS_INVALID_ARGUMENT`
+: In the event the `state` or `out` pointer are null.
+
+-------------------------------------------------------------------------------
+
+# km_core_state_restore()
+
+## Description
+
+Return a state to a snapshot taken by [km_core_state_snapshot], undoing the
+changes made to its contexts and keyboard options by any events processed, or
+context API calls made, since. The actions returned by
+[km_core_state_get_actions] and [km_core_state_action_items] are not
+restored: they continue to describe the last event processed. A snapshot may
+be restored any number of times.
+
+## Specification
+
+```c */
+KMN_API
+km_core_status
+km_core_state_restore(km_core_state *state,
+                      km_core_snapshot const *snapshot);
+
+/*
+```
+## Parameters
+
+`state`
+: A pointer to the opaque state object to be restored.
+
+`snapshot`
+: A pointer to a snapshot taken from `state`, or from another state of the
+  same keyboard.
+
+## Returns
+
+`KM_CORE_STATUS_OK`
+: On success.
+
+`KM_CORE_STATUS_NO_MEM`
+: In the event memory is unavailable to restore the state.
+
+`KM_CORE_STATUS_INVALID_ARGUMENT`
+: In the event the `state` or `snapshot` pointer are null, or the snapshot
+  was taken from a state of another keyboard.
+
+-------------------------------------------------------------------------------
+
+# km_core_snapshot_dispose()
+
+## Description
+
+Free the allocated resources belonging to a [km_core_snapshot] object
+previously returned by [km_core_state_snapshot].
+
+## Specification
+
+```c */
+KMN_API
+void
+km_core_snapshot_dispose(km_core_snapshot *snapshot);
+
+/*
+```
+## Parameters
+
+`snapshot`
+: A pointer to the opaque snapshot object to be disposed.
+
+-------------------------------------------------------------------------------
+
 # km_core_state_dispose()
 
 ## Description
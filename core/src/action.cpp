@@ -19,6 +19,33 @@
 bool km::core::action_item_list_to_actions_object(
   km_core_action_item const *action_items,
   km_core_actions *actions
+) {
+  assert(actions != nullptr);
+  actions_buffers buffers;
+  if(!action_item_list_to_actions_object(action_items, actions, buffers)) {
+    return false;
+  }
+
+  // Copy the arrays out of the buffers, for the caller to free with
+  // actions_dispose
+
+  std::unique_ptr<km_core_usv[]> output(new km_core_usv[buffers.output.size()]);
+  std::copy(buffers.output.begin(), buffers.output.end(), output.get());
+
+  actions->persist_options = new km_core_option_item[buffers.persist_options.size()];
+  for(size_t i = 0; i < buffers.options.size(); i++) {
+    actions->persist_options[i] = buffers.options[i].release();
+  }
+  actions->persist_options[buffers.options.size()] = KM_CORE_OPTIONS_END;
+
+  actions->output = output.release();
+  return true;
+}
+
+bool km::core::action_item_list_to_actions_object(
+  km_core_action_item const *action_items,
+  km_core_actions *actions,
+  actions_buffers &buffers
 ) {
   assert(action_items != nullptr);
   assert(actions != nullptr);
@@ -28,8 +55,10 @@ bool km::core::action_item_list_to_actions_object(
 
 
   // Set actions default values
-  std::vector<km_core_context_item> output;
-  std::vector<km_core_option_item> options;
+  auto &output = buffers.items;
+  auto &options = buffers.options;
+  output.clear();
+  options.clear();
   actions->code_points_to_delete = 0;
   actions->do_alert = KM_CORE_FALSE;
   actions->emit_keystroke = KM_CORE_FALSE;
@@ -97,15 +126,12 @@ bool km::core::action_item_list_to_actions_object(
         output.push_back({KM_CORE_CT_MARKER,{0},{action_items->marker}});
         break;
       case KM_CORE_IT_PERSIST_OPT:
-      {
         // TODO: lowpri: replace existing item if already present in options vector?
-        km::core::option opt(static_cast<km_core_option_scope>(action_items->option->scope),
+        options.emplace_back(static_cast<km_core_option_scope>(action_items->option->scope),
           action_items->option->key,
           action_items->option->value
         );
-        options.push_back(opt.release()); // hand over memory management of the option item to the action struct
         break;
-      }
       default:
         assert(false);
     }
@@ -122,19 +148,20 @@ bool km::core::action_item_list_to_actions_object(
     return false;
   }
 
-  std::unique_ptr<km_core_usv[]> output_usv(new km_core_usv[buf_size]);
+  buffers.output.resize(buf_size);
 
-  if(context_items_to_utf32(output.data(), output_usv.get(), &buf_size) != KM_CORE_STATUS_OK) {
+  if(context_items_to_utf32(output.data(), buffers.output.data(), &buf_size) != KM_CORE_STATUS_OK) {
     return false;
   }
 
-  actions->output = output_usv.release();
+  actions->output = buffers.output.data();
 
-  // Create an array of the persisted options
+  // Create an array of the persisted options, which point to the keys and
+  // values owned by buffers.options
 
-  options.push_back(KM_CORE_OPTIONS_END);
-  actions->persist_options = new km_core_option_item[options.size()];
-  std::copy(options.begin(), options.end(), actions->persist_options);
+  buffers.persist_options.assign(options.begin(), options.end());
+  buffers.persist_options.push_back(KM_CORE_OPTIONS_END);
+  actions->persist_options = buffers.persist_options.data();
 
   // We now have a complete set of actions
 
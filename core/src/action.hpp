@@ -14,20 +14,36 @@
 namespace km {
 namespace core
 {
+  // Allocates the arrays of actions on the heap, to be freed with
+  // actions_dispose
   bool action_item_list_to_actions_object(
     km_core_action_item const *action_items,
     km_core_actions *actions
   );
 
+  // Points the arrays of actions into buffers, valid until buffers is next
+  // used or destroyed
+  bool action_item_list_to_actions_object(
+    km_core_action_item const *action_items,
+    km_core_actions *actions,
+    actions_buffers &buffers
+  );
+
+  // If buffers is given, the arrays of actions must point into it, otherwise
+  // they must have been allocated on the heap
   bool actions_normalize(
     /* in */      context const *cached_context,
     /* in, out */ context *app_context,
-    /* in, out */ km_core_actions &actions
+    /* in, out */ km_core_actions &actions,
+    /* in, out */ actions_buffers *buffers = nullptr
   );
 
   bool actions_update_app_context_nfu(
     /* in */      context const *cached_context,
-    /* in, out */ context *app_context
+    /* in, out */ context *app_context,
+    /* in, out */ km_core_actions &actions,
+    /* in */      bool app_context_synced,
+    /* in, out */ actions_buffers *buffers = nullptr
   );
 
   void actions_dispose(
@@ -39,5 +55,11 @@ namespace core
     unsigned int code_points_to_delete
   );
 
+  km_core_usv const *get_deleted_context(
+    context const &app_context,
+    unsigned int code_points_to_delete,
+    std::vector<km_core_usv> &buffer
+  );
+
 } // namespace core
 } // namespace km
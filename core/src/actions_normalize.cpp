@@ -8,6 +8,8 @@
 #include <algorithm>
 #include <sstream>
 #include <memory>
+#include <string>
+#include <vector>
 
 #include <cassert>
 #include "context.hpp"
@@ -19,8 +21,10 @@
 
 // forward declarations
 
-icu::UnicodeString context_items_to_unicode_string(km::core::context const *context);
+bool previous_char(km::core::context const &context, size_t &i);
+icu::UnicodeString context_chars_to_unicode_string(km::core::context const &context, size_t begin, size_t end);
 km_core_usv *unicode_string_to_usv(icu::UnicodeString& src);
+km_core_usv *unicode_string_to_usv(icu::UnicodeString& src, std::vector<km_core_usv> &dst);
 
 /**
  * Normalize the output from an action to NFC, across the context | output
@@ -33,12 +37,16 @@ km_core_usv *unicode_string_to_usv(icu::UnicodeString& src);
  *                        applied, and will be applied by this function
  * @param actions         transform to apply, in NFD, which will be converted
  *                        to NFC by this function
+ * @param buffers         if given, the storage that the arrays of actions
+ *                        point into, and into which the new arrays are
+ *                        written; otherwise the arrays are on the heap
  * @return true on success, false on failure
  */
 bool km::core::actions_normalize(
   /* in */      km::core::context const *cached_context,
   /* in, out */ km::core::context *app_context,
-  /* in, out */ km_core_actions &actions
+  /* in, out */ km_core_actions &actions,
+  /* in, out */ km::core::actions_buffers *buffers
 ) {
   assert(cached_context != nullptr);
   assert(app_context != nullptr);
@@ -85,12 +93,8 @@ bool km::core::actions_normalize(
   }
 
   icu::UnicodeString output = icu::UnicodeString::fromUTF32(reinterpret_cast<const UChar32*>(actions.output), -1);
-  icu::UnicodeString cached_context_string = context_items_to_unicode_string(cached_context);
-  icu::UnicodeString app_context_string = context_items_to_unicode_string(app_context);
   assert(!output.isBogus());
-  assert(!cached_context_string.isBogus());
-  assert(!app_context_string.isBogus());
-  if(output.isBogus() || cached_context_string.isBogus() || app_context_string.isBogus()) {
+  if(output.isBogus()) {
     return false;
   }
   int nfu_to_delete = 0;
@@ -100,18 +104,24 @@ bool km::core::actions_normalize(
   */
 
   assert(nfd->isNormalized(output, icu_status) && U_SUCCESS(icu_status));
-  assert(nfd->isNormalized(cached_context_string, icu_status) && U_SUCCESS(icu_status));
 
   /*
     The keyboard processor will have updated the cached_context already,
-    applying the transform to it, so we need to rewind this. Remove the output
-    from cached_context_string to start
+    applying the transform to it, so we need to rewind this. Walk back over
+    the output at the end of cached_context to start. Only the chars of the
+    cached_context are looked at; its markers are skipped.
   */
 
-  assert(cached_context_string.length() >= output.length());
-  int n = cached_context_string.length() - output.length();
-  assert(cached_context_string.compare(n, output.length(), output) == 0);
-  cached_context_string.remove(n);
+  size_t cached_end = cached_context->size();
+  for(auto p = actions.output + std::char_traits<km_core_usv>::length(actions.output); p > actions.output; ) {
+    --p;
+    bool found = previous_char(*cached_context, cached_end);
+    assert(found && (*cached_context)[cached_end].character == *p);
+    if(!found) {
+      DebugLog("cached context is shorter than the output");
+      return false;
+    }
+  }
 
   /*
     While cached_context is guaranteed to be normalized, actions->output may not
@@ -119,35 +129,90 @@ bool km::core::actions_normalize(
     normalization in our output, we now need to look for a normalization
     boundary prior to the intersection of the cached_context and the output.
   */
+  size_t chars_prepended = 0;
   if(!output.isEmpty()) {
-    while(n > 0 && !nfd->hasBoundaryBefore(output[0])) {
+    size_t i = cached_end;
+    while(!nfd->hasBoundaryBefore(output.char32At(0)) && previous_char(*cached_context, i)) {
       // The output may interact with the context further in normalization. We
       // need to copy characters back further until we reach a normalization
       // boundary.
-
-      // Remove last code point from the context ...
-
-      n = cached_context_string.moveIndex32(n, -1);
-      UChar32 chr = cached_context_string.char32At(n);
-      cached_context_string.remove(n);
-
-      // And prepend it to the output ...
-
-      output.insert(0, chr);
+      cached_end = i;
+      output.insert(0, (UChar32) (*cached_context)[i].character);
+      chars_prepended++;
     }
   }
 
   /*
-    At this point, our output and cached_context are coherent and normalization
-    will be complete at the edit boundary.
+    At this point, our output and the cached_context up to cached_end are
+    coherent and normalization will be complete at the edit boundary.
 
     Now, we need to adjust the delete_back to match the number of codepoints
     that must actually be deleted from the applications's NFU context
 
     To adjust, we remove one codepoint at a time from the app_context until
     its normalized form matches the cached_context normalized form.
+
+    Only the end of each context needs to be compared: the app_context from a
+    normalization boundary before the code points that could be affected, and
+    the same span of the cached_context. The text before that normalizes
+    independently of what follows it, and has not been changed by the keyboard
+    processor, so it is the same in both, as the contexts are kept in step.
+    If the ends of the contexts do not line up as expected, the whole of the
+    contexts are compared instead.
   */
 
+  size_t const affected = actions.code_points_to_delete + chars_prepended;
+  size_t app_start = app_context->size();
+  while(app_start > 0 && !(app_context->size() - app_start >= affected &&
+      (app_start == app_context->size() || nfd->hasBoundaryBefore((*app_context)[app_start].character)))) {
+    app_start--;
+  }
+
+  size_t cached_start = 0;
+  if(app_start > 0) {
+    icu::UnicodeString app_window = context_chars_to_unicode_string(*app_context, app_start, app_context->size());
+    icu::UnicodeString app_window_nfd;
+    nfd->normalize(app_window, app_window_nfd, icu_status);
+    assert(U_SUCCESS(icu_status));
+    if(!U_SUCCESS(icu_status)) {
+      DebugLog("nfd->normalize failed with %x", icu_status);
+      return false;
+    }
+
+    // The app window, less the code points deleted by the keyboard processor,
+    // should normalize to the cached_context from cached_start up to the output
+    size_t window_chars = (size_t) app_window_nfd.countChar32();
+    size_t target_chars = window_chars - actions.code_points_to_delete;
+    cached_start = cached_end;
+    bool lined_up = window_chars >= affected;
+    for(size_t n = chars_prepended; lined_up && n < target_chars; n++) {
+      lined_up = previous_char(*cached_context, cached_start);
+    }
+    if(lined_up) {
+      icu::UnicodeString cached_window = context_chars_to_unicode_string(*cached_context, cached_start, cached_end);
+      cached_window.append(output, 0, output.moveIndex32(0, (int32_t) chars_prepended));
+      lined_up = app_window_nfd.compare(0, app_window_nfd.moveIndex32(0, (int32_t) target_chars), cached_window) == 0;
+    }
+    if(lined_up) {
+      // As a check that the text before the windows is the same, the char
+      // before each must match
+      UChar32 app_last = (*app_context)[app_start - 1].character;
+      icu::UnicodeString decomposition;
+      if(nfd->getDecomposition(app_last, decomposition)) {
+        app_last = decomposition.char32At(decomposition.moveIndex32(decomposition.length(), -1));
+      }
+      size_t i = cached_start;
+      lined_up = previous_char(*cached_context, i) && (*cached_context)[i].character == (km_core_usv) app_last;
+    }
+    if(!lined_up) {
+      app_start = cached_start = 0;
+    }
+  }
+
+  icu::UnicodeString app_context_string = context_chars_to_unicode_string(*app_context, app_start, app_context->size());
+  icu::UnicodeString cached_context_string = context_chars_to_unicode_string(*cached_context, cached_start, cached_end);
+  assert(nfd->isNormalized(cached_context_string, icu_status) && U_SUCCESS(icu_status));
+
   while(app_context_string.countChar32()) {
     icu::UnicodeString app_context_nfd;
     nfd->normalize(app_context_string, app_context_nfd, icu_status);
@@ -182,7 +247,9 @@ bool km::core::actions_normalize(
     return false;
   }
 
-  auto new_output = unicode_string_to_usv(output_nfc);
+  auto new_output = buffers
+    ? unicode_string_to_usv(output_nfc, buffers->output)
+    : unicode_string_to_usv(output_nfc);
   if(!new_output) {
     // error logging handled in unicode_string_to_usv
     return false;
@@ -192,66 +259,58 @@ bool km::core::actions_normalize(
     Final steps -- set our outputs
   */
 
-  // Append the new NFC output to our reduced app_context
+  // Replace the NFU code points being deleted from the app_context with the
+  // new NFC output, recording the deleted code points for the app
 
-  app_context_string.append(output_nfc);
-  km_core_context_item *app_context_items = nullptr;
-  km_core_status status = KM_CORE_STATUS_OK;
-  if((status = context_items_from_utf16(app_context_string.getTerminatedBuffer(), &app_context_items)) != KM_CORE_STATUS_OK) {
-    DebugLog("context_items_from_utf16 failed with %x", status);
-    delete [] new_output;
-    return false;
+  assert(nfu_to_delete >= 0 && (size_t) nfu_to_delete <= app_context->size());
+  auto deleted_context = buffers
+    ? get_deleted_context(*app_context, nfu_to_delete, buffers->deleted_context)
+    : get_deleted_context(*app_context, nfu_to_delete);
+  for(int i = 0; i < nfu_to_delete; i++) {
+    app_context->pop_back();
   }
-
-  if((status = km_core_context_set(static_cast<km_core_context*>(app_context), app_context_items)) != KM_CORE_STATUS_OK) {
-    DebugLog("km_core_context_set failed with %x", status);
-    km_core_context_items_dispose(app_context_items);
-    delete [] new_output;
-    return false;
+  for(auto p = new_output; *p; p++) {
+    app_context->push_character(*p);
   }
 
-  km_core_context_items_dispose(app_context_items);
-
   // Update actions with new NFC output + count of NFU code points to delete
 
-  delete [] actions.output;
+  if(!buffers) {
+    delete [] actions.output;
+    delete [] actions.deleted_context;
+  }
   actions.output = new_output;
   actions.code_points_to_delete = nfu_to_delete;
+  actions.deleted_context = deleted_context;
 
   return true;
 }
 
 /**
- * Helper to convert km_core_context list into a icu::UnicodeString
+ * Helper to move `i` back to the previous char in the context, skipping
+ * markers. Returns false if there is no char before `i`.
  */
-icu::UnicodeString context_items_to_unicode_string(km::core::context const *context) {
-  icu::UnicodeString nullString;
-  nullString.setToBogus();
-
-  km_core_context_item *items = nullptr;
-  km_core_status status;
-  if((status = km_core_context_get(static_cast<km_core_context const *>(context), &items)) != KM_CORE_STATUS_OK) {
-    DebugLog("Failed to retrieve context with %s", status);
-    return nullString;
-  }
-  size_t buf_size = 0;
-  if((status = context_items_to_utf32(items, nullptr, &buf_size)) != KM_CORE_STATUS_OK) {
-    DebugLog("Failed to retrieve context size with %s", status);
-    km_core_context_items_dispose(items);
-    return nullString;
+bool previous_char(km::core::context const &context, size_t &i) {
+  while(i > 0) {
+    i--;
+    if(context[i].type == KM_CORE_CT_CHAR) {
+      return true;
+    }
   }
+  return false;
+}
 
-  km_core_usv *buf = new km_core_usv[buf_size];
-  if((status = context_items_to_utf32(items, buf, &buf_size)) != KM_CORE_STATUS_OK) {
-    DebugLog("Failed to retrieve context with %s", status);
-    km_core_context_items_dispose(items);
-    delete [] buf;
-    return nullString;
+/**
+ * Helper to convert the chars of context items [begin, end) into a
+ * icu::UnicodeString, skipping markers
+ */
+icu::UnicodeString context_chars_to_unicode_string(km::core::context const &context, size_t begin, size_t end) {
+  icu::UnicodeString result;
+  for(size_t i = begin; i < end; i++) {
+    if(context[i].type == KM_CORE_CT_CHAR) {
+      result.append((UChar32) context[i].character);
+    }
   }
-
-  auto result = icu::UnicodeString::fromUTF32(reinterpret_cast<const UChar32*>(buf), -1);
-  km_core_context_items_dispose(items);
-  delete [] buf;
   return result;
 }
 
@@ -277,49 +336,94 @@ km_core_usv *unicode_string_to_usv(icu::UnicodeString& src) {
   return dst;
 }
 
+/**
+ * Helper to convert icu::UnicodeString to a UTF-32 km_core_usv buffer,
+ * nul-terminated, held in dst
+ */
+km_core_usv *unicode_string_to_usv(icu::UnicodeString& src, std::vector<km_core_usv> &dst) {
+  UErrorCode icu_status = U_ZERO_ERROR;
+
+  dst.resize(src.length() + 1);
+
+  src.toUTF32(reinterpret_cast<UChar32*>(dst.data()), src.length(), icu_status);
+
+  assert(U_SUCCESS(icu_status));
+  if(!U_SUCCESS(icu_status)) {
+    DebugLog("toUTF32 failed with %x", icu_status);
+    return nullptr;
+  }
+
+  dst[src.length()] = 0;
+  return dst.data();
+}
+
 
 
 /**
- * Refresh app_context to match the cached_context. Does not do normalization,
- * unlike `actions_normalize`. Used in conjunction with keyboard processors that
- * do not support normalization. Resulting app context is same as the cached
- * context, but without markers.
+ * Apply the actions to app_context, so that it matches the cached_context.
+ * Does not do normalization, unlike `actions_normalize`. Used in conjunction
+ * with keyboard processors that do not support normalization. Resulting app
+ * context is same as the cached context, but without markers.
  *
- * @param cached_context  the cached context, in NFU, after transform has been
- *                        applied to it by the keyboard processor
- * @param app_context     the app context, in NFU; transform has not been
- *                        applied, and will effectively be applied by this
- *                        function
+ * If app_context matched cached_context before the keyboard processor applied
+ * the actions to it, then only the code points deleted and output by the
+ * actions are changed in app_context. Otherwise, app_context is rebuilt from
+ * the whole of cached_context.
+ *
+ * @param cached_context      the cached context, in NFU, after transform has
+ *                            been applied to it by the keyboard processor
+ * @param app_context         the app context, in NFU; transform has not been
+ *                            applied, and will be applied by this function
+ * @param actions             transform to apply; deleted_context is set to
+ *                            the code points deleted from app_context
+ * @param app_context_synced  true if app_context held the same text as the
+ *                            end of cached_context, or vice versa, before the
+ *                            transform was applied to cached_context
+ * @param buffers             if given, the storage that the arrays of actions
+ *                            point into; otherwise the arrays are on the heap
  * @return true on success, false on failure
  */
 bool km::core::actions_update_app_context_nfu(
   /* in */      km::core::context const *cached_context,
-  /* in, out */ km::core::context *app_context
+  /* in, out */ km::core::context *app_context,
+  /* in, out */ km_core_actions &actions,
+  /* in */      bool app_context_synced,
+  /* in, out */ km::core::actions_buffers *buffers
 ) {
-  km_core_status status = KM_CORE_STATUS_OK;
-  km_core_context_item *items = nullptr;
-
-  if((status = km_core_context_get(static_cast<km_core_context const *>(cached_context), &items)) != KM_CORE_STATUS_OK) {
-    DebugLog("km_core_context_get failed with %d", status);
+  assert(cached_context != nullptr);
+  assert(app_context != nullptr);
+  if(cached_context == nullptr || app_context == nullptr) {
     return false;
   }
 
-  // Strip markers from returned context
+  assert(actions.code_points_to_delete <= app_context->size());
+  auto const code_points_to_delete = std::min<size_t>(actions.code_points_to_delete, app_context->size());
+  if(buffers) {
+    actions.deleted_context = get_deleted_context(*app_context, code_points_to_delete, buffers->deleted_context);
+  } else {
+    delete [] actions.deleted_context;
+    actions.deleted_context = get_deleted_context(*app_context, code_points_to_delete);
+  }
 
-  int i, j;
-  for(i = 0, j = 0; items[i].type != KM_CORE_CT_END; i++) {
-    if(items[i].type != KM_CORE_CT_MARKER) {
-      items[j] = items[i];
-      j++;
+  if(app_context_synced && actions.code_points_to_delete <= app_context->size()) {
+    for(auto n = actions.code_points_to_delete; n > 0; n--) {
+      app_context->pop_back();
+    }
+    for(auto p = actions.output; p && *p; p++) {
+      app_context->push_character(*p);
     }
+    return true;
   }
-  items[j] = KM_CORE_CONTEXT_ITEM_END;
 
-  if((status = km_core_context_set(static_cast<km_core_context*>(app_context), items)) != KM_CORE_STATUS_OK) {
-    DebugLog("km_core_context_set failed with %d", status);
-  }
+  // Copy the cached context, stripping markers
 
-  delete [] items;
+  app_context->clear();
+  for(auto const &item : *cached_context) {
+    if(item.type == KM_CORE_CT_CHAR) {
+      app_context->push_back(item);
+    }
+  }
+  app_context->revision++;
 
-  return status == KM_CORE_STATUS_OK;
+  return true;
 }
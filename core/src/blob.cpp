@@ -0,0 +1,156 @@
+/*
+  Copyright:    © SIL International.
+  Description:  Read-only keyboard data, memory mapped from a file or held
+                in memory.
+  Create Date:  17 Oct 2026
+*/
+
+#include <cstring>
+#include "blob.hpp"
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <windows.h>
+#elif defined(__EMSCRIPTEN__)
+#include <cstdio>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace km::core;
+
+blob blob::copy(void const * data, size_t size) {
+  if (!data || size == 0) {
+    return blob();
+  }
+
+  std::shared_ptr<uint8_t> buf(new uint8_t[size], std::default_delete<uint8_t[]>());
+  std::memcpy(buf.get(), data, size);
+  return blob(std::move(buf), size);
+}
+
+#if defined(_WIN32) || defined(_WIN64)
+
+blob blob::map_file(path const & filename) {
+  // Sharing delete access lets a keyboard be upgraded or removed while it is
+  // loaded, by renaming or deleting the file
+  HANDLE file = CreateFileW(filename.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr,
+                            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    return blob();
+  }
+
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size) || size.QuadPart == 0 || size.HighPart != 0) {
+    CloseHandle(file);
+    return blob();
+  }
+
+  if (static_cast<size_t>(size.QuadPart) < map_threshold) {
+    std::shared_ptr<uint8_t> buf(new uint8_t[size.LowPart], std::default_delete<uint8_t[]>());
+    DWORD read = 0;
+    BOOL ok = ReadFile(file, buf.get(), size.LowPart, &read, nullptr);
+    CloseHandle(file);
+    if (!ok || read != size.LowPart) {
+      return blob();
+    }
+    return blob(std::move(buf), read);
+  }
+
+  HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  CloseHandle(file);
+  if (!mapping) {
+    return blob();
+  }
+
+  void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  CloseHandle(mapping);
+  if (!view) {
+    return blob();
+  }
+
+  return blob(
+    std::shared_ptr<const uint8_t>(static_cast<const uint8_t *>(view),
+      [](const uint8_t *p) { UnmapViewOfFile(p); }),
+    static_cast<size_t>(size.QuadPart));
+}
+
+#elif defined(__EMSCRIPTEN__)
+
+// The emscripten filesystem would copy the file for a mapping anyway
+blob blob::map_file(path const & filename) {
+  FILE *fp = fopen(filename.c_str(), "rb");
+  if (!fp) {
+    return blob();
+  }
+
+  if (fseek(fp, 0, SEEK_END) != 0) {
+    fclose(fp);
+    return blob();
+  }
+
+  auto sz = ftell(fp);
+  if (sz <= 0 || fseek(fp, 0, SEEK_SET) != 0) {
+    fclose(fp);
+    return blob();
+  }
+
+  std::shared_ptr<uint8_t> buf(new uint8_t[sz], std::default_delete<uint8_t[]>());
+  auto read = fread(buf.get(), 1, sz, fp);
+  fclose(fp);
+  if (read != static_cast<size_t>(sz)) {
+    return blob();
+  }
+
+  return blob(std::move(buf), static_cast<size_t>(sz));
+}
+
+#else
+
+blob blob::map_file(path const & filename) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return blob();
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+    close(fd);
+    return blob();
+  }
+
+  size_t size = static_cast<size_t>(st.st_size);
+  if (size < map_threshold) {
+    std::shared_ptr<uint8_t> buf(new uint8_t[size], std::default_delete<uint8_t[]>());
+    size_t got = 0;
+    while (got < size) {
+      ssize_t n = read(fd, buf.get() + got, size - got);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        close(fd);
+        return blob();
+      }
+      got += static_cast<size_t>(n);
+    }
+    close(fd);
+    return blob(std::move(buf), size);
+  }
+
+  void *addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    return blob();
+  }
+
+  return blob(
+    std::shared_ptr<const uint8_t>(static_cast<const uint8_t *>(addr),
+      [size](const uint8_t *p) { munmap(const_cast<uint8_t *>(p), size); }),
+    size);
+}
+
+#endif
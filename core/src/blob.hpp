@@ -0,0 +1,68 @@
+/*
+  Copyright:    © SIL International.
+  Description:  Read-only keyboard data, memory mapped from a file or held
+                in memory.
+  Create Date:  17 Oct 2026
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "path.hpp"
+
+namespace km {
+namespace core
+{
+  /**
+   * An immutable byte buffer holding the contents of a keyboard file. Copies
+   * share the same underlying data, which is released when the last copy
+   * goes away.
+   *
+   * Where the platform supports it, files of `map_threshold` bytes or more
+   * are memory mapped read-only, so that only the pages actually touched are
+   * read, and processes that load the same keyboard share those pages.
+   * Smaller files are read in, so that they can be replaced freely.
+   */
+  class blob
+  {
+    std::shared_ptr<const uint8_t> _data;
+    size_t                         _size = 0;
+
+  public:
+    // Most keyboards are much smaller than this, and gain little from mapping
+    static constexpr size_t map_threshold = 1024 * 1024;
+
+    blob() = default;
+    blob(std::shared_ptr<const uint8_t> data, size_t size) : _data(std::move(data)), _size(size) {}
+
+    /**
+     * Map a file read-only into memory, or read it in if it is smaller than
+     * `map_threshold` or mapping is not available.
+     *
+     * A mapped file must not be modified while the blob is in use: the data
+     * would change under the keyboard that was loaded and verified from it,
+     * and reading beyond the end of a truncated file faults. Replace the file
+     * instead, by writing a new file and renaming it over the old one. On
+     * Windows the file cannot be written to, but can be renamed or deleted.
+     *
+     * @return  an empty blob if the file could not be opened or is empty
+     */
+    static blob map_file(path const & filename);
+
+    /**
+     * Copy a buffer supplied by the caller, who keeps ownership of it.
+     *
+     * @return  an empty blob if `data` is null or `size` is zero
+     */
+    static blob copy(void const * data, size_t size);
+
+    uint8_t const * data() const noexcept { return _data.get(); }
+    size_t          size() const noexcept { return _size; }
+    bool            empty() const noexcept { return !_data || _size == 0; }
+  };
+
+} // namespace core
+} // namespace km
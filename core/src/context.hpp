@@ -7,9 +7,10 @@
 */
 
 #pragma once
-#include <list>
-#include <vector>
 #include <cassert>
+#include <cstddef>
+#include <iterator>
+#include <vector>
 #include "keyman_core.h"
 
 // Forward declarations
@@ -19,20 +20,149 @@ namespace km {
 namespace core
 {
 
-// This will likely be replaced with a class implementing a more space
-// efficient data structure such as a ring buffer or bounded queue.
-class context: public std::list<km_core_context_item>
+/**
+ * The context is a ring buffer of context items. Its storage grows as needed,
+ * starting at `initial_capacity` items, and is reused as items are pushed and
+ * popped, so that doing so does not allocate once the context has reached its
+ * working size.
+ *
+ * Iterators are random access, so a suffix of the context is just
+ * `end() - n`.
+ */
+class context
 {
 public:
+  template<typename C, typename V>
+  class basic_iterator
+  {
+  public:
+    using iterator_category = std::random_access_iterator_tag;
+    using value_type        = km_core_context_item;
+    using difference_type   = ptrdiff_t;
+    using pointer           = V *;
+    using reference         = V &;
+
+    basic_iterator() = default;
+    basic_iterator(C * ctxt, difference_type i) : _ctxt(ctxt), _i(i) {}
+    // Allow iterator to const_iterator conversion
+    template<typename C2, typename V2>
+    basic_iterator(basic_iterator<C2, V2> const & rhs) : _ctxt(rhs._ctxt), _i(rhs._i) {}
+
+    reference operator*() const                   { return (*_ctxt)[_i]; }
+    pointer   operator->() const                  { return &(*_ctxt)[_i]; }
+    reference operator[](difference_type n) const { return (*_ctxt)[_i + n]; }
+
+    basic_iterator & operator++()    { ++_i; return *this; }
+    basic_iterator & operator--()    { --_i; return *this; }
+    basic_iterator   operator++(int) { auto r = *this; ++_i; return r; }
+    basic_iterator   operator--(int) { auto r = *this; --_i; return r; }
+    basic_iterator & operator+=(difference_type n) { _i += n; return *this; }
+    basic_iterator & operator-=(difference_type n) { _i -= n; return *this; }
+    basic_iterator   operator+(difference_type n) const { return basic_iterator(_ctxt, _i + n); }
+    basic_iterator   operator-(difference_type n) const { return basic_iterator(_ctxt, _i - n); }
+    friend basic_iterator operator+(difference_type n, basic_iterator const & it) { return it + n; }
+    difference_type  operator-(basic_iterator const & rhs) const { return _i - rhs._i; }
+
+    bool operator==(basic_iterator const & rhs) const { return _i == rhs._i; }
+    bool operator!=(basic_iterator const & rhs) const { return _i != rhs._i; }
+    bool operator<(basic_iterator const & rhs) const  { return _i < rhs._i; }
+    bool operator>(basic_iterator const & rhs) const  { return _i > rhs._i; }
+    bool operator<=(basic_iterator const & rhs) const { return _i <= rhs._i; }
+    bool operator>=(basic_iterator const & rhs) const { return _i >= rhs._i; }
+
+  private:
+    template<typename, typename> friend class basic_iterator;
+
+    C *             _ctxt = nullptr;
+    difference_type _i = 0;
+  };
+
+  using value_type             = km_core_context_item;
+  using size_type              = size_t;
+  using difference_type        = ptrdiff_t;
+  using reference              = value_type &;
+  using const_reference        = value_type const &;
+  using iterator               = basic_iterator<context, value_type>;
+  using const_iterator         = basic_iterator<context const, value_type const>;
+  using reverse_iterator       = std::reverse_iterator<iterator>;
+  using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+  // Matches the max_context reported by the keyboard processors, so that the
+  // context a keyboard can see fits without growing again
+  static constexpr size_type initial_capacity = 256;
+
   bool has_markers = true;
+  // Incremented by each of the context API functions that change the context,
+  // so that a keyboard processor that keeps its own copy of the context can
+  // tell when the context has been changed by something other than itself
+  uint32_t revision = 0;
+
+  size_type size() const noexcept  { return _size; }
+  bool      empty() const noexcept { return _size == 0; }
+
+  reference       operator[](size_type i)       { return _items[slot(i)]; }
+  const_reference operator[](size_type i) const { return _items[slot(i)]; }
+
+  reference       front()       { assert(!empty()); return (*this)[0]; }
+  const_reference front() const { assert(!empty()); return (*this)[0]; }
+  reference       back()        { assert(!empty()); return (*this)[_size - 1]; }
+  const_reference back() const  { assert(!empty()); return (*this)[_size - 1]; }
+
+  iterator               begin() noexcept        { return iterator(this, 0); }
+  const_iterator         begin() const noexcept  { return const_iterator(this, 0); }
+  iterator               end() noexcept          { return iterator(this, _size); }
+  const_iterator         end() const noexcept    { return const_iterator(this, _size); }
+  reverse_iterator       rbegin() noexcept       { return reverse_iterator(end()); }
+  const_reverse_iterator rbegin() const noexcept { return const_reverse_iterator(end()); }
+  reverse_iterator       rend() noexcept         { return reverse_iterator(begin()); }
+  const_reverse_iterator rend() const noexcept   { return const_reverse_iterator(begin()); }
+
+  void clear() noexcept { _head = _size = 0; }
+  void push_back(value_type const &);
+  void push_front(value_type const &);
+  void pop_back()  { assert(!empty()); _size--; }
+  void pop_front() { assert(!empty()); _head = slot(1); _size--; }
+
   void push_character(km_core_usv);
   void push_marker(uint32_t);
+
+private:
+  std::vector<value_type> _items;
+  size_type               _head = 0,
+                          _size = 0;
+
+  size_type slot(size_type i) const noexcept {
+    i += _head;
+    return i < _items.size() ? i : i - _items.size();
+  }
+  void reserve(size_type n);
 };
 
 
+inline
+void context::push_back(value_type const & item) {
+  if (_size == _items.size()) {
+    reserve(_size + 1);
+  }
+  _items[slot(_size)] = item;
+  _size++;
+}
+
+
+inline
+void context::push_front(value_type const & item) {
+  if (_size == _items.size()) {
+    reserve(_size + 1);
+  }
+  _head = _head == 0 ? _items.size() - 1 : _head - 1;
+  _items[_head] = item;
+  _size++;
+}
+
+
 inline
 void context::push_character(km_core_usv usv) {
-  emplace_back(km_core_context_item { KM_CORE_CT_CHAR, {0,}, {usv} });
+  push_back(km_core_context_item { KM_CORE_CT_CHAR, {0,}, {usv} });
 }
 
 
@@ -40,7 +170,7 @@ inline
 void context::push_marker(uint32_t marker) {
   assert(has_markers);
   if(!has_markers) return;
-  emplace_back(km_core_context_item { KM_CORE_CT_MARKER, {0,}, {marker} });
+  push_back(km_core_context_item { KM_CORE_CT_MARKER, {0,}, {marker} });
 }
 
 // Context helper functions
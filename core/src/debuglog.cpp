@@ -8,6 +8,16 @@
 #include <chrono>
 #include "debuglog.h"
 
+// Windows is left out because the writer thread would be joined under the
+// loader lock when the library is unloaded
+#if !defined(_MSC_VER) && !defined(__EMSCRIPTEN__)
+#define USE_LOG_WRITER
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
+
 namespace km {
 namespace core {
 namespace kmx {
@@ -340,8 +350,214 @@ GetTickCount()
   return (unsigned long) duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
 }
 
+/**
+ * \def LOG_MESSAGE_SIZ size of a formatted log line, including file and
+ * function names
+*/
+#define LOG_MESSAGE_SIZ 1024
+
+static void WriteLogMessage(KMX_BOOL toConsole, const char *message) {
+  if (toConsole) { // I3951
+    ::std::cout << message << ::std::endl; // OutputDebugStringA(windowinfo);
+  } else {
+#ifdef _USE_WINDOWS
+    ::std::cout << message << ::std::endl; // OutputDebugStringA(windowinfo);
+#else
+    syslog(LOG_DEBUG, "%s", message);
+#endif
+  }
+}
+
+#ifdef USE_LOG_WRITER
+
+/**
+ * Writes log messages on a background thread, so that logging from the
+ * keystroke path does not wait on the console or on syslog.
+ *
+ * Messages are passed through a bounded lock-free queue, after Dmitry Vyukov's
+ * bounded MPMC queue, with this thread as the only consumer. When the queue is
+ * full, messages are counted and dropped rather than blocking the caller. The
+ * writer thread sleeps while the queue is empty; a caller only takes the lock
+ * to wake it up.
+ */
+class LogWriter {
+public:
+  static const size_t QUEUE_SIZE = 512;  // must be a power of two
+
+  LogWriter();
+  ~LogWriter();
+
+  /** Returns FALSE if the writer has been shut down */
+  KMX_BOOL Write(KMX_BOOL toConsole, const char *message);
+  void Flush();
+
+private:
+  struct Slot {
+    std::atomic<size_t> sequence;
+    KMX_BOOL toConsole;
+    char message[LOG_MESSAGE_SIZ];
+  };
+
+  Slot m_slots[QUEUE_SIZE];
+  std::atomic<size_t> m_enqueuePos{0}, m_dequeuePos{0};
+  std::atomic<unsigned> m_dropped{0};
+  std::atomic<bool> m_started{false}, m_sleeping{false}, m_stopping{false};
+  std::once_flag m_startOnce;
+  std::thread m_thread;
+  std::mutex m_mutex;
+  std::condition_variable m_wake, m_drained;
+
+  void Run();
+  KMX_BOOL Drain();
+  KMX_BOOL IsEmpty();
+};
+
+// Set once the writer has been destroyed at exit, after which we log directly
+static std::atomic<bool> g_logWriterClosed{false};
+
+LogWriter::LogWriter() {
+  for (size_t i = 0; i < QUEUE_SIZE; i++) {
+    m_slots[i].sequence.store(i, std::memory_order_relaxed);
+  }
+}
+
+LogWriter::~LogWriter() {
+  g_logWriterClosed = true;
+  if (m_started) {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stopping = true;
+      m_sleeping = false;
+    }
+    m_wake.notify_one();
+    m_thread.join();
+  }
+}
+
+KMX_BOOL LogWriter::Write(KMX_BOOL toConsole, const char *message) {
+  if (m_stopping) {
+    return FALSE;
+  }
+
+  std::call_once(m_startOnce, [this] {
+    m_thread = std::thread(&LogWriter::Run, this);
+    m_started = true;
+  });
+
+  // Claim a slot
+  Slot *slot;
+  size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+  for (;;) {
+    slot = &m_slots[pos & (QUEUE_SIZE - 1)];
+    intptr_t dif = (intptr_t)slot->sequence.load(std::memory_order_acquire) - (intptr_t)pos;
+    if (dif == 0) {
+      if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (dif < 0) {
+      // The queue is full
+      m_dropped++;
+      return TRUE;
+    } else {
+      pos = m_enqueuePos.load(std::memory_order_relaxed);
+    }
+  }
+
+  slot->toConsole = toConsole;
+  strncpy(slot->message, message, LOG_MESSAGE_SIZ - 1);
+  slot->message[LOG_MESSAGE_SIZ - 1] = 0;
+  slot->sequence.store(pos + 1, std::memory_order_release);
+
+  // Pairs with the fence in Run(), so that either we see that the writer is
+  // going to sleep, or it sees our message
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (m_sleeping.exchange(false)) {
+    { std::lock_guard<std::mutex> lock(m_mutex); }
+    m_wake.notify_one();
+  }
+  return TRUE;
+}
+
+void LogWriter::Flush() {
+  if (!m_started) {
+    return;
+  }
+  size_t target = m_enqueuePos.load();
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_drained.wait(lock, [this, target] { return m_dequeuePos.load() >= target || m_stopping; });
+}
+
+KMX_BOOL LogWriter::IsEmpty() {
+  size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+  return m_slots[pos & (QUEUE_SIZE - 1)].sequence.load(std::memory_order_acquire) != pos + 1;
+}
+
+KMX_BOOL LogWriter::Drain() {
+  KMX_BOOL any = FALSE, toConsole = g_debug_ToConsole;
+  for (;;) {
+    size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+    Slot &slot = m_slots[pos & (QUEUE_SIZE - 1)];
+    if (slot.sequence.load(std::memory_order_acquire) != pos + 1) {
+      break;
+    }
+    toConsole = slot.toConsole;
+    WriteLogMessage(toConsole, slot.message);
+    slot.sequence.store(pos + QUEUE_SIZE, std::memory_order_release);
+    m_dequeuePos.store(pos + 1, std::memory_order_release);
+    any = TRUE;
+  }
+
+  unsigned dropped = m_dropped.exchange(0);
+  if (dropped) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "DebugLog: %u messages dropped", dropped);
+    WriteLogMessage(toConsole, buf);
+  }
+  return any;
+}
+
+void LogWriter::Run() {
+  for (;;) {
+    while (Drain());
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_drained.notify_all();
+    if (m_stopping) {
+      // Anything logged while we were stopping
+      Drain();
+      return;
+    }
+
+    m_sleeping = true;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!IsEmpty()) {
+      m_sleeping = false;
+      continue;
+    }
+    m_wake.wait(lock, [this] { return !m_sleeping || m_stopping; });
+  }
+}
+
+static LogWriter &GetLogWriter() {
+  static LogWriter writer;
+  return writer;
+}
+
+#endif
+
+void DebugLogFlush() {
+#ifdef USE_LOG_WRITER
+  if (!g_logWriterClosed) {
+    GetLogWriter().Flush();
+  }
+#endif
+}
+
 int DebugLog_1(const char *file, int line, const char *function, const char *fmt, ...)
 {
+  if (!ShouldDebug())
+    return 0;
+
   char fmtbuf[256];
 
   va_list vars;
@@ -350,11 +566,8 @@ int DebugLog_1(const char *file, int line, const char *function, const char *fmt
   fmtbuf[255] = 0;
   va_end(vars);
 
-  if (!g_debug_KeymanLog)
-    return 0;
-
-  char windowinfo[1024];
-  snprintf(windowinfo, 1024,
+  char windowinfo[LOG_MESSAGE_SIZ];
+  snprintf(windowinfo, LOG_MESSAGE_SIZ,
           "%ld" TAB   //"TickCount" TAB
           "%s:%d" TAB //"SourceFile" TAB
           "%s" TAB    //"Function"
@@ -365,24 +578,18 @@ int DebugLog_1(const char *file, int line, const char *function, const char *fmt
           function,       //"Function" TAB
           fmtbuf);        //"Message"
 
-  if (g_debug_ToConsole) { // I3951
-    ::std::cout << windowinfo << ::std::endl; // OutputDebugStringA(windowinfo);
-  } else {
-#ifdef _USE_WINDOWS
-    ::std::cout << windowinfo << ::std::endl; // OutputDebugStringA(windowinfo);
-#else
-    syslog(LOG_DEBUG, "%s", windowinfo);
-#endif
+#ifdef USE_LOG_WRITER
+  if (!g_logWriterClosed && GetLogWriter().Write(g_debug_ToConsole, windowinfo)) {
+    return 0;
   }
+#endif
 
+  WriteLogMessage(g_debug_ToConsole, windowinfo);
   return 0;
 }
 
 const char *Debug_ModifierName(KMX_UINT modifiers) {
-#ifdef _MSC_VER
-  __declspec(thread)
-#endif
-  static char buf[256];
+  static thread_local char buf[256];
   buf[0] = 0;
   for(int i = 0; s_modifier_names[i].name; i++)
     if (modifiers & s_modifier_names[i].modifier) {
@@ -395,10 +602,7 @@ const char *Debug_ModifierName(KMX_UINT modifiers) {
 }
 
 const char *Debug_VirtualKey(KMX_WORD vk) {
-#ifdef _MSC_VER
-  __declspec(thread)
-#endif
-  static char buf[256];
+  static thread_local char buf[256];
   if (!ShouldDebug()) {
     return "";
   }
@@ -416,10 +620,7 @@ const char *Debug_UnicodeString(PKMX_WCHAR s, int x) {
   if (!ShouldDebug()) {
     return "";
   }
-#ifdef _MSC_VER
-  __declspec(thread)
-#endif
-  static char bufout[2][MEDIUM_BUF_SIZ];
+  static thread_local char bufout[2][MEDIUM_BUF_SIZ];
   KMX_WCHAR *p;
   char *q;
   bufout[x][0] = 0;
@@ -436,10 +637,7 @@ const char *Debug_UnicodeString(::std::u16string s, int x) {
   if (!ShouldDebug()) {
     return "";
   }
-#ifdef _MSC_VER
-  __declspec(thread)
-#endif
-  static char bufout[2][MEDIUM_BUF_SIZ];
+  static thread_local char bufout[2][MEDIUM_BUF_SIZ];
   auto p = s.begin();
   char *q;
   bufout[x][0] = 0;
@@ -455,10 +653,7 @@ const char *Debug_UnicodeString(::std::u32string s, int x) {
   if (!ShouldDebug()) {
     return "";
   }
-#ifdef _MSC_VER
-  __declspec(thread)
-#endif
-  static char bufout[2][MEDIUM_BUF_SIZ];
+  static thread_local char bufout[2][MEDIUM_BUF_SIZ];
   auto p = s.begin();
   char *q;
   bufout[x][0] = 0;
@@ -4,6 +4,19 @@
 
 #include <keyman/keyman_core_api_bits.h>
 
+/**
+ * Set KMX_DEBUGLOG to 1 to compile in DebugLog() calls. When it is 0, the
+ * calls and the evaluation of their arguments are removed by the compiler.
+ * By default, logging is only compiled into debug builds.
+ */
+#ifndef KMX_DEBUGLOG
+#ifdef DEBUG
+#define KMX_DEBUGLOG 1
+#else
+#define KMX_DEBUGLOG 0
+#endif
+#endif
+
 namespace km {
 namespace core {
 namespace kmx {
@@ -47,10 +60,21 @@ const char *Debug_UnicodeString(std::u16string s, int x = 0);
 const char *Debug_UnicodeString(std::u32string s, int x = 0);
 const char *Debug_ModifierName(KMX_UINT modifiers);
 
+/**
+ * Returns TRUE if DebugLog() is compiled in and g_debug_KeymanLog is set. The
+ * DebugLog macros check this before evaluating their arguments.
+ */
 inline KMX_BOOL ShouldDebug() {
-  return g_debug_KeymanLog;
+  return KMX_DEBUGLOG && g_debug_KeymanLog;
 }
 
+/**
+ * Waits until messages logged so far have been written out. Messages are
+ * written from a background thread where the platform supports it, so they
+ * may otherwise appear some time after the DebugLog() call.
+ */
+void DebugLogFlush();
+
 void write_console(KMX_BOOL error, const wchar_t *fmt, ...);
 
 }
@@ -55,10 +55,8 @@ void km::core::actions_dispose(
 }
 
 km_core_usv const *km::core::get_deleted_context(context const &app_context, unsigned int code_points_to_delete) {
-  auto p = app_context.end();
-  for(size_t i = code_points_to_delete; i > 0; i--, p--) {
-    assert(p != app_context.begin());
-  }
+  assert(code_points_to_delete <= app_context.size());
+  auto p = app_context.end() - code_points_to_delete;
 
   auto deleted_context = new km_core_usv[code_points_to_delete + 1];
   for(size_t i = 0; i < code_points_to_delete; i++) {
@@ -68,3 +66,16 @@ km_core_usv const *km::core::get_deleted_context(context const &app_context, uns
   deleted_context[code_points_to_delete] = 0;
   return deleted_context;
 }
+
+km_core_usv const *km::core::get_deleted_context(context const &app_context, unsigned int code_points_to_delete, std::vector<km_core_usv> &buffer) {
+  assert(code_points_to_delete <= app_context.size());
+  auto p = app_context.end() - code_points_to_delete;
+
+  buffer.resize(code_points_to_delete + 1);
+  for(size_t i = 0; i < code_points_to_delete; i++) {
+    buffer[i] = p->character;
+    p++;
+  }
+  buffer[code_points_to_delete] = 0;
+  return buffer.data();
+}
@@ -180,6 +180,7 @@ void km_core_context_clear(km_core_context *ctxt)
   if (ctxt)
   {
     ctxt->clear();
+    ctxt->revision++;
   }
 }
 
@@ -197,6 +198,7 @@ km_core_status context_append(km_core_context *ctxt,
   assert(ctxt); assert(ci);
   if (!ctxt || !ci)   return KM_CORE_STATUS_INVALID_ARGUMENT;
 
+  ctxt->revision++;
   try
   {
     for (;ci->type != KM_CORE_CT_END; ++ci)
@@ -205,7 +207,7 @@ km_core_status context_append(km_core_context *ctxt,
       if(ci->type == KM_CORE_CT_CHAR || ci->type == KM_CORE_CT_MARKER) {
         assert(ctxt->has_markers || ci->type != KM_CORE_CT_MARKER);
         if(ctxt->has_markers || ci->type != KM_CORE_CT_MARKER) {
-          ctxt->emplace_back(*ci);
+          ctxt->push_back(*ci);
         }
       }
     }
@@ -227,20 +229,25 @@ context_prepend(
   if (!ctxt || !ci)
     return KM_CORE_STATUS_INVALID_ARGUMENT;
 
+  ctxt->revision++;
+
+  // Find the end of the items to insert, then insert them from the last back
+  auto end = ci;
+  for (; end->type != KM_CORE_CT_END && num > 0; ++end) {
+    num--;
+  }
+
   try {
-    std::vector<km_core_context_item> vci;
-    for (; ci->type != KM_CORE_CT_END && num > 0; ++ci) {
-      num--;
-      assert(ci->type == KM_CORE_CT_CHAR || ci->type == KM_CORE_CT_MARKER);
-      if(ci->type == KM_CORE_CT_CHAR || ci->type == KM_CORE_CT_MARKER) {
-        assert(ctxt->has_markers || ci->type != KM_CORE_CT_MARKER);
-        if(ctxt->has_markers || ci->type != KM_CORE_CT_MARKER) {
-          vci.push_back(*ci);
+    while (end != ci) {
+      --end;
+      assert(end->type == KM_CORE_CT_CHAR || end->type == KM_CORE_CT_MARKER);
+      if(end->type == KM_CORE_CT_CHAR || end->type == KM_CORE_CT_MARKER) {
+        assert(ctxt->has_markers || end->type != KM_CORE_CT_MARKER);
+        if(ctxt->has_markers || end->type != KM_CORE_CT_MARKER) {
+          ctxt->push_front(*end);
         }
       }
     }
-
-    ctxt->insert(ctxt->begin(), vci.begin(), vci.end());
   } catch (std::bad_alloc &) {
     return KM_CORE_STATUS_NO_MEM;
   }
@@ -258,25 +265,20 @@ context_shrink(
   if (!ctxt)
     return KM_CORE_STATUS_INVALID_ARGUMENT;
 
+  ctxt->revision++;
+  num = std::min(num, ctxt->size());
   if (from_end) {
     // remove from the end
-    try {
-      ctxt->resize(ctxt->size() - std::min(num, ctxt->size()));
-    } catch (std::bad_alloc &) {
-      return KM_CORE_STATUS_NO_MEM;
+    while (num-- > 0) {
+      ctxt->pop_back();
+    }
+  } else {
+    // remove from the beginning
+    while (num-- > 0) {
+      ctxt->pop_front();
     }
-
-    return KM_CORE_STATUS_OK;
-  }
-
-  // remove from the beginning
-  auto it = ctxt->begin();
-  while (num > 0 && it != ctxt->end()) {
-    num--;
-    it++;
   }
 
-  ctxt->erase(ctxt->begin(), it);
   return KM_CORE_STATUS_OK;
 }
 
@@ -294,6 +296,19 @@ km_core_context_item_list_size(km_core_context_item const *context_items)
   return n;
 }
 
+void km::core::context::reserve(size_type n) {
+  if (n <= _items.size()) {
+    return;
+  }
+
+  // Grow geometrically
+  n = std::max({n, _items.size() * 2, size_type(initial_capacity)});
+  std::vector<value_type> items(begin(), end());
+  items.resize(n);
+  _items.swap(items);
+  _head = 0;
+}
+
 json & operator << (json & j, km::core::context const & ctxt) {
   j << json::array;
   for (auto & i: ctxt)  j << i;
@@ -9,12 +9,13 @@
                                     into keyboard.hpp
 */
 #include <cassert>
-#include <vector>
 
 #include "keyman_core.h"
 
 #include "keyboard.hpp"
 #include "processor.hpp"
+#include "blob.hpp"
+#include "kmx_file.h"
 #include "kmx/kmx_processor.hpp"
 #include "ldml/ldml_processor.hpp"
 #include "mock/mock_processor.hpp"
@@ -23,16 +24,31 @@ using namespace km::core;
 
 namespace
 {
-  abstract_processor * processor_factory(path const & kb_path) {
+  ldml::compile_mode compile_mode(uint32_t flags) {
+    if (flags & KM_CORE_KEYBOARD_LOAD_LAZY) {
+      return ldml::compile_mode::lazy;
+    }
+    if (flags & KM_CORE_KEYBOARD_LOAD_PARALLEL) {
+      return ldml::compile_mode::parallel;
+    }
+    return ldml::compile_mode::serial;
+  }
+
+  abstract_processor * processor_factory(path const & kb_path, blob const & data, uint32_t flags = KM_CORE_KEYBOARD_LOAD_DEFAULT) {
+    if (data.size() >= KMX_MAX_ALLOWED_FILE_SIZE) {
+      return new null_processor();
+    }
+    if (ldml_processor::is_kmxplus_file(data)) {
+      return new ldml_processor(kb_path, data, compile_mode(flags));
+    }
+    return new kmx_processor(kb_path, data);
+  }
+
+  abstract_processor * processor_factory(path const & kb_path, uint32_t flags = KM_CORE_KEYBOARD_LOAD_DEFAULT) {
     // Some legacy packages may include upper-case file extensions
-    // TODO-LDML: move file io out of core and into engine
     if (kb_path.suffix() == ".kmx" || kb_path.suffix() == ".KMX") {
-      std::vector<uint8_t> buf;
-      if(ldml_processor::is_kmxplus_file(kb_path, buf)) {
-        abstract_processor * result = new ldml_processor(kb_path, buf);
-        return result;
-      }
-      return new kmx_processor(kb_path);
+      // The file is read once; both processors work from the same data
+      return processor_factory(kb_path, blob::map_file(kb_path), flags);
     }
     else if (kb_path.suffix() == ".mock") {
       return new mock_processor(kb_path);
@@ -42,8 +58,17 @@ namespace
     }
   }
 
-
+  km_core_status load_keyboard(abstract_processor *kp, km_core_keyboard **keyboard) {
+    km_core_status status = kp->validate();
+    if (status != KM_CORE_STATUS_OK) {
+      delete kp;
+      return status;
+    }
+    *keyboard = static_cast<km_core_keyboard *>(kp);
+    return KM_CORE_STATUS_OK;
+  }
 }
+
 km_core_status
 km_core_keyboard_load(km_core_path_name kb_path, km_core_keyboard **keyboard)
 {
@@ -53,19 +78,50 @@ km_core_keyboard_load(km_core_path_name kb_path, km_core_keyboard **keyboard)
 
   try
   {
-    abstract_processor *kp = processor_factory(kb_path);
-    km_core_status status = kp->validate();
-    if (status != KM_CORE_STATUS_OK) {
-      delete kp;
-      return status;
-    }
-    *keyboard = static_cast<km_core_keyboard *>(kp);
+    return load_keyboard(processor_factory(kb_path), keyboard);
+  }
+  catch (std::bad_alloc &)
+  {
+    return KM_CORE_STATUS_NO_MEM;
+  }
+}
+
+km_core_status
+km_core_keyboard_load_with_flags(km_core_path_name kb_path, uint32_t flags, km_core_keyboard **keyboard)
+{
+  assert(keyboard);
+  if (!keyboard)
+    return KM_CORE_STATUS_INVALID_ARGUMENT;
+
+  try
+  {
+    return load_keyboard(processor_factory(kb_path, flags), keyboard);
+  }
+  catch (std::bad_alloc &)
+  {
+    return KM_CORE_STATUS_NO_MEM;
+  }
+}
+
+km_core_status
+km_core_keyboard_load_from_blob(
+  km_core_path_name kb_name,
+  void const *blob,
+  size_t blob_size,
+  km_core_keyboard **keyboard
+) {
+  assert(kb_name); assert(blob); assert(keyboard);
+  if (!kb_name || !blob || !blob_size || !keyboard)
+    return KM_CORE_STATUS_INVALID_ARGUMENT;
+
+  try
+  {
+    return load_keyboard(processor_factory(kb_name, km::core::blob::copy(blob, blob_size)), keyboard);
   }
   catch (std::bad_alloc &)
   {
     return KM_CORE_STATUS_NO_MEM;
   }
-  return KM_CORE_STATUS_OK;
 }
 
 void
@@ -47,7 +47,7 @@ km_core_state_option_lookup(km_core_state const *state,
 
   auto & processor = state->processor();
 
-  *value_out = processor.lookup_option(km_core_option_scope(scope), key);
+  *value_out = processor.lookup_option(*state, km_core_option_scope(scope), key);
   if (!*value_out)  return KM_CORE_STATUS_KEY_ERROR;
 
   return KM_CORE_STATUS_OK;
@@ -70,6 +70,7 @@ km_core_state_options_update(km_core_state *state, km_core_option_item const *op
         return KM_CORE_STATUS_INVALID_ARGUMENT;
 
       if (processor.update_option(
+            *state,
             km_core_option_scope(opt->scope),
             opt->key,
             opt->value).empty())
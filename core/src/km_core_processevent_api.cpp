@@ -37,6 +37,9 @@ km_core_event(
       return KM_CORE_STATUS_INVALID_ARGUMENT;
   }
 
+  // The keyboard processor may change the cached context without going
+  // through the context API
+  state->invalidate_app_context_mirror();
   return state->processor().external_event(state, event, data);
 }
 
@@ -50,6 +53,13 @@ km_core_process_event(km_core_state *state,
   if(state == nullptr) {
     return KM_CORE_STATUS_INVALID_ARGUMENT;
   }
+
+  // Key-ups and bare modifier keys make up much of the stream of events, and
+  // usually change nothing, so the processor gets to skip them up front
+  if(state->processor().process_no_op_event(state, vk, modifier_state, is_key_down, event_flags)) {
+    return KM_CORE_STATUS_OK;
+  }
+
   km_core_status status = state->processor().process_event(state, vk, modifier_state, is_key_down, event_flags);
 
   state->apply_actions_and_merge_app_context();
@@ -65,6 +75,7 @@ km_core_process_queued_actions(
   if(state == nullptr) {
     return KM_CORE_STATUS_INVALID_ARGUMENT;
   }
+  state->invalidate_app_context_mirror();
   return state->processor().process_queued_actions(state);
 }
 
@@ -65,6 +65,53 @@ void km_core_state_dispose(km_core_state *state)
 }
 
 
+km_core_status km_core_state_snapshot(km_core_state const *state,
+                                      km_core_snapshot ** out)
+{
+  assert(state); assert(out);
+  if (!state || !out)
+    return KM_CORE_STATUS_INVALID_ARGUMENT;
+
+  try
+  {
+    std::unique_ptr<km_core_snapshot> snapshot(new km_core_snapshot());
+    state->snapshot(*snapshot);
+    *out = snapshot.release();
+  }
+  catch (std::bad_alloc &)
+  {
+    return KM_CORE_STATUS_NO_MEM;
+  }
+  return KM_CORE_STATUS_OK;
+}
+
+
+km_core_status km_core_state_restore(km_core_state *state,
+                                     km_core_snapshot const *snapshot)
+{
+  assert(state); assert(snapshot);
+  if (!state || !snapshot)
+    return KM_CORE_STATUS_INVALID_ARGUMENT;
+
+  try
+  {
+    if (!state->restore(*snapshot))
+      return KM_CORE_STATUS_INVALID_ARGUMENT;
+  }
+  catch (std::bad_alloc &)
+  {
+    return KM_CORE_STATUS_NO_MEM;
+  }
+  return KM_CORE_STATUS_OK;
+}
+
+
+void km_core_snapshot_dispose(km_core_snapshot *snapshot)
+{
+  delete snapshot;
+}
+
+
 km_core_context *km_core_state_context(km_core_state const *state)
 {
   assert(state);
@@ -91,7 +138,7 @@ km_core_status km_core_state_get_intermediate_context(
     return KM_CORE_STATUS_INVALID_ARGUMENT;
   }
   auto & processor = state->processor();
-  *context_items = processor.get_intermediate_context();
+  *context_items = processor.get_intermediate_context(state);
 
   return KM_CORE_STATUS_OK;
 }
@@ -7,7 +7,10 @@
   History:      15 Jan 2024 - MCD - Refactor our km_core_state_context_set_if_needed
                                     and implement normalization
 */
+#include <algorithm>
 #include <cassert>
+#include <cstring>
+#include <string>
 
 #include "keyman_core.h"
 
@@ -39,10 +42,15 @@ typedef struct {
 
 // Forward declarations
 
+bool set_context_from_mirror(km_core_state *state, km_core_cp const *new_context, size_t new_length, km_core_context_status &status);
+void update_mirror(km_core_state *state, km_core_cp const *new_context, size_t new_length);
 bool replace_context(context_change_result context_change, km_core_context *context, km_core_cp const *new_context);
 bool should_normalize(km_core_state *state);
-context_change_result get_context_change(km_core_cp const *new_context, km_core_context *context);
-context_change_result get_context_items_change(km_core_context_item *new_context_items, km_core_context_item *context_items);
+context_change_result get_context_change(km_core_cp const *new_context, size_t new_length, km_core_context *context);
+size_t count_code_points(km_core_cp const *text, size_t length);
+bool is_valid_utf16(km_core_cp const *text, size_t length);
+bool prepend_utf16(km_core_context *context, km_core_cp const *text, size_t length);
+void drop_chars_from_front(km_core_context *context, size_t chars);
 
 bool do_normalize_nfd(km_core_cp const * src, std::u16string &dst);
 km_core_context_status do_fail(km_core_context *app_context, km_core_context *cached_context, const char* error);
@@ -68,10 +76,23 @@ km_core_state_context_set_if_needed(
 
   auto app_context    = km_core_state_app_context(state);
   auto cached_context = km_core_state_context(state);
+  size_t const new_length = std::char_traits<km_core_cp>::length(new_app_context);
+
+  if (!is_valid_utf16(new_app_context, new_length)) {
+    return do_fail(app_context, cached_context, "new app context has an unpaired surrogate");
+  }
+
+  // Usually the app passes the same text as last time, with the output of
+  // any events since applied, which the mirror of the app context follows
+
+  km_core_context_status status;
+  if (set_context_from_mirror(state, new_app_context, new_length, status)) {
+    return status;
+  }
 
   // Compare the internal app context with the passed-in application context
 
-  auto context_change = get_context_change(new_app_context, app_context);
+  auto context_change = get_context_change(new_app_context, new_length, app_context);
   if (context_change.type != CONTEXT_UNCHANGED) {
     // We replace the internal app context with the passed-in application context
     if (!replace_context(context_change, app_context, new_app_context)) {
@@ -92,19 +113,23 @@ km_core_state_context_set_if_needed(
 
   std::u16string normalized_buffer;
   km_core_cp const *new_cached_context = nullptr;
+  size_t new_cached_length = 0;
 
   if (should_normalize(state)) {
     if (!do_normalize_nfd(new_app_context, normalized_buffer)) {
       return do_fail(app_context, cached_context, "could not normalize string");
     }
     new_cached_context = normalized_buffer.c_str();
+    new_cached_length = normalized_buffer.length();
   } else {
     new_cached_context = new_app_context;
+    new_cached_length = new_length;
   }
 
-  context_change = get_context_change(new_cached_context, cached_context);
+  context_change = get_context_change(new_cached_context, new_cached_length, cached_context);
   if (context_change.type == CONTEXT_UNCHANGED) {
     // We keep the context as is
+    update_mirror(state, new_app_context, new_length);
     return KM_CORE_CONTEXT_STATUS_UNCHANGED;
   }
 
@@ -121,9 +146,149 @@ km_core_state_context_set_if_needed(
     }
   }
 
+  update_mirror(state, new_app_context, new_length);
   return KM_CORE_CONTEXT_STATUS_UPDATED;
 }
 
+/**
+ * Updates both contexts from the mirror of the app context, if the new app
+ * context is the same text as the mirror, or differs from it only by text
+ * added or removed at the start. Then only the text added or removed is
+ * normalized, and nothing is allocated at all if the text is unchanged.
+ *
+ * Returns false, leaving the contexts untouched, if they must be compared in
+ * full instead.
+ */
+bool
+set_context_from_mirror(
+  km_core_state *state,
+  km_core_cp const *new_context,
+  size_t new_length,
+  km_core_context_status &status
+) {
+  if (!state->app_context_mirror_valid()) {
+    return false;
+  }
+
+  auto &mirror        = state->app_context_mirror();
+  auto app_context    = km_core_state_app_context(state);
+  auto cached_context = km_core_state_context(state);
+  size_t const old_length = mirror.text.length();
+
+  if (new_length == 0 || old_length == 0) {
+    // An empty app context always needs updating
+    return false;
+  }
+
+  size_t const common = std::min(new_length, old_length);
+  if (memcmp(new_context + new_length - common, mirror.text.data() + old_length - common,
+             common * sizeof(km_core_cp)) != 0) {
+    return false;
+  }
+
+  if (app_context->size() != mirror.code_points) {
+    // The app context no longer holds the text of the mirror
+    return false;
+  }
+
+  if (new_length == old_length) {
+    status = KM_CORE_CONTEXT_STATUS_UNCHANGED;
+    return true;
+  }
+
+  km_core_cp const *common_start = new_context + new_length - common;
+  if (Uni_IsSurrogate2(*common_start)) {
+    // The text added or removed ends in the middle of a surrogate pair
+    return false;
+  }
+
+  const icu::Normalizer2 *nfd = nullptr;
+  if (should_normalize(state)) {
+    UErrorCode icu_status = U_ZERO_ERROR;
+    nfd = icu::Normalizer2::getNFDInstance(icu_status);
+    assert(U_SUCCESS(icu_status));
+    if (!U_SUCCESS(icu_status)) {
+      return false;
+    }
+    // The common text must normalize the same whatever comes before it
+    km_core_usv first = *common_start;
+    if (Uni_IsSurrogate1(first) && common > 1 && Uni_IsSurrogate2(common_start[1])) {
+      first = Uni_SurrogateToUTF32(first, common_start[1]);
+    }
+    if (!nfd->hasBoundaryBefore(first)) {
+      return false;
+    }
+  }
+
+  if (new_length > old_length) {
+    // Text added at the start of the app context
+    size_t const head_length = new_length - old_length;
+    if (!prepend_utf16(app_context, new_context, head_length)) {
+      status = do_fail(app_context, cached_context, "could not prepend new app context");
+      return true;
+    }
+    bool prepended;
+    if (nfd) {
+      UErrorCode icu_status = U_ZERO_ERROR;
+      icu::UnicodeString head = nfd->normalize(icu::UnicodeString(false, new_context, (int32_t)head_length), icu_status);
+      assert(U_SUCCESS(icu_status));
+      if (!U_SUCCESS(icu_status)) {
+        status = do_fail(app_context, cached_context, "could not normalize string");
+        return true;
+      }
+      prepended = prepend_utf16(cached_context, head.getBuffer(), head.length());
+    } else {
+      prepended = prepend_utf16(cached_context, new_context, head_length);
+    }
+    if (!prepended) {
+      status = do_fail(app_context, cached_context, "could not prepend new cached context");
+      return true;
+    }
+  } else {
+    // Text removed from the start of the app context
+    size_t const head_length = old_length - new_length;
+    if (!is_valid_utf16(mirror.text.data(), head_length)) {
+      // Keyboard output in the mirror may not be valid UTF-16
+      return false;
+    }
+    size_t const head_code_points = count_code_points(mirror.text.data(), head_length);
+    drop_chars_from_front(app_context, head_code_points);
+    if (nfd) {
+      UErrorCode icu_status = U_ZERO_ERROR;
+      icu::UnicodeString head = nfd->normalize(icu::UnicodeString(false, mirror.text.data(), (int32_t)head_length), icu_status);
+      assert(U_SUCCESS(icu_status));
+      if (!U_SUCCESS(icu_status)) {
+        status = do_fail(app_context, cached_context, "could not normalize string");
+        return true;
+      }
+      drop_chars_from_front(cached_context, count_code_points(head.getBuffer(), head.length()));
+    } else {
+      drop_chars_from_front(cached_context, head_code_points);
+    }
+  }
+
+  app_context->revision++;
+  cached_context->revision++;
+  update_mirror(state, new_context, new_length);
+  status = KM_CORE_CONTEXT_STATUS_UPDATED;
+  return true;
+}
+
+/**
+ * Makes `new_context` the mirror of the app context, once both contexts have
+ * been updated from it
+ */
+void
+update_mirror(km_core_state *state, km_core_cp const *new_context, size_t new_length) {
+  auto &mirror = state->app_context_mirror();
+  mirror.text.assign(new_context, new_length);
+  mirror.code_points = count_code_points(new_context, new_length);
+  state->sync_app_context_mirror();
+  if (!should_normalize(state)) {
+    state->sync_app_context();
+  }
+}
+
 bool
 replace_context(
   context_change_result context_change,
@@ -135,13 +300,19 @@ replace_context(
       return false;
     }
   } else if (context_change.type == CONTEXT_SHORTER) {
-    km_core_context_item *new_context_items = nullptr;
-    if (context_items_from_utf16(new_context, &new_context_items) != KM_CORE_STATUS_OK ||
-        context_prepend(context, new_context_items, context_change.end_difference) != KM_CORE_STATUS_OK) {
-      km_core_context_items_dispose(new_context_items);
+    // Prepend the first end_difference code points of the new context
+    size_t length = 0;
+    for (uint32_t n = context_change.end_difference; n > 0 && new_context[length]; n--) {
+      length += (Uni_IsSurrogate1(new_context[length]) && Uni_IsSurrogate2(new_context[length + 1])) ? 2 : 1;
+    }
+    try {
+      if (!prepend_utf16(context, new_context, length)) {
+        return false;
+      }
+    } catch (std::bad_alloc &) {
       return false;
     }
-    km_core_context_items_dispose(new_context_items);
+    context->revision++;
   } else {
     assert(context_change.type == CONTEXT_LONGER);
     if (context_shrink(context, context_change.end_difference, false) != KM_CORE_STATUS_OK) {
@@ -158,38 +329,17 @@ bool should_normalize(km_core_state *state) {
   return state->processor().supports_normalization();
 }
 
-/**
- * Returns the previous context item that is a character skipping any
- * markers, or NULL if there are no more characters before to
- * `context_items`.
- */
-km_core_context_item const *
-context_previous_char(
-  km_core_context_item const *context_items,
-  km_core_context_item const *context_start
-) {
-  if (context_items == context_start) {
-    return NULL;
-  }
-  while (context_items > context_start) {
-    context_items--;
-    if (context_items->type == KM_CORE_CT_CHAR) {
-      return context_items;
-    }
-    // skip over marker
-  }
-  return NULL;
-}
-
 /**
  * Analyzes the difference between existing context and a new context string
  * retrieved from the application, and returns the type of change and the
  * number of context items affected by the change (including markers if they
- * are in the original context).
+ * are in the original context). The two are compared from the end, code point
+ * by code point, skipping over any markers in the existing context.
  */
 context_change_result
 get_context_change(
   km_core_cp const *new_context_string,
+  size_t new_length,
   km_core_context *context
 ) {
   context_change_result change_type({CONTEXT_DIFFERENT, 0});
@@ -199,90 +349,120 @@ get_context_change(
     return change_type;
   }
 
-  km_core_context_item *new_context_items = nullptr;
-  km_core_context_item *context_items = nullptr;
-
-  if(context_items_from_utf16(new_context_string, &new_context_items) == KM_CORE_STATUS_OK) {
-    if(km_core_context_get(context, &context_items) == KM_CORE_STATUS_OK) {
-      change_type = get_context_items_change(new_context_items, context_items);
-    }
-  }
-
-  km_core_context_items_dispose(new_context_items);
-  km_core_context_items_dispose(context_items);
-
-  return change_type;
-}
-
-/**
- * Analyzes the difference between existing context items array and a new
- * context items array retrieved from the application, and returns the type of
- * change and the number of context items affected by the change (including
- * markers if they are in the original context).
- */
-context_change_result
-get_context_items_change(
-  km_core_context_item *new_context_items,
-  km_core_context_item *context_items
-) {
-  int n = 0;
-  km_core_context_item const *context_p = nullptr, *new_context_p = nullptr;
-
-  context_change_result change_type({CONTEXT_DIFFERENT, 0});
-
-  if(context_items->type == KM_CORE_CT_END) {
+  if (context->empty()) {
     // If the app_context is "empty" then it needs updating
     return change_type;
   }
 
-  // move to the end of the new and internal app context
-  new_context_p = new_context_items;
-  while (new_context_p->type != KM_CORE_CT_END) {
-    new_context_p++;
-  }
+  size_t new_p = new_length;
+  size_t context_p = context->size();
 
-  context_p = context_items;
-  while (context_p->type != KM_CORE_CT_END) {
-    context_p++;
-  }
+  for (;;) {
+    // Move to the previous character in each, skipping markers
+    while (context_p > 0 && (*context)[context_p - 1].type != KM_CORE_CT_CHAR) {
+      context_p--;
+    }
+    if (new_p == 0 || context_p == 0) {
+      break;
+    }
 
-  // Move to last character for each pointer
-  new_context_p = context_previous_char(new_context_p, new_context_items);
-  context_p = context_previous_char(context_p, context_items);
+    km_core_usv ch = new_context_string[--new_p];
+    if (Uni_IsSurrogate2(ch) && new_p > 0 && Uni_IsSurrogate1(new_context_string[new_p - 1])) {
+      new_p--;
+      ch = Uni_SurrogateToUTF32(new_context_string[new_p], ch);
+    }
+    context_p--;
 
-  // we need to compare from the end of the cached context
-  for (; new_context_p != NULL && context_p != NULL;
-        new_context_p = context_previous_char(new_context_p, new_context_items),
-        context_p = context_previous_char(context_p, context_items)) {
-    if (new_context_p->character != context_p->character) {
+    if (ch != (*context)[context_p].character) {
       // The cached context doesn't match the application context
       return change_type;
     }
   }
 
-  if (context_p == NULL && new_context_p == NULL) {
+  if (context_p == 0 && new_p == 0) {
     // new and internal app contexts are identical
     change_type.type = CONTEXT_UNCHANGED;
     return change_type;
   }
 
-  if (context_p >= context_items) {
-    for (n = 1; context_p > context_items; context_p--) {
-      n++;
-    }
+  if (context_p > 0) {
     change_type.type = CONTEXT_LONGER;
-    change_type.end_difference = n;
+    change_type.end_difference = (uint32_t) context_p;
     return change_type;
   }
 
-  for (n = 1; new_context_p > new_context_items; new_context_p--) {
-    n++;
-  }
   change_type.type = CONTEXT_SHORTER;
-  change_type.end_difference = n;
+  change_type.end_difference = (uint32_t) count_code_points(new_context_string, new_p);
   return change_type;
 }
 
+/**
+ * Returns the number of code points in a UTF-16 string
+ */
+size_t
+count_code_points(km_core_cp const *text, size_t length) {
+  size_t n = length;
+  for (size_t i = 1; i < length; i++) {
+    if (Uni_IsSurrogate2(text[i]) && Uni_IsSurrogate1(text[i - 1])) {
+      n--;
+    }
+  }
+  return n;
+}
+
+/**
+ * Returns true if a UTF-16 string has no unpaired surrogates
+ */
+bool
+is_valid_utf16(km_core_cp const *text, size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    if (Uni_IsSurrogate1(text[i]) && i + 1 < length && Uni_IsSurrogate2(text[i + 1])) {
+      i++;
+    } else if (Uni_IsSurrogate(text[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Inserts the characters of a UTF-16 string at the start of the context,
+ * dropping those that do not fit. The caller bumps the context's revision.
+ *
+ * Returns false, leaving the context untouched, if the string has an unpaired
+ * surrogate.
+ */
+bool
+prepend_utf16(km_core_context *context, km_core_cp const *text, size_t length) {
+  if (!is_valid_utf16(text, length)) {
+    return false;
+  }
+  while (length > 0) {
+    km_core_usv ch = text[--length];
+    if (Uni_IsSurrogate2(ch) && length > 0 && Uni_IsSurrogate1(text[length - 1])) {
+      length--;
+      ch = Uni_SurrogateToUTF32(text[length], ch);
+    }
+    context->push_front(km_core_context_item{KM_CORE_CT_CHAR, {0,}, {ch}});
+  }
+  return true;
+}
+
+/**
+ * Removes items from the start of the context up to and including the
+ * `chars`th character, along with any markers before it. The caller bumps the
+ * context's revision.
+ */
+void
+drop_chars_from_front(km_core_context *context, size_t chars) {
+  while (chars > 0 && !context->empty()) {
+    if (context->front().type == KM_CORE_CT_CHAR) {
+      chars--;
+    }
+    context->pop_front();
+  }
+}
+
 /**
  * Normalize the input string using ICU
  */
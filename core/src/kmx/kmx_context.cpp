@@ -24,6 +24,7 @@ void KMX_Context::Add(KMX_WCHAR ch)
     auto n = (int)(p - CurContext);
     memmove(CurContext, p, (MAXCONTEXT - n) * sizeof(KMX_WCHAR));
     pos -= n;
+    truncated = TRUE;
   }
 
   CurContext[pos++] = ch;
@@ -77,6 +78,7 @@ void KMX_Context::Reset()
   DebugLog("KMX_Context::Reset");
   pos = 0;
   CurContext[0] = 0;
+  truncated = FALSE;
 }
 
 void KMX_Context::Get(KMX_WCHAR *buf, int bufsize)
@@ -100,10 +102,11 @@ void KMX_Context::CopyFrom(KMX_Context *source)   // I3575
   DebugLog("KMX_Context::CopyFrom source=%s; before copy, dest=%s", Debug_UnicodeString(source->CurContext, 0), Debug_UnicodeString(CurContext, 1));
   u16cpy(CurContext, /*_countof(CurContext),*/ source->CurContext);
   pos = source->pos;
+  truncated = source->truncated;
 }
 
 
-void KMX_Context::Set(const KMX_WCHAR *buf)
+void KMX_Context::Set(const KMX_WCHAR *buf, KMX_BOOL bufTruncated)
 {
   DebugLog("KMX_Context::Set(): ENTER [%d]: (%d) %s", pos, u16len(CurContext), Debug_UnicodeString(CurContext, 1));
   DebugLog("                                (%d) %s", u16len(buf), Debug_UnicodeString(buf));
@@ -126,6 +129,8 @@ void KMX_Context::Set(const KMX_WCHAR *buf)
     p = incxstr((KMX_WCHAR*)p);
   }
 
+  truncated = bufTruncated || p > buf;
+
   for(q = CurContext; *p; p++, q++)
   {
     *q = *p;
@@ -18,6 +18,7 @@ class KMX_Context
 private:
   KMX_WCHAR CurContext[MAXCONTEXT];
   int pos;
+  KMX_BOOL truncated;
 
 public:
   KMX_Context();
@@ -63,8 +64,9 @@ public:
    *  Sets the CurContext to the supplied buf character array and updates the pos index.
    *
    * @param buf
+   * @param bufTruncated  TRUE if buf is only the end of a longer context
    */
-  void Set(const KMX_WCHAR *buf);
+  void Set(const KMX_WCHAR *buf, KMX_BOOL bufTruncated = FALSE);
 
   /**
    * Returns a pointer to the character in the current context buffer which
@@ -115,6 +117,14 @@ public:
    * @return  BOOL
    */
   KMX_BOOL IsEmpty();
+
+  /**
+   * Returns TRUE if the start of the context has been dropped to fit it into
+   * CurContext, by Set or by Add. Deleting from a truncated context does not
+   * bring back the dropped characters.
+   * @return  BOOL
+   */
+  KMX_BOOL IsTruncated() { return truncated; }
 };
 
 } // namespace kmx
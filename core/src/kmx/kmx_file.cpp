@@ -5,17 +5,17 @@
 #include "kmx_processevent.h"
 #include <assert.h>
 #include "kmx_file_validator.hpp"
+#include "blob.hpp"
 
 using namespace km::core;
 using namespace kmx;
 
-#if defined(_WIN32) || defined(_WIN64)
-#include <share.h>
-#endif
-
-KMX_BOOL KMX_ProcessEvent::Load(km_core_path_name KeyboardName)
+KMX_BOOL KMX_Keyboard::Load(blob const & data)
 {
-  if(!LoadKeyboard(KeyboardName, &m_keyboard.Keyboard)) return FALSE;   // I5136
+  if(!LoadKeyboard(data, &m_keyboard)) return FALSE;   // I5136
+
+  m_ruleIndex.Build(m_keyboard);
+  m_storeIndex.Build(m_keyboard);
 
   return TRUE;
 }
@@ -53,127 +53,94 @@ static_assert(sizeof(CODE__SIZE) / sizeof(CODE__SIZE[0]) == (CODE_LASTCODE + 1),
 
 
 
-KMX_BOOL KMX_ProcessEvent::LoadKeyboard(km_core_path_name fileName, LPKEYBOARD *lpKeyboard)
+KMX_BOOL KMX_Keyboard::LoadKeyboard(blob const & data, LPKEYBOARD *lpKeyboard)
 {
-  PKMX_BYTE buf;
-  FILE *fp;
   LPKEYBOARD kbp;
   PKMX_BYTE filebase;
 
-  DebugLog("Loading file '%s'", fileName);
-  if(!fileName || !lpKeyboard)
+  if(!lpKeyboard)
   {
-    DebugLog("Bad Filename");
+    DebugLog("Bad parameter");
     return FALSE;
   }
 
-#if defined(_WIN32) || defined(_WIN64)
-  fp = _wfsopen(fileName, L"rb", _SH_DENYWR);
-#else
-  fp = fopen(fileName, "rb");
-#endif
-  if(fp == NULL)
+  // The keyboard data is read-only and never copied: strings are referenced
+  // directly in it, so when it is a file mapping, its pages are only read
+  // when touched, and are shared with any other process that loads the same
+  // keyboard. VerifyKeyboard checks every offset we read through.
+  if(data.empty())
   {
-    DebugLog("Could not open file");
-    return FALSE;
-  }
-
-  if (fseek(fp, 0, SEEK_END) != 0) {
-    fclose(fp);
-    DebugLog("Could not fseek file");
-    return FALSE;
-  }
-
-  auto sz = ftell(fp);
-  if (sz < 0) {
-    fclose(fp);
-    return FALSE;
-  }
-
-  if (fseek(fp, 0, SEEK_SET) != 0) {
-    fclose(fp);
-    DebugLog("Could not fseek(set) file");
+    DebugLog("No keyboard data");
     return FALSE;
   }
 
-#ifdef KMX_64BIT
-  // allocate enough memory for expanded data structure + original data.
-  // Expanded data structure is double the size of data on disk (8-byte
-  // pointers) - on disk the "pointers" are relative to the beginning of
-  // the file.
-  // We save the original data at the end of buf; we don't copy strings, so
-  // those will remain in the location at the end of the buffer.
-  buf = new KMX_BYTE[sz * 3];
-#else
-  buf = new KMX_BYTE[sz];
-#endif
-
-  if(!buf)
+  size_t sz = data.size();
+  if(sz < sizeof(COMP_KEYBOARD))
   {
-    fclose(fp);
-    DebugLog("Not allocmem");
-    return FALSE;
-  }
-#ifdef KMX_64BIT
-  filebase = buf + sz*2;
-#else
-  filebase = buf;
-#endif
-
-  if (fread(filebase, 1, sz, fp) < (size_t) sz) {
-    fclose(fp);
-    DebugLog("Could not read file");
+    DebugLog("Invalid file - too small");
     return FALSE;
   }
 
-  fclose(fp);
+  filebase = const_cast<PKMX_BYTE>(data.data());
 
   if(*PKMX_DWORD(filebase) != KMX_DWORD(FILEID_COMPILED))
   {
-    delete [] buf;
     DebugLog("Invalid file - signature is invalid");
     return FALSE;
   }
 
   if(!VerifyKeyboard(filebase, sz)) return FALSE;
 
-#ifdef KMX_64BIT
-  kbp = CopyKeyboard(buf, filebase);
-#else
-  kbp = FixupKeyboard(buf, filebase);
-#endif
+  kbp = CopyKeyboard(filebase);
 
   if(!kbp) return FALSE;
 
   if(kbp->dwIdentifier != FILEID_COMPILED) {
-    delete [] buf;
+    delete [] (PKMX_BYTE) kbp;
     DebugLog("errNotFileID");
     return FALSE;
   }
 
+  m_keyboardTables.reset((PKMX_BYTE) kbp);
+  m_keyboardData = data;
   *lpKeyboard = kbp;
 
   return TRUE;
 }
 
-PKMX_WCHAR KMX_ProcessEvent::StringOffset(PKMX_BYTE base, KMX_DWORD offset)
+PKMX_WCHAR KMX_Keyboard::StringOffset(PKMX_BYTE base, KMX_DWORD offset)
 {
   if(offset == 0) return NULL;
   return (PKMX_WCHAR)(base + offset);
 }
 
-#ifdef KMX_64BIT
 /**
-  CopyKeyboard will copy the data read into bufp from x86-sized structures into
-  x64-sized structures starting at `base`
-  * After this function finishes, we still need to keep the original data because
-    we don't copy the strings
-  This method is used on 64-bit architectures.
+  CopyKeyboard builds the pointer-based KEYBOARD, STORE, GROUP and KEY tables
+  from the offset-based structures in the file at `base`. Only the tables are
+  allocated; strings are not copied, so the file data must be kept for as
+  long as the keyboard is loaded.
+
+  The file data is read-only, so even on 32-bit architectures, where the
+  structures are the same size, we cannot fix up pointers in place.
 */
-LPKEYBOARD KMX_ProcessEvent::CopyKeyboard(PKMX_BYTE bufp, PKMX_BYTE base)
+LPKEYBOARD KMX_Keyboard::CopyKeyboard(PKMX_BYTE base)
 {
   PCOMP_KEYBOARD ckbp = (PCOMP_KEYBOARD) base;
 
+  /* Size the tables exactly */
+
+  KMX_DWORD i, cxKeys = 0;
+  PCOMP_GROUP cgp = (PCOMP_GROUP)(base + ckbp->dpGroupArray);
+  for(i = 0; i < ckbp->cxGroupArray; i++, cgp++) {
+    cxKeys += cgp->cxKeyArray;
+  }
+
+  PKMX_BYTE bufp = new KMX_BYTE[
+    sizeof(KEYBOARD) +
+    sizeof(STORE) * ckbp->cxStoreArray +
+    sizeof(GROUP) * ckbp->cxGroupArray +
+    sizeof(KEY) * cxKeys];
+
   /* Copy keyboard structure */
 
   LPKEYBOARD kbp = (LPKEYBOARD) bufp;
@@ -200,7 +167,6 @@ LPKEYBOARD KMX_ProcessEvent::CopyKeyboard(PKMX_BYTE bufp, PKMX_BYTE base)
 
   PCOMP_STORE csp;
   LPSTORE sp;
-  KMX_DWORD i;
 
   for(
     csp = (PCOMP_STORE)(base + ckbp->dpStoreArray), sp = kbp->dpStoreArray, i = 0;
@@ -212,7 +178,6 @@ LPKEYBOARD KMX_ProcessEvent::CopyKeyboard(PKMX_BYTE bufp, PKMX_BYTE base)
     sp->dpString = StringOffset(base, csp->dpString);
   }
 
-  PCOMP_GROUP cgp;
   LPGROUP gp;
 
   for(
@@ -248,53 +213,26 @@ LPKEYBOARD KMX_ProcessEvent::CopyKeyboard(PKMX_BYTE bufp, PKMX_BYTE base)
   return kbp;
 }
 
-#else
+
+static KMX_BOOL IsRangeInFile(KMX_DWORD offset, KMX_DWORD count, size_t itemSize, std::size_t sz)
+{
+  return (uint64_t) offset + (uint64_t) count * itemSize <= sz;
+}
+
 /**
- Fixup the keyboard by expanding pointers. On disk the pointers are stored relative to the
- beginning of the file, but we need real pointers. This method is used on 32-bit architectures.
+  Returns TRUE if the string at `offset` is null, or is terminated within the
+  file
 */
-LPKEYBOARD KMX_ProcessEvent::FixupKeyboard(PKMX_BYTE bufp, PKMX_BYTE base)
+static KMX_BOOL IsStringInFile(const PKMX_BYTE filebase, KMX_DWORD offset, std::size_t sz)
 {
-  KMX_DWORD i, j;
-  PCOMP_KEYBOARD ckbp = (PCOMP_KEYBOARD) base;
-  PCOMP_GROUP cgp;
-  PCOMP_STORE csp;
-  PCOMP_KEY ckp;
-  LPKEYBOARD kbp = (LPKEYBOARD) bufp;
-  LPSTORE sp;
-  LPGROUP gp;
-  LPKEY kp;
-
-  kbp->dpStoreArray = (LPSTORE) (base + ckbp->dpStoreArray);
-  kbp->dpGroupArray = (LPGROUP) (base + ckbp->dpGroupArray);
-
-  for(sp = kbp->dpStoreArray, csp = (PCOMP_STORE) sp, i = 0; i < kbp->cxStoreArray; i++, sp++, csp++)
-  {
-    sp->dpName = StringOffset(base, csp->dpName);
-    sp->dpString = StringOffset(base, csp->dpString);
+  if(offset == 0) return TRUE;
+  for(uint64_t p = offset; p + sizeof(KMX_WCHAR) <= sz; p += sizeof(KMX_WCHAR)) {
+    if(*(PKMX_WCHAR)(filebase + p) == 0) return TRUE;
   }
-
-  for(gp = kbp->dpGroupArray, cgp = (PCOMP_GROUP) gp, i = 0; i < kbp->cxGroupArray; i++, gp++, cgp++)
-  {
-    gp->dpName = StringOffset(base, cgp->dpName);
-    gp->dpKeyArray = cgp->cxKeyArray > 0 ? (LPKEY) (base + cgp->dpKeyArray) : NULL;
-    gp->dpMatch = StringOffset(base, cgp->dpMatch);
-    gp->dpNoMatch = StringOffset(base, cgp->dpNoMatch);
-
-    for(kp = gp->dpKeyArray, ckp = (PCOMP_KEY) kp, j = 0; j < gp->cxKeyArray; j++, kp++, ckp++)
-    {
-      kp->dpOutput = StringOffset(base, ckp->dpOutput);
-      kp->dpContext = StringOffset(base, ckp->dpContext);
-    }
-  }
-
-  return kbp;
+  return FALSE;
 }
 
-#endif
-
-
-KMX_BOOL KMX_ProcessEvent::VerifyKeyboard(PKMX_BYTE filebase, size_t sz)
+KMX_BOOL KMX_Keyboard::VerifyKeyboard(PKMX_BYTE filebase, size_t sz)
 {
   KMX_FileValidator *ckbp = reinterpret_cast<KMX_FileValidator*>(filebase);
 
@@ -302,12 +240,17 @@ KMX_BOOL KMX_ProcessEvent::VerifyKeyboard(PKMX_BYTE filebase, size_t sz)
 }
 
 
-KMX_BOOL KMX_FileValidator::VerifyKeyboard(std::size_t _kmn_unused(sz)) const
+KMX_BOOL KMX_FileValidator::VerifyKeyboard(std::size_t sz) const
 {
   KMX_DWORD i;
   PCOMP_STORE csp;
   const PKMX_BYTE filebase = (KMX_BYTE*)this;
 
+  if(!IsRangeInFile(dpStoreArray, cxStoreArray, sizeof(COMP_STORE), sz)) {
+    DebugLog("Invalid store array");
+    return FALSE;
+  }
+
   /* Check file version */
 
   if(dwFileVersion < VERSION_MIN ||
@@ -317,10 +260,10 @@ KMX_BOOL KMX_FileValidator::VerifyKeyboard(std::size_t _kmn_unused(sz)) const
     for(csp = (PCOMP_STORE)(filebase + dpStoreArray), i = 0; i < cxStoreArray; i++, csp++) {
       if(csp->dwSystemID == TSS_COMPILEDVERSION)
       {
-        if(csp->dpString == 0)
+        if(csp->dpString == 0 || !IsStringInFile(filebase, csp->dpString, sz))
           DebugLog("errWrongFileVersion:NULL");
         else
-          DebugLog("errWrongFileVersion:%10.10ls", KMX_ProcessEvent::StringOffset(filebase, csp->dpString));
+          DebugLog("errWrongFileVersion:%10.10ls", KMX_Keyboard::StringOffset(filebase, csp->dpString));
         return FALSE;
       }
     }
@@ -339,7 +282,48 @@ KMX_BOOL KMX_FileValidator::VerifyKeyboard(std::size_t _kmn_unused(sz)) const
     return FALSE;
   }
 
-  // TODO: verify many other offsets such as stores, groups, keys, strings!
+  // Verify that the group and key arrays are within the file; these are read
+  // in place, through their offsets
+
+  if(!IsRangeInFile(dpGroupArray, cxGroupArray, sizeof(COMP_GROUP), sz)) {
+    DebugLog("Invalid group array");
+    return FALSE;
+  }
+
+  PCOMP_GROUP cgp;
+  for(cgp = (PCOMP_GROUP)(filebase + dpGroupArray), i = 0; i < cxGroupArray; i++, cgp++) {
+    if(!IsRangeInFile(cgp->dpKeyArray, cgp->cxKeyArray, sizeof(COMP_KEY), sz)) {
+      DebugLog("Invalid key array in group %d", i);
+      return FALSE;
+    }
+  }
+
+  // Verify that every string is terminated within the file, as strings are
+  // also read in place
+
+  for(csp = (PCOMP_STORE)(filebase + dpStoreArray), i = 0; i < cxStoreArray; i++, csp++) {
+    if(!IsStringInFile(filebase, csp->dpName, sz) || !IsStringInFile(filebase, csp->dpString, sz)) {
+      DebugLog("Invalid string in store %d", i);
+      return FALSE;
+    }
+  }
+
+  for(cgp = (PCOMP_GROUP)(filebase + dpGroupArray), i = 0; i < cxGroupArray; i++, cgp++) {
+    if(!IsStringInFile(filebase, cgp->dpName, sz) ||
+       !IsStringInFile(filebase, cgp->dpMatch, sz) ||
+       !IsStringInFile(filebase, cgp->dpNoMatch, sz)) {
+      DebugLog("Invalid string in group %d", i);
+      return FALSE;
+    }
+
+    PCOMP_KEY ckp = (PCOMP_KEY)(filebase + cgp->dpKeyArray);
+    for(KMX_DWORD j = 0; j < cgp->cxKeyArray; j++, ckp++) {
+      if(!IsStringInFile(filebase, ckp->dpOutput, sz) || !IsStringInFile(filebase, ckp->dpContext, sz)) {
+        DebugLog("Invalid string in key %d of group %d", j, i);
+        return FALSE;
+      }
+    }
+  }
 
   return TRUE;
 }
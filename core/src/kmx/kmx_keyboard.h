@@ -0,0 +1,55 @@
+/*
+  Copyright:        © SIL International.
+  Description:      Loaded KMX keyboard, shared read-only between states
+  Create Date:      17 Oct 2026
+*/
+
+#pragma once
+
+#include <memory>
+#include "blob.hpp"
+#include "kmx_base.h"
+#include "kmx_rule_index.h"
+#include "kmx_store_index.h"
+
+namespace km {
+namespace core {
+namespace kmx {
+
+/**
+ * The rules of a KMX keyboard and the lookup tables built from them. This is
+ * loaded once per keyboard and never modified afterwards, so it can be used
+ * by any number of `KMX_ProcessEvent` instances, on any number of threads.
+ *
+ * Option values and other run-time changes to stores are made by each
+ * `KMX_ProcessEvent` in its own copy of the store array.
+ */
+class KMX_Keyboard
+{
+private:
+  // The keyboard file data and the tables built from it
+  blob m_keyboardData;
+  std::unique_ptr<KMX_BYTE[]> m_keyboardTables;
+
+  LPKEYBOARD m_keyboard = nullptr;
+  KMX_RuleIndex m_ruleIndex;
+  KMX_StoreIndex m_storeIndex;
+
+  KMX_BOOL LoadKeyboard(blob const & data, LPKEYBOARD *lpKeyboard);
+  KMX_BOOL VerifyKeyboard(PKMX_BYTE filebase, size_t sz);
+  LPKEYBOARD CopyKeyboard(PKMX_BYTE base);
+
+public:
+  KMX_BOOL Load(blob const & data);
+
+  KEYBOARD const *GetKeyboard() const { return m_keyboard; }
+  KMX_RuleIndex const &GetRuleIndex() const { return m_ruleIndex; }
+  KMX_StoreIndex const &GetStoreIndex() const { return m_storeIndex; }
+
+  // Utility function
+  static PKMX_WCHAR StringOffset(PKMX_BYTE base, KMX_DWORD offset);
+};
+
+} // namespace kmx
+} // namespace core
+} // namespace km
@@ -2,7 +2,6 @@
   Copyright:        Copyright (C) 2003-2018 SIL International.
   Authors:          mcdurdin
 */
-#include "processor.hpp"
 #include "kmx_processevent.h"
 #include <option.hpp>
 
@@ -41,7 +40,7 @@ void KMX_Options::AddOptionsStoresFromXString(PKMX_WCHAR s) {
   }
 }
 
-void KMX_Options::Load(abstract_processor & ap, std::u16string const &key) {
+void KMX_Options::Load(std::u16string const &key) {
   LPSTORE sp;
   auto i = 0U;
 
@@ -53,7 +52,7 @@ void KMX_Options::Load(abstract_processor & ap, std::u16string const &key) {
     if (_kp->KeyboardOptions[i].OriginalStore != NULL
         && sp->dpName != NULL
         && u16icmp(sp->dpName, key.c_str()) == 0) {
-      Reset(ap, i);
+      Reset(i);
       return;
     }
   }
@@ -173,7 +172,7 @@ void KMX_Options::Set(int nStoreToSet, int nStoreToRead)
   Set(nStoreToSet, rStoreToReadValue);
 }
 
-void KMX_Options::Reset(abstract_processor & ap, int nStoreToReset)
+void KMX_Options::Reset(int nStoreToReset)
 {
   assert(_kp != NULL);
   assert(_kp->Keyboard != NULL);
@@ -192,9 +191,9 @@ void KMX_Options::Reset(abstract_processor & ap, int nStoreToReset)
 
   if(rStoreToReset.dpName == nullptr) return;
 
-  // Now we need to go back and get any saved value from KPAPI. internal_value is owned by options api
-  auto i = ap.persisted_store().find(rStoreToReset.dpName);
-  if(i != ap.persisted_store().end()) {
+  // Now we need to go back and get any saved value from KPAPI
+  auto i = m_persisted.find(rStoreToReset.dpName);
+  if(i != m_persisted.end()) {
     // Copy the value from KPAPI
     rOptionToReset.Value = new KMX_WCHAR[i->second.size() + 1];
     u16cpy(rOptionToReset.Value, /*u16len(val) + 1,*/ i->second.c_str());
@@ -215,3 +214,18 @@ void KMX_Options::Save(int nStoreToSave)
   if (rStoreToSave.dpName == nullptr) return;
   m_actions.QueueAction(QIT_SAVEOPT, nStoreToSave);
 }
+
+void KMX_Options::CopyFrom(KMX_Options const &other)
+{
+  assert(_kp != NULL);
+  assert(_kp->KeyboardOptions != NULL);
+  assert(other._kp->KeyboardOptions != NULL);
+  assert(_kp->Keyboard->cxStoreArray == other._kp->Keyboard->cxStoreArray);
+
+  for(KMX_DWORD i = 0; i < _kp->Keyboard->cxStoreArray; i++) {
+    if(other._kp->KeyboardOptions[i].Value) {
+      Set(i, other._kp->KeyboardOptions[i].Value);
+    }
+  }
+  m_persisted = other.m_persisted;
+}
@@ -2,6 +2,7 @@
 #pragma once
 
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "keyman_core.h"
@@ -12,9 +13,6 @@
 
 namespace km {
 namespace core {
-
-class abstract_processor;
-
 namespace kmx {
 
 class KMX_Options
@@ -23,6 +21,8 @@ private:
   LPINTKEYBOARDINFO _kp;
   KMX_DebugItems *m_debug_items;
   KMX_Actions& m_actions;
+  // Values saved with save(), or set by the host, which reset() returns to
+  std::unordered_map<std::u16string, std::u16string> m_persisted;
 
   void AddOptionsStoresFromXString(PKMX_WCHAR s);
 
@@ -35,13 +35,16 @@ public:
   ~KMX_Options();
 
   void Init(std::vector<option> &opts);
-  void Load(abstract_processor &, std::u16string const &key);
+  void Load(std::u16string const &key);
   char16_t const * LookUp(std::u16string const &key) const;
   void Set(int nStoreToSet, int nStoreToRead);
   void Set(int nStoreToSet, std::u16string const &value);
   void Set(std::u16string const &key, std::u16string const &value);
-  void Reset(abstract_processor &, int nStoreToReset);
+  void Reset(int nStoreToReset);
   void Save(int nStoreToSave);
+  void CopyFrom(KMX_Options const &other);
+
+  std::unordered_map<std::u16string, std::u16string> & PersistedStore() { return m_persisted; }
 
   void SetInternalDebugItems(KMX_DebugItems *debug_items) {
     m_debug_items = debug_items;
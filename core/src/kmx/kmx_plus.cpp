@@ -4,6 +4,7 @@
   Implementation for the KMX Plus utilities
 */
 
+#include <algorithm>
 #include <km_types.h>
 #include <kmx_file.h>
 #include <kmx/kmx_plus.h>
@@ -1100,39 +1101,59 @@ COMP_KMXPLUS_USET_Helper::setUset(const COMP_KMXPLUS_USET *newUset) {
   return is_valid;
 }
 
-SimpleUSet::SimpleUSet(const COMP_KMXPLUS_USET_RANGE *newRange, size_t newCount)  {
+SimpleUSet::SimpleUSet(const COMP_KMXPLUS_USET_RANGE *newRange, size_t newCount) : ranges(), bmp(), is_valid(true) {
+  std::vector<std::pair<km_core_usv, km_core_usv>> sorted;
   for (size_t i = 0; i < newCount; i++) {
-    ranges.emplace_back(newRange[i].start, newRange[i].end);
+    if (!Uni_IsValid(newRange[i].start, newRange[i].end)) {
+      DebugLog("Invalid UnicodeSet (contains noncharacters): [U+%04X,U+%04X]", (int)newRange[i].start, (int)newRange[i].end);
+      is_valid = false;
+    }
+    if (newRange[i].start <= newRange[i].end) {
+      sorted.emplace_back(newRange[i].start, newRange[i].end);
+    }
+  }
+  // sort and merge, so that contains() can binary search
+  std::sort(sorted.begin(), sorted.end());
+  for (const auto &range : sorted) {
+    if (!ranges.empty() && range.first <= ranges.back().end + 1) {
+      ranges.back().end = std::max(ranges.back().end, range.second);
+    } else {
+      ranges.emplace_back(range.first, range.second);
+    }
+  }
+
+  if (ranges.size() >= BITMAP_MIN_RANGES) {
+    bmp.resize(0x10000 / 64);
+    for (const auto &range : ranges) {
+      for (km_core_usv ch = range.start; ch <= range.end && ch < 0x10000; ch++) {
+        bmp[ch / 64] |= (uint64_t)1 << (ch % 64);
+      }
+    }
   }
 }
 
-SimpleUSet::SimpleUSet() {
+SimpleUSet::SimpleUSet() : ranges(), bmp(), is_valid(true) {
 }
 
 bool SimpleUSet::contains(km_core_usv ch) const {
-  for (const auto &range : ranges) {
-    if (range.start <= ch && range.end >= ch) {
-      return true;
-    }
+  if (ch < 0x10000 && !bmp.empty()) {
+    return (bmp[ch / 64] >> (ch % 64)) & 1;
   }
-  return false;
+  // find the last range starting at or before ch
+  auto range = std::upper_bound(ranges.begin(), ranges.end(), ch, [](km_core_usv c, const COMP_KMXPLUS_USET_RANGE &r) {
+    return c < r.start;
+  });
+  return range != ranges.begin() && ch <= (--range)->end;
 }
 
 bool
 SimpleUSet::valid() const {
-  // double check
-  for (const auto &range : ranges) {
-    if (!Uni_IsValid(range.start, range.end)) {
-      DebugLog("Invalid UnicodeSet (contains noncharacters): [U+%04X,U+%04X]", (int)range.start, (int)range.end);
-      return false;
-    }
-  }
-  return true;
+  return is_valid;
 }
 
 void
 SimpleUSet::dump() const {
-  DebugLog(" - USet size=%d", ranges.size());
+  DebugLog(" - USet size=%d%s", ranges.size(), bmp.empty() ? "" : " (bitmap)");
   for (const auto &range : ranges) {
     if (range.start == range.end) {
       DebugLog("  - [U+%04X]", (uint32_t)range.start);
@@ -1142,14 +1163,20 @@ SimpleUSet::dump() const {
   }
 }
 
-SimpleUSet
+std::shared_ptr<const SimpleUSet>
 COMP_KMXPLUS_USET_Helper::getUset(KMXPLUS_USET i) const {
   if (!valid() || i >= uset->usetCount) {
     assert(false);
-    return SimpleUSet(nullptr, 0); // empty set
+    return std::make_shared<const SimpleUSet>(nullptr, 0); // empty set
+  }
+  if (built.size() < uset->usetCount) {
+    built.resize(uset->usetCount);
+  }
+  if (!built[i]) {
+    auto &set = usets[i];
+    built[i] = std::make_shared<const SimpleUSet>(getRange(set.range), set.count);
   }
-  auto &set = usets[i];
-  return SimpleUSet(getRange(set.range), set.count);
+  return built[i];
 }
 
 const COMP_KMXPLUS_USET_RANGE *
@@ -11,8 +11,9 @@
 #include <kmx/kmx_base.h>
 #include <kmx_file.h>
 #include <ldml/keyman_core_ldml.h>
-#include <list>
 #include <deque>
+#include <memory>
+#include <vector>
 
 namespace km {
 namespace core {
@@ -686,8 +687,16 @@ class SimpleUSet {
     /** debugging */
     void dump() const;
     bool valid() const;
+    /** the ranges in the set, sorted and merged, for building other lookups from it */
+    const std::vector<COMP_KMXPLUS_USET_RANGE> &get_ranges() const { return ranges; }
   private:
-    std::list<COMP_KMXPLUS_USET_RANGE> ranges;
+    /** sets with at least this many ranges also get a BMP bitmap */
+    static const size_t BITMAP_MIN_RANGES = 16;
+    /** sorted by start, with overlapping and adjacent ranges merged */
+    std::vector<COMP_KMXPLUS_USET_RANGE> ranges;
+    /** one bit per BMP code point, or empty */
+    std::vector<uint64_t> bmp;
+    bool is_valid;
 };
 
 class COMP_KMXPLUS_USET_Helper {
@@ -700,7 +709,11 @@ public:
   bool setUset(const COMP_KMXPLUS_USET *newUset);
   inline bool valid() const { return is_valid; }
 
-  SimpleUSet getUset(KMXPLUS_USET list) const;
+  /**
+   * Get a uset, which is built on first use and then shared by every caller
+   * @return the set, or an empty set if the index is invalid
+   */
+  std::shared_ptr<const SimpleUSet> getUset(KMXPLUS_USET list) const;
   const COMP_KMXPLUS_USET_RANGE *getRange(KMX_DWORD index) const;
 
 private:
@@ -708,6 +721,8 @@ private:
   bool is_valid;
   const COMP_KMXPLUS_USET_USET *usets;
   const COMP_KMXPLUS_USET_RANGE *ranges;
+  /** sets already built, by index. Keyboard loading is single threaded. */
+  mutable std::vector<std::shared_ptr<const SimpleUSet>> built;
 };
 
 static_assert(sizeof(struct COMP_KMXPLUS_USET) % 0x4 == 0, "Structs prior to variable part should align to 32-bit boundary");
@@ -19,7 +19,15 @@ KMX_BOOL km::core::kmx::g_silent = FALSE;
 * KMX_ProcessEvent
 */
 
-KMX_ProcessEvent::KMX_ProcessEvent() : m_actions(&m_context), m_options(&m_keyboard, m_actions) {
+KMX_ProcessEvent::KMX_ProcessEvent(KMX_Keyboard const &kmx)
+  : m_kmx(kmx), m_actions(&m_context), m_options(&m_keyboard, m_actions) {
+  KEYBOARD const *kbd = kmx.GetKeyboard();
+  assert(kbd);
+  m_keyboardHeader = *kbd;
+  m_stores.assign(kbd->dpStoreArray, kbd->dpStoreArray + kbd->cxStoreArray);
+  m_keyboardHeader.dpStoreArray = m_stores.data();
+  m_keyboard.Keyboard = &m_keyboardHeader;
+
   m_indexStack = new KMX_WORD[GLOBAL_ContextStackSize];
   m_miniContext = new KMX_WCHAR[GLOBAL_ContextStackSize];
   m_miniContextIfLen = 0;
@@ -180,14 +188,7 @@ KMX_BOOL KMX_ProcessEvent::ProcessGroup(LPGROUP gp, KMX_BOOL *pOutputKeystroke)
 
   LPKEYBOARD kbd = m_keyboard.Keyboard;
 
-  sdmfI = -1;
-
-  for (i = 0; i < kbd->cxGroupArray; i++) {
-    if (gp == &kbd->dpGroupArray[i]) {
-      sdmfI = i;
-      break;
-    }
-  }
+  sdmfI = gp ? (int)(gp - kbd->dpGroupArray) : -1;
 
   /*
    If the number of nested groups goes higher than 50, then break out - this is
@@ -213,14 +214,34 @@ KMX_BOOL KMX_ProcessEvent::ProcessGroup(LPGROUP gp, KMX_BOOL *pOutputKeystroke)
     2. A normal key rule (WM_CHAR), where the key to be matched is an Ascii char.
     3. A rule in a keyless group, where only the context is matched.
 
-   The loop goes through and checks the rules like that.  This loop could be optimized
-   with standard searching techniques - the ContextMatch may be difficult.
+   The loop goes through and checks the rules like that.  For groups using keys,
+   the rule index built at load time gives us just the rules whose key could match
+   this keystroke, in their original order, so we only test context on those.
   */
 
   DebugLog("m_state.vkey: %s shiftFlags: %x; charCode: %X", Debug_VirtualKey(m_state.vkey), m_modifiers, m_state.charCode);   // I4582
   DebugLog("m_context: %s",  Debug_UnicodeString(m_context.GetFullContext()));
 
-  if(gp)
+  if(gp && m_kmx.GetRuleIndex().IsIndexed(sdmfI))
+  {
+    KMX_BOOL found = FALSE;
+    KMX_RuleIndex::Candidates candidates = m_kmx.GetRuleIndex().Find(sdmfI, m_state.vkey, m_state.charCode);
+    while(!found && candidates.Next(i))
+    {
+      kkp = &gp->dpKeyArray[i];
+
+      /* Keyman 6.0: support Virtual Characters */
+      if(IsEquivalentShift(kkp->ShiftFlags, m_modifiers))
+      {
+        if(kkp->Key != m_state.vkey) continue;   // I3438   // I4582   // I4169
+      }
+      else if(kkp->ShiftFlags != 0 || kkp->Key != m_state.charCode || m_state.charCode == 0) continue;
+
+      found = ContextMatch(kkp);
+    }
+    if(!found) i = gp->cxKeyArray;
+  }
+  else if(gp)
   {
     for(kkp = gp->dpKeyArray, i=0; i < gp->cxKeyArray; i++, kkp++)
     {
@@ -434,7 +455,8 @@ int KMX_ProcessEvent::PostString(PKMX_WCHAR str, LPKEYBOARD lpkb, PKMX_WCHAR end
   PKMX_WCHAR p, q, temp;
   LPSTORE s;
   int n1, n2;
-  int i, n;
+  int i;
+  KMX_WORD index;
   KMX_BOOL FoundUse = FALSE;
   // TODO: Refactor to use incxstr
   for(p = str; *p && (p < endstr || !endstr); p++)
@@ -491,11 +513,12 @@ int KMX_ProcessEvent::PostString(PKMX_WCHAR str, LPKEYBOARD lpkb, PKMX_WCHAR end
         break;
       case CODE_INDEX:
         p++;
-        s = &m_keyboard.Keyboard->dpStoreArray[*p - 1];
+        n1 = *p - 1;
+        s = &m_keyboard.Keyboard->dpStoreArray[n1];
         p++;
 
-        n = m_indexStack[*p - 1];
-        for(temp = s->dpString; *temp && n > 0; temp = incxstr(temp), n--);
+        index = m_indexStack[*p - 1];
+        temp = m_kmx.GetStoreIndex().At(n1, s, index);
         PostString(temp, lpkb, incxstr(temp), pOutputKeystroke);
         break;
       case CODE_SETOPT:
@@ -508,7 +531,7 @@ int KMX_ProcessEvent::PostString(PKMX_WCHAR str, LPKEYBOARD lpkb, PKMX_WCHAR end
       case CODE_RESETOPT:
         p++;
         n1 = *p - 1;
-        GetOptions()->Reset(m_core_state->processor(), n1);
+        GetOptions()->Reset(n1);
         break;
       case CODE_SAVEOPT:
         p++;
@@ -598,6 +621,7 @@ KMX_BOOL KMX_ProcessEvent::IsMatchingPlatform(LPSTORE s)  // I3432
 KMX_BOOL KMX_ProcessEvent::ContextMatch(LPKEY kkp)
 {
   KMX_WORD /*i,*/ n;
+  int index;
   PKMX_WCHAR p, q, qbuf, temp;
   PKMX_WORD indexp;
   LPSTORE s, t;
@@ -685,10 +709,10 @@ KMX_BOOL KMX_ProcessEvent::ContextMatch(LPKEY kkp)
       case CODE_ANY:
         s = &m_keyboard.Keyboard->dpStoreArray[(*(p+2))-1];
 
-        temp = xstrchr(s->dpString, q);
+        temp = m_kmx.GetStoreIndex().Find((*(p+2))-1, s, q, &index);
 
         if(temp != NULL)
-          *indexp = (KMX_WORD) xstrpos(temp, s->dpString);
+          *indexp = (KMX_WORD) index;
 
         else
           return FALSE;
@@ -696,7 +720,7 @@ KMX_BOOL KMX_ProcessEvent::ContextMatch(LPKEY kkp)
       case CODE_NOTANY:
         s = &m_keyboard.Keyboard->dpStoreArray[(*(p+2))-1];
 
-        if((temp = xstrchr(s->dpString, q)) != NULL)
+        if((temp = m_kmx.GetStoreIndex().Find((*(p+2))-1, s, q, &index)) != NULL)
           return FALSE;
 
         break;
@@ -704,7 +728,7 @@ KMX_BOOL KMX_ProcessEvent::ContextMatch(LPKEY kkp)
         s = &m_keyboard.Keyboard->dpStoreArray[(*(p+2))-1];
         *indexp = n = m_indexStack[(*(p+3))-1];
 
-        for(temp = s->dpString; *temp && n > 0; temp = incxstr(temp), n--);
+        temp = m_kmx.GetStoreIndex().At((*(p+2))-1, s, n);
         if(n != 0) return FALSE;
         if(xchrcmp(temp, q) != 0) return FALSE;
         break;
@@ -764,13 +788,6 @@ INTKEYBOARDINFO const *KMX_ProcessEvent::GetKeyboard() const {
 }
 
 
-KMX_BOOL KMX_ProcessEvent::ReleaseKeyboardMemory(LPKEYBOARD kbd)
-{
-  if (!kbd) return TRUE;
-  delete kbd;
-  return TRUE;
-}
-
 PKMX_WCHAR KMX_ProcessEvent::GetSystemStore(LPKEYBOARD kb, KMX_DWORD SystemID)
 {
   for (KMX_DWORD i = 0; i < kb->cxStoreArray; i++)
@@ -11,6 +11,7 @@
 #include <assert.h>
 #include <string>
 #include <string.h>
+#include <vector>
 #include <keyman/keyman_core_api_bits.h>
 #include "debuglog.h"
 #include "kmx_base.h"
@@ -23,6 +24,7 @@
 #include "kmx_options.h"
 #include "kmx_environment.h"
 #include "kmx_debugger.h"
+#include "kmx_keyboard.h"
 
 /***************************************************************************/
 
@@ -34,8 +36,21 @@ namespace kmx {
 
 #define GLOBAL_ContextStackSize 80
 
+/**
+ * Processes events against a loaded keyboard. This holds everything that
+ * changes while processing: the context, the action queue, option values
+ * and the environment, so each state needs its own instance, while the
+ * keyboard itself is shared.
+ */
 class KMX_ProcessEvent {
 private:
+  KMX_Keyboard const &m_kmx;
+
+  // This instance's copy of the keyboard header and store array; option
+  // stores are changed here, while groups and keys are shared
+  KEYBOARD m_keyboardHeader;
+  std::vector<STORE> m_stores;
+
   PKMX_WORD m_indexStack;
   PKMX_WCHAR m_miniContext;
   int m_miniContextIfLen; // number of if() statements excluded from start of m_miniContext
@@ -53,18 +68,6 @@ private:
   INTKEYBOARDINFO m_keyboard = { 0, {}, {}, {} };
   KMX_DWORD m_modifiers = 0;
 
-  /* File loading */
-  KMX_BOOL LoadKeyboard(km_core_path_name fileName, LPKEYBOARD *lpKeyboard);
-  KMX_BOOL VerifyKeyboard(PKMX_BYTE filebase, size_t sz);
-  KMX_BOOL VerifyChecksum(PKMX_BYTE buf,  size_t sz);
-#ifdef KMX_64BIT
-  LPKEYBOARD CopyKeyboard(PKMX_BYTE bufp, PKMX_BYTE base);
-#else
-  LPKEYBOARD FixupKeyboard(PKMX_BYTE bufp, PKMX_BYTE base);
-#endif
-
-  KMX_BOOL ReleaseKeyboardMemory(LPKEYBOARD kbd);
-
   /* Keystroke Processing */
 
   KMX_BOOL ProcessGroup(LPGROUP gp, KMX_BOOL *pOutputKeystroke);
@@ -93,10 +96,10 @@ private:
   KMX_BOOL IsEquivalentShift(KMX_UINT rshift, KMX_UINT kshift);
 
 public:
-  KMX_ProcessEvent();
+  KMX_ProcessEvent(KMX_Keyboard const &kmx);
+  KMX_ProcessEvent(KMX_ProcessEvent const &) = delete;
   ~KMX_ProcessEvent();
 
-  KMX_BOOL Load(km_core_path_name keyboardName);
   KMX_BOOL ProcessEvent(km_core_state *state, KMX_UINT vkey, KMX_DWORD modifiers, KMX_BOOL isKeyDown);  // returns FALSE on error or key not matched
 
   KMX_Actions *GetActions();
@@ -107,10 +110,6 @@ public:
   KMX_Environment const *GetEnvironment() const;
   INTKEYBOARDINFO const *GetKeyboard() const;
   void SetCapsLock(KMX_DWORD &modifiers, KMX_BOOL capsLockOn, KMX_BOOL force = FALSE);
-
-  // Utility function
-public:
-  static PKMX_WCHAR StringOffset(PKMX_BYTE base, KMX_DWORD offset);
 };
 
 inline KMX_BOOL KMX_ProcessEvent::IsCapsLockOn(KMX_DWORD modifiers) {
@@ -2,6 +2,7 @@
 #include "state.hpp"
 #include "kmx/kmx_processor.hpp"
 #include <map>
+#include <iterator>
 
 using namespace km::core;
 using namespace kmx;
@@ -34,19 +35,95 @@ static KMX_BOOL ContextItemsFromAppContext(KMX_WCHAR *buf, km_core_context_item*
   return true;
 }
 
+namespace {
+
+kmx_processor_state & GetProcessorState(km::core::state & state) {
+  return *static_cast<kmx_processor_state *>(state.processor_state());
+}
+
+KMX_ProcessEvent & GetEngine(km::core::state & state) {
+  return GetProcessorState(state).engine;
+}
+
+KMX_ProcessEvent const & GetEngine(km::core::state const & state) {
+  return static_cast<kmx_processor_state const *>(state.processor_state())->engine;
+}
+
+/**
+ * Rebuild the engine's context from the end of the state's context. Only as
+ * many items as fit into the engine's context are visited, so this does not
+ * depend on the length of the state's context.
+ */
+void SetEngineContext(KMX_Context & kmx_context, km::core::context const & ctxt) {
+  // Find the longest run of items at the end of the context that fits
+  auto start = ctxt.end();
+  int len = 0;
+  while (start != ctxt.begin()) {
+    auto prev = std::prev(start);
+    int n = prev->type == KM_CORE_CT_MARKER ? 3 : prev->character > 0xFFFF ? 2 : 1;
+    if (len + n > MAXCONTEXT - 1) {
+      break;
+    }
+    len += n;
+    start = prev;
+  }
+
+  KMX_WCHAR buf[MAXCONTEXT];
+  KMX_WCHAR *p = buf;
+  for (auto c = start; c != ctxt.end(); c++) {
+    switch (c->type) {
+    case KM_CORE_CT_CHAR:
+      {
+        km::core::kmx::char16_single ch;
+        const int n = km::core::kmx::Utf32CharToUtf16(c->character, ch);
+        for (int i = 0; i < n; i++) {
+          *p++ = ch.ch[i];
+        }
+      }
+      break;
+    case KM_CORE_CT_MARKER:
+      assert(c->marker > 0);
+      *p++ = UC_SENTINEL;
+      *p++ = CODE_DEADKEY;
+      *p++ = (KMX_WCHAR) c->marker;
+      break;
+    }
+  }
+  *p = 0;
+
+  kmx_context.Set(buf, start != ctxt.begin());
+}
+
+}
+
+kmx_processor_state::kmx_processor_state(
+  KMX_Keyboard const & keyboard,
+  std::unordered_map<std::u16string, std::u16string> const & persisted
+) : _keyboard(keyboard), engine(keyboard) {
+  std::vector<option> defaults;
+  engine.GetOptions()->Init(defaults);
+  engine.GetOptions()->PersistedStore() = persisted;
+}
+
+processor_state * kmx_processor_state::clone() const {
+  auto copy = new kmx_processor_state(_keyboard, {});
+  copy->engine.GetOptions()->CopyFrom(*engine.GetOptions());
+  *copy->engine.GetEnvironment() = *engine.GetEnvironment();
+  return copy;
+}
+
 km_core_status kmx_processor::validate() const {
   return _valid ? KM_CORE_STATUS_OK : KM_CORE_STATUS_INVALID_KEYBOARD;
 }
 
-kmx_processor::kmx_processor(core::path p) {
-  p.replace_extension(".kmx");
-  _valid = bool(_kmx.Load(p.c_str()));
+kmx_processor::kmx_processor(path const & kb_path, blob const & data) {
+  _valid = bool(_kmx.Load(data));
 
   if (!_valid)
     return;
 
   keyboard_attributes::options_store defaults;
-  _kmx.GetOptions()->Init(defaults);
+  KMX_ProcessEvent(_kmx).GetOptions()->Init(defaults);
 
   for (auto const & opt: defaults)
   {
@@ -54,25 +131,32 @@ kmx_processor::kmx_processor(core::path p) {
       persisted_store()[opt.key] = opt.value;
   }
   // Fill out attributes
-  auto v = _kmx.GetKeyboard()->Keyboard->version;
+  auto v = _kmx.GetKeyboard()->version;
   auto vs = std::to_string(v >> 16) + "." + std::to_string(v & 0xffff);
 
-  _attributes = keyboard_attributes(static_cast<std::u16string>(p.stem()),
-                  std::u16string(vs.begin(), vs.end()), p.parent(), defaults);
+  _attributes = keyboard_attributes(static_cast<std::u16string>(kb_path.stem()),
+                  std::u16string(vs.begin(), vs.end()), kb_path.parent(), defaults);
+}
+
+std::unique_ptr<processor_state>
+kmx_processor::create_state() const {
+  return std::unique_ptr<processor_state>(new kmx_processor_state(_kmx, persisted_store()));
 }
 
 char16_t const *
 kmx_processor::lookup_option(
+  state const & state,
   km_core_option_scope scope,
   std::u16string const &key
 ) const {
+  auto const & engine = GetEngine(state);
   char16_t const *pValue = nullptr;
   switch (scope) {
   case KM_CORE_OPT_KEYBOARD:
-    pValue = _kmx.GetOptions()->LookUp(key);
+    pValue = engine.GetOptions()->LookUp(key);
     break;
   case KM_CORE_OPT_ENVIRONMENT:
-    pValue = _kmx.GetEnvironment()->LookUp(key);
+    pValue = engine.GetEnvironment()->LookUp(key);
     break;
   default:
     break;
@@ -83,17 +167,19 @@ kmx_processor::lookup_option(
 
 option
 kmx_processor::update_option(
+  state & state,
   km_core_option_scope scope,
   std::u16string const &key,
   std::u16string const &value
 ) {
+  auto & engine = GetEngine(state);
   switch (scope) {
   case KM_CORE_OPT_KEYBOARD:
-    _kmx.GetOptions()->Set(key, value);
-    persisted_store()[key] = value;
+    engine.GetOptions()->Set(key, value);
+    engine.GetOptions()->PersistedStore()[key] = value;
     break;
   case KM_CORE_OPT_ENVIRONMENT:
-    _kmx.GetEnvironment()->Set(key, value);
+    engine.GetEnvironment()->Set(key, value);
     break;
   default:
     return option();
@@ -109,16 +195,17 @@ kmx_processor::external_event(
   uint32_t event,
   void* _kmn_unused(data)
 ) {
+  auto & engine = GetEngine(*state);
 
   switch (event) {
     case KM_CORE_EVENT_KEYBOARD_ACTIVATED:
       // reset any current actions in the queue as a new keyboard
       // has been activated
-      _kmx.GetActions()->ResetQueue();
+      engine.GetActions()->ResetQueue();
       state->actions().clear();
-      if (_kmx.GetKeyboard()->Keyboard->dwFlags & KF_CAPSALWAYSOFF) {
+      if (_kmx.GetKeyboard()->dwFlags & KF_CAPSALWAYSOFF) {
         KMX_DWORD dummy_modifiers = 0;
-        _kmx.SetCapsLock(dummy_modifiers, FALSE, TRUE);
+        engine.SetCapsLock(dummy_modifiers, FALSE, TRUE);
       }
       break;
     default:
@@ -132,32 +219,33 @@ kmx_processor::queue_action(
   km_core_state * state,
   km_core_action_item const * action_item
 ) {
+  auto & engine = GetEngine(*state);
   switch (action_item->type) {
   case KM_CORE_IT_END:
     DebugLog("kmx_processor::queue_action: Error attempt to queue KM_CORE_IT_END action type\n");
     return false;
   case KM_CORE_IT_CHAR:
-   _kmx.GetActions()->QueueAction(QIT_CHAR, action_item->character);
+   engine.GetActions()->QueueAction(QIT_CHAR, action_item->character);
     break;
   case KM_CORE_IT_MARKER:
-   _kmx.GetActions()->QueueAction(QIT_DEADKEY, (KMX_DWORD)action_item->marker);
+   engine.GetActions()->QueueAction(QIT_DEADKEY, (KMX_DWORD)action_item->marker);
     break;
   case KM_CORE_IT_ALERT:
-    _kmx.GetActions()->QueueAction(QIT_BELL, 0);
+    engine.GetActions()->QueueAction(QIT_BELL, 0);
     break;
   case KM_CORE_IT_BACK:
   {
     // If the context is already empty, we want to emit the backspace for application to use
-    PKMX_WCHAR p_last_item_context = _kmx.GetContext()->Buf(1);
+    PKMX_WCHAR p_last_item_context = engine.GetContext()->Buf(1);
 
     if ((!p_last_item_context || *p_last_item_context == 0) ||
       (action_item->backspace.expected_type == KM_CORE_BT_UNKNOWN)) {
-      _kmx.GetActions()->QueueAction(QIT_INVALIDATECONTEXT, 0);
-      _kmx.GetActions()->QueueAction(QIT_BACK, BK_DEFAULT);
+      engine.GetActions()->QueueAction(QIT_INVALIDATECONTEXT, 0);
+      engine.GetActions()->QueueAction(QIT_BACK, BK_DEFAULT);
     } else if (action_item->backspace.expected_type == KM_CORE_BT_MARKER) {
-      _kmx.GetActions()->QueueAction(QIT_BACK, BK_DEADKEY);
+      engine.GetActions()->QueueAction(QIT_BACK, BK_DEADKEY);
     } else /* KM_CORE_BT_CHAR, KM_CORE_BT_UNKNOWN */ {
-      _kmx.GetActions()->QueueAction(QIT_BACK, BK_DEFAULT);
+      engine.GetActions()->QueueAction(QIT_BACK, BK_DEFAULT);
     }
     break;
   }
@@ -174,7 +262,7 @@ kmx_processor::queue_action(
     state->actions().push_emit_keystroke();
     break;
   case KM_CORE_IT_INVALIDATE_CONTEXT:
-    _kmx.GetActions()->QueueAction(QIT_INVALIDATECONTEXT, 0);
+    engine.GetActions()->QueueAction(QIT_INVALIDATECONTEXT, 0);
     break;
   }
   return true;
@@ -182,9 +270,16 @@ kmx_processor::queue_action(
 
 km_core_status
 kmx_processor::internal_process_queued_actions(km_core_state *state) {
+  auto & ps = GetProcessorState(*state);
+  auto & engine = ps.engine;
 
-  for (auto i = 0; i < _kmx.GetActions()->Length(); i++) {
-    auto a = _kmx.GetActions()->Get(i);
+  // The queued actions have already been applied to the engine's context, so
+  // after we apply them to the state's context, the two still match if they
+  // did beforehand
+  bool synced = ps.context_synced && ps.context_revision == state->context().revision;
+
+  for (auto i = 0; i < engine.GetActions()->Length(); i++) {
+    auto a = engine.GetActions()->Get(i);
     switch (a.ItemType) {
     case QIT_CAPSLOCK:
       state->actions().push_capslock(a.dwData);
@@ -196,8 +291,8 @@ kmx_processor::internal_process_queued_actions(km_core_state *state) {
         // this queue reprocessing happens. This is not an issue from a process
         // point-of-view because the event result data is only guaranteed on
         // exit of process_event.
-        auto const & rStoreToSave = _kmx.GetKeyboard()->Keyboard->dpStoreArray[a.dwData];
-        state->processor().persisted_store()[rStoreToSave.dpName] = rStoreToSave.dpString;
+        auto const & rStoreToSave = engine.GetKeyboard()->Keyboard->dpStoreArray[a.dwData];
+        engine.GetOptions()->PersistedStore()[rStoreToSave.dpName] = rStoreToSave.dpString;
         state->actions().push_persist(
           option{KM_CORE_OPT_KEYBOARD, rStoreToSave.dpName, rStoreToSave.dpString});
       }
@@ -249,6 +344,7 @@ kmx_processor::internal_process_queued_actions(km_core_state *state) {
     case QIT_INVALIDATECONTEXT:
       state->context().clear();
       state->actions().push_invalidate_context();
+      synced = false;
       break;
     default:
       // std::cout << "Unexpected item type " << a.ItemType << ", " << a.dwData << std::endl;
@@ -257,9 +353,15 @@ kmx_processor::internal_process_queued_actions(km_core_state *state) {
   }
 
   state->actions().commit();
+
+  // Once the engine's context has dropped its oldest items, deleting from it
+  // leaves it shorter than a rebuild would, so we can no longer follow along
+  ps.context_synced = synced && !engine.GetContext()->IsTruncated();
+  ps.context_revision = state->context().revision;
+
   // Queue should be cleared to allow testing if external actions have
   // been added to the keyboard action queue (currently IMX interaction)
-  _kmx.GetActions()->ResetQueue();
+  engine.GetActions()->ResetQueue();
   return KM_CORE_STATUS_OK;
 }
 
@@ -271,39 +373,72 @@ kmx_processor::process_event(
   uint8_t is_key_down,
   uint16_t /* event_flags */
 ) {
-  // Construct a context buffer from the items
-  std::u16string ctxt;
-  auto cp = state->context();
-  for (auto c = cp.begin(); c != cp.end(); c++) {
-    switch (c->type) {
-    case KM_CORE_CT_CHAR:
-      {
-        km::core::kmx::char16_single buf;
-        const int len = km::core::kmx::Utf32CharToUtf16(c->character, buf);
-        ctxt.append(buf.ch, len);
-      }
-      break;
-    case KM_CORE_CT_MARKER:
-      assert(c->marker > 0);
-      ctxt += UC_SENTINEL;
-      ctxt += CODE_DEADKEY;
-      ctxt += c->marker;
-      break;
-    }
+  auto & ps = GetProcessorState(*state);
+  auto & engine = ps.engine;
+
+  if (!ps.context_synced || ps.context_revision != state->context().revision) {
+    SetEngineContext(*engine.GetContext(), state->context());
+    ps.context_synced = true;
+    ps.context_revision = state->context().revision;
   }
 
-  _kmx.GetContext()->Set(ctxt.c_str());
-  _kmx.GetActions()->ResetQueue();
+  engine.GetActions()->ResetQueue();
   state->actions().clear();
 
-  if (!_kmx.ProcessEvent(state, vk, modifier_state, is_key_down)) {
+  if (!engine.ProcessEvent(state, vk, modifier_state, is_key_down)) {
     // We need to output the default keystroke
-    _kmx.GetActions()->QueueAction(QIT_EMIT_KEYSTROKE, 0);
+    engine.GetActions()->QueueAction(QIT_EMIT_KEYSTROKE, 0);
   }
 
   return internal_process_queued_actions(state);
 }
 
+bool
+kmx_processor::process_no_op_event(
+  km_core_state *state,
+  km_core_virtual_key vk,
+  uint16_t /* modifier_state */,
+  uint8_t is_key_down,
+  uint16_t /* event_flags */
+) {
+  auto kbd = _kmx.GetKeyboard();
+
+  // Caps lock stores can change the caps lock state on any event, and a
+  // debugger wants to see each event as the engine processes it
+  if ((kbd->dwFlags & (KF_CAPSONONLY | KF_CAPSALWAYSOFF | KF_SHIFTFREESCAPS)) ||
+      kbd->StartGroup[BEGIN_UNICODE] == (KMX_DWORD) -1 ||
+      state->debug_items().is_enabled()) {
+    return false;
+  }
+
+  // As KMX_ProcessEvent::ProcessEvent would: the engine swallows Shift, Ctrl
+  // and Alt, and passes on the keystroke for any other key-up
+  bool emit_keystroke;
+  switch (vk) {
+  case KM_CORE_VKEY_SHIFT:
+  case KM_CORE_VKEY_CONTROL:
+  case KM_CORE_VKEY_ALT:
+    emit_keystroke = false;
+    break;
+  default:
+    if (is_key_down) {
+      return false;
+    }
+    emit_keystroke = true;
+  }
+
+  // Without debugging, each event leaves a lone end item, which is large
+  // enough that it is only worth replacing if it is not already there
+  auto & debug_items = state->debug_items();
+  if (debug_items.size() != 1 || debug_items[0].type != KM_CORE_DEBUG_END ||
+      debug_items[0].flags != 0 || debug_items[0].kmx_info.first_action != 0) {
+    debug_items.clear();
+    debug_items.push_end(0, 0);
+  }
+  state->set_no_op_actions(emit_keystroke);
+  return true;
+}
+
 km_core_status
 kmx_processor::process_queued_actions (km_core_state *state) {
   state->actions().clear();
@@ -323,8 +458,8 @@ km_core_attr const & kmx_processor::attributes() const {
   return engine_attrs;
 }
 
-km_core_context_item * kmx_processor::get_intermediate_context() {
-  KMX_WCHAR *buf = _kmx.GetContext()->BufMax(MAXCONTEXT);
+km_core_context_item * kmx_processor::get_intermediate_context(km_core_state *state) {
+  KMX_WCHAR *buf = GetEngine(*state).GetContext()->BufMax(MAXCONTEXT);
   km_core_context_item *citems = nullptr;
   if (!ContextItemsFromAppContext(buf, &citems)) {
     citems = new km_core_context_item(KM_CORE_CONTEXT_ITEM_END);
@@ -335,8 +470,8 @@ km_core_context_item * kmx_processor::get_intermediate_context() {
 km_core_keyboard_key * kmx_processor::get_key_list() const  {
   // Iterate through the groups and get the rules with virtual keys
   // and store the key along with the modifer.
-  const uint32_t group_cnt = _kmx.GetKeyboard()->Keyboard->cxGroupArray;
-  const LPGROUP group_array = _kmx.GetKeyboard()->Keyboard->dpGroupArray;
+  const uint32_t group_cnt = _kmx.GetKeyboard()->cxGroupArray;
+  const LPGROUP group_array = _kmx.GetKeyboard()->dpGroupArray;
   GROUP *p_group;
 
   std::map<std::pair<km_core_virtual_key,uint32_t>, uint32_t> map_rules;
@@ -375,8 +510,8 @@ km_core_keyboard_key * kmx_processor::get_key_list() const  {
 
 km_core_keyboard_imx * kmx_processor::get_imx_list() const  {
 
-  const uint32_t store_cnt = _kmx.GetKeyboard()->Keyboard->cxStoreArray;
-  const LPSTORE store_array = _kmx.GetKeyboard()->Keyboard->dpStoreArray;
+  const uint32_t store_cnt = _kmx.GetKeyboard()->cxStoreArray;
+  const LPSTORE store_array = _kmx.GetKeyboard()->dpStoreArray;
   uint16_t fn_count = 0;
   uint16_t fn_idx = 0;
 
@@ -9,6 +9,7 @@
 #pragma once
 
 #include <string>
+#include <unordered_map>
 #include "keyman_core.h"
 #include "kmx/kmx_processevent.h"
 #include "keyboard.hpp"
@@ -17,11 +18,37 @@
 namespace km {
 namespace core
 {
+  /**
+   * The KMX engine for one state: its context, action queue, option values
+   * and environment. The keyboard itself is shared by all states.
+   */
+  class kmx_processor_state : public processor_state
+  {
+    kmx::KMX_Keyboard const & _keyboard;
+
+  public:
+    kmx::KMX_ProcessEvent engine;
+
+    // The engine's context follows the actions that the engine queues, so it
+    // only needs to be rebuilt from the state's context when that has been
+    // changed in some other way. `context_revision` is the revision of the
+    // state's context that the engine's context was last known to match.
+    bool     context_synced = false;
+    uint32_t context_revision = 0;
+
+    kmx_processor_state(
+      kmx::KMX_Keyboard const & keyboard,
+      std::unordered_map<std::u16string, std::u16string> const & persisted
+    );
+
+    processor_state * clone() const override;
+  };
+
   class kmx_processor : public abstract_processor
   {
   private:
     bool               _valid;
-    kmx::KMX_ProcessEvent _kmx;
+    kmx::KMX_Keyboard  _kmx;
 
     km_core_status
     internal_process_queued_actions(
@@ -29,7 +56,7 @@ namespace core
       );
 
   public:
-    kmx_processor(path);
+    kmx_processor(path const & kb_path, blob const & data);
 
     km_core_status
     process_event(
@@ -40,17 +67,30 @@ namespace core
       uint16_t event_flags
     ) override;
 
+    bool
+    process_no_op_event(
+      km_core_state *state,
+      km_core_virtual_key vk,
+      uint16_t modifier_state,
+      uint8_t is_key_down,
+      uint16_t event_flags
+    ) override;
+
     km_core_attr const & attributes() const override;
     km_core_status       validate() const override;
 
+    std::unique_ptr<processor_state> create_state() const override;
+
     char16_t const *
     lookup_option(
+      state const &,
       km_core_option_scope,
       std::u16string const & key
     )  const override;
 
     option
     update_option(
+      state &,
       km_core_option_scope scope,
       std::u16string const & key,
       std::u16string const & value
@@ -74,7 +114,7 @@ namespace core
       km_core_action_item const* action_item
     ) override;
 
-    km_core_context_item * get_intermediate_context() override;
+    km_core_context_item * get_intermediate_context(km_core_state *state) override;
 
     km_core_keyboard_key * get_key_list() const override;
 
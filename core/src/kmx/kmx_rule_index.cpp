@@ -0,0 +1,76 @@
+/*
+  Copyright:        © SIL International.
+  Description:      Per-group rule dispatch index for KMX keyboards
+  Create Date:      17 Oct 2026
+*/
+#include <algorithm>
+#include <assert.h>
+#include "kmx_rule_index.h"
+
+using namespace km::core;
+using namespace kmx;
+
+namespace {
+
+bool EntryLess(KMX_RuleIndex::Entry const &a, KMX_RuleIndex::Entry const &b) {
+  return a.Key < b.Key || (a.Key == b.Key && a.Rule < b.Rule);
+}
+
+} // namespace
+
+void KMX_RuleIndex::Clear() {
+  m_groups.clear();
+}
+
+void KMX_RuleIndex::Build(LPKEYBOARD kbd) {
+  Clear();
+  if (!kbd) return;
+
+  m_groups.resize(kbd->cxGroupArray);
+
+  for (KMX_DWORD i = 0; i < kbd->cxGroupArray; i++) {
+    LPGROUP gp = &kbd->dpGroupArray[i];
+    GroupIndex &gi = m_groups[i];
+    if (!gp->fUsingKeys) {
+      continue;
+    }
+    gi.indexed = TRUE;
+
+    LPKEY kkp = gp->dpKeyArray;
+    for (KMX_DWORD j = 0; j < gp->cxKeyArray; j++, kkp++) {
+      // IsEquivalentShift never matches a rule with no shift flags, and the
+      // character code test requires no shift flags, so each rule belongs in
+      // exactly one of the two lists
+      if (kkp->ShiftFlags != 0) {
+        gi.vkeyRules.push_back({kkp->Key, j});
+      } else if (kkp->Key != 0) {
+        gi.charRules.push_back({kkp->Key, j});
+      }
+    }
+
+    std::sort(gi.vkeyRules.begin(), gi.vkeyRules.end(), EntryLess);
+    std::sort(gi.charRules.begin(), gi.charRules.end(), EntryLess);
+  }
+}
+
+void KMX_RuleIndex::FindRange(std::vector<Entry> const &entries, KMX_WCHAR key, const Entry **begin, const Entry **end) {
+  auto range = std::equal_range(entries.begin(), entries.end(), Entry{key, 0},
+    [](Entry const &a, Entry const &b) { return a.Key < b.Key; });
+  *begin = entries.data() + (range.first - entries.begin());
+  *end = entries.data() + (range.second - entries.begin());
+}
+
+KMX_RuleIndex::Candidates KMX_RuleIndex::Find(KMX_DWORD group, KMX_WCHAR vkey, KMX_WCHAR charCode) const {
+  assert(IsIndexed(group));
+  GroupIndex const &gi = m_groups[group];
+
+  const Entry *vk, *vkEnd, *ch, *chEnd;
+  FindRange(gi.vkeyRules, vkey, &vk, &vkEnd);
+  if (charCode != 0) {
+    FindRange(gi.charRules, charCode, &ch, &chEnd);
+  } else {
+    ch = chEnd = nullptr;
+  }
+
+  return Candidates(vk, vkEnd, ch, chEnd);
+}
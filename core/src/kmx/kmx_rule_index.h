@@ -0,0 +1,112 @@
+/*
+  Copyright:        © SIL International.
+  Description:      Per-group rule dispatch index for KMX keyboards
+  Create Date:      17 Oct 2026
+*/
+
+#pragma once
+
+#include <vector>
+#include "kmx_base.h"
+
+namespace km {
+namespace core {
+namespace kmx {
+
+/**
+ * Per-group dispatch index over the rules of a keyboard, built once at load
+ * time. For groups `using keys`, a rule can only ever match a keystroke if
+ * its key equals the event's virtual key (rules with shift flags), or its
+ * key equals the event's character code (rules without shift flags). The
+ * index buckets rules on those two keys so that `ProcessGroup` only needs to
+ * test context on the candidate rules, visiting them in their original order
+ * so that first-match semantics are unchanged.
+ *
+ * Keyless groups are not indexed; every rule must be tested there.
+ */
+class KMX_RuleIndex
+{
+public:
+  struct Entry {
+    KMX_WCHAR Key;
+    KMX_DWORD Rule;   // index into GROUP::dpKeyArray
+  };
+
+  /**
+   * Merges the virtual key and character candidates for a keystroke, in
+   * ascending rule order.
+   */
+  class Candidates
+  {
+  private:
+    const Entry *vk, *vkEnd, *ch, *chEnd;
+
+  public:
+    Candidates(const Entry *vkBegin, const Entry *vkLast, const Entry *chBegin, const Entry *chLast)
+      : vk(vkBegin), vkEnd(vkLast), ch(chBegin), chEnd(chLast) {}
+
+    /**
+     * Retrieves the next candidate rule index
+     *
+     * @param  rule  receives the index of the rule in the group key array
+     * @return       FALSE when there are no more candidates
+     */
+    KMX_BOOL Next(KMX_DWORD &rule);
+  };
+
+  /**
+   * Builds the index for all groups in the keyboard. Any previous index is
+   * discarded.
+   *
+   * @param  kbd  the loaded keyboard
+   */
+  void Build(LPKEYBOARD kbd);
+
+  void Clear();
+
+  /**
+   * Returns TRUE if the group has an index; only groups `using keys` are
+   * indexed.
+   */
+  KMX_BOOL IsIndexed(KMX_DWORD group) const;
+
+  /**
+   * Finds the candidate rules for a keystroke in an indexed group.
+   *
+   * @param  group     index of the group
+   * @param  vkey      virtual key of the event
+   * @param  charCode  character code of the event, 0 if none
+   */
+  Candidates Find(KMX_DWORD group, KMX_WCHAR vkey, KMX_WCHAR charCode) const;
+
+private:
+  struct GroupIndex {
+    KMX_BOOL indexed = FALSE;
+    std::vector<Entry> vkeyRules;  // rules with shift flags, sorted by (Key, Rule)
+    std::vector<Entry> charRules;  // rules without shift flags, sorted by (Key, Rule)
+  };
+
+  std::vector<GroupIndex> m_groups;
+
+  static void FindRange(std::vector<Entry> const &entries, KMX_WCHAR key, const Entry **begin, const Entry **end);
+};
+
+inline KMX_BOOL KMX_RuleIndex::Candidates::Next(KMX_DWORD &rule) {
+  if (vk != vkEnd && (ch == chEnd || vk->Rule < ch->Rule)) {
+    rule = (vk++)->Rule;
+    return TRUE;
+  }
+  if (ch != chEnd) {
+    rule = (ch++)->Rule;
+    return TRUE;
+  }
+  return FALSE;
+}
+
+inline KMX_BOOL KMX_RuleIndex::IsIndexed(KMX_DWORD group) const {
+  return group < m_groups.size() && m_groups[group].indexed;
+}
+
+} // namespace kmx
+} // namespace core
+} // namespace km
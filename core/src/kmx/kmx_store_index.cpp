@@ -0,0 +1,153 @@
+/*
+  Copyright:        © SIL International.
+  Description:      Membership index for KMX stores used in any(), notany() and index()
+  Create Date:      17 Oct 2026
+*/
+#include "kmx_processevent.h"
+#include "kmx_store_index.h"
+
+using namespace km::core;
+using namespace kmx;
+
+namespace {
+
+// Stores with fewer elements than this are cheaper to walk than to hash
+const KMX_DWORD MinIndexedElements = 8;
+
+// Stores with at least this many elements also get a BMP bitmap
+const KMX_DWORD MinBitmapElements = 32;
+
+uint64_t ElementKey(PKMX_WCHAR p, size_t len) {
+  uint64_t key = (uint64_t) len << 48;
+  for (size_t i = 0; i < len; i++) {
+    key |= (uint64_t) p[i] << (16 * i);
+  }
+  return key;
+}
+
+} // namespace
+
+void KMX_StoreIndex::Clear() {
+  m_stores.clear();
+}
+
+void KMX_StoreIndex::MarkReferences(LPKEYBOARD kbd, PKMX_WCHAR p, std::vector<bool> &referenced) const {
+  for (; p && *p; p = incxstr(p)) {
+    if (*p != UC_SENTINEL) continue;
+    switch (*(p + 1)) {
+    case CODE_ANY:
+    case CODE_NOTANY:
+    case CODE_INDEX:
+      if (*(p + 2) != 0 && (KMX_DWORD)(*(p + 2) - 1) < kbd->cxStoreArray) {
+        referenced[*(p + 2) - 1] = true;
+      }
+      break;
+    }
+  }
+}
+
+void KMX_StoreIndex::Build(LPKEYBOARD kbd) {
+  Clear();
+  if (!kbd) return;
+
+  std::vector<bool> referenced(kbd->cxStoreArray, false);
+
+  for (KMX_DWORD i = 0; i < kbd->cxGroupArray; i++) {
+    LPGROUP gp = &kbd->dpGroupArray[i];
+    LPKEY kkp = gp->dpKeyArray;
+    for (KMX_DWORD j = 0; j < gp->cxKeyArray; j++, kkp++) {
+      MarkReferences(kbd, kkp->dpContext, referenced);
+      MarkReferences(kbd, kkp->dpOutput, referenced);
+    }
+    MarkReferences(kbd, gp->dpMatch, referenced);
+    MarkReferences(kbd, gp->dpNoMatch, referenced);
+  }
+
+  m_stores.resize(kbd->cxStoreArray);
+  for (KMX_DWORD i = 0; i < kbd->cxStoreArray; i++) {
+    if (referenced[i]) {
+      BuildStore(i, &kbd->dpStoreArray[i]);
+    }
+  }
+}
+
+void KMX_StoreIndex::BuildStore(KMX_DWORD store, LPSTORE s) {
+  if (!s->dpString) return;
+
+  StoreIndex si;
+  PKMX_WCHAR p, q;
+  for (p = s->dpString; *p; p = q) {
+    q = incxstr(p);
+    size_t len = q - p;
+    if (len > MaxElementLength) {
+      // e.g. virtual keys; leave this store to the linear walk
+      return;
+    }
+    si.offsets.push_back((KMX_DWORD)(p - s->dpString));
+    si.lengths |= 1 << len;
+    si.firstIndex.insert({ElementKey(p, len), (KMX_DWORD)(si.offsets.size() - 1)});
+  }
+  si.offsets.push_back((KMX_DWORD)(p - s->dpString));
+
+  KMX_DWORD count = (KMX_DWORD) si.offsets.size() - 1;
+  if (count < MinIndexedElements) return;
+
+  if (count >= MinBitmapElements && (si.lengths & (1 << 1))) {
+    si.bmp.resize(0x10000 / 64, 0);
+    for (KMX_DWORD i = 0; i < count; i++) {
+      if (si.offsets[i + 1] - si.offsets[i] == 1) {
+        KMX_WCHAR ch = s->dpString[si.offsets[i]];
+        si.bmp[ch / 64] |= (uint64_t) 1 << (ch % 64);
+      }
+    }
+  }
+
+  si.source = s->dpString;
+  m_stores[store] = std::move(si);
+}
+
+KMX_StoreIndex::StoreIndex const *KMX_StoreIndex::Get(KMX_DWORD store, LPSTORE s) const {
+  if (store >= m_stores.size()) return nullptr;
+  StoreIndex const *si = &m_stores[store];
+  if (!si->source || si->source != s->dpString) return nullptr;
+  return si;
+}
+
+PKMX_WCHAR KMX_StoreIndex::Find(KMX_DWORD store, LPSTORE s, PKMX_WCHAR chr, int *index) const {
+  StoreIndex const *si = Get(store, s);
+  if (!si) {
+    PKMX_WCHAR temp = xstrchr(s->dpString, chr);
+    if (temp) *index = xstrpos(temp, s->dpString);
+    return temp;
+  }
+
+  // An element matches if its code units are a prefix of chr, so test each
+  // element length present in the store and keep the earliest position
+  KMX_DWORD best = (KMX_DWORD) -1;
+  for (size_t len = 1; len <= MaxElementLength && chr[len - 1]; len++) {
+    if (!(si->lengths & (1 << len))) continue;
+    if (len == 1 && !si->bmp.empty() && !(si->bmp[chr[0] / 64] & ((uint64_t) 1 << (chr[0] % 64)))) continue;
+    auto it = si->firstIndex.find(ElementKey(chr, len));
+    if (it != si->firstIndex.end() && it->second < best) {
+      best = it->second;
+    }
+  }
+
+  if (best == (KMX_DWORD) -1) return NULL;
+  *index = (int) best;
+  return s->dpString + si->offsets[best];
+}
+
+PKMX_WCHAR KMX_StoreIndex::At(KMX_DWORD store, LPSTORE s, KMX_WORD &n) const {
+  StoreIndex const *si = Get(store, s);
+  if (!si) {
+    PKMX_WCHAR temp;
+    for (temp = s->dpString; *temp && n > 0; temp = incxstr(temp), n--);
+    return temp;
+  }
+
+  KMX_DWORD count = (KMX_DWORD) si->offsets.size() - 1;
+  KMX_DWORD step = n < count ? n : count;
+  n -= (KMX_WORD) step;
+  return s->dpString + si->offsets[step];
+}
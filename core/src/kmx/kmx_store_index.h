@@ -0,0 +1,90 @@
+/*
+  Copyright:        © SIL International.
+  Description:      Membership index for KMX stores used in any(), notany() and index()
+  Create Date:      17 Oct 2026
+*/
+
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+#include "kmx_base.h"
+
+namespace km {
+namespace core {
+namespace kmx {
+
+/**
+ * Lookup tables for the stores that rules reference with `any()`,
+ * `notany()` and `index()`, built once at load time. Without an index,
+ * these walk the store string with `incxstr` for every test.
+ *
+ * Each store element (as split by `incxstr`) is keyed on its code units,
+ * mapping to the position of its first occurrence, so `Find` gives exactly
+ * the same result as `xstrchr` followed by `xstrpos`. A bitmap over the BMP
+ * rejects most non-members of single code unit elements without hashing.
+ *
+ * Small stores, stores with elements longer than three code units, and
+ * stores whose string has since been replaced (e.g. option stores changed
+ * with `set()`) are not indexed and fall back to the linear walk.
+ */
+class KMX_StoreIndex
+{
+public:
+  /**
+   * Builds the index for the stores referenced by `any()`, `notany()` or
+   * `index()` in the keyboard. Any previous index is discarded.
+   *
+   * @param  kbd  the loaded keyboard
+   */
+  void Build(LPKEYBOARD kbd);
+
+  void Clear();
+
+  /**
+   * Finds the first element of a store that matches the start of `chr`;
+   * equivalent to `xstrchr(s->dpString, chr)`.
+   *
+   * @param  store  index of the store in the keyboard
+   * @param  s      the store
+   * @param  chr    the character to look for
+   * @param  index  receives the position of the element, as `xstrpos` would
+   *                return it
+   * @return        pointer to the matching element in the store, or NULL
+   */
+  PKMX_WCHAR Find(KMX_DWORD store, LPSTORE s, PKMX_WCHAR chr, int *index) const;
+
+  /**
+   * Finds the nth element of a store, as the walk
+   * `for(p = s->dpString; *p && n > 0; p = incxstr(p), n--)` would.
+   *
+   * @param  store  index of the store in the keyboard
+   * @param  s      the store
+   * @param  n      position of the element; on return, the number of
+   *                elements that could not be stepped over, so non-zero if
+   *                the store is too short
+   * @return        pointer to the element, or to the terminating nul
+   */
+  PKMX_WCHAR At(KMX_DWORD store, LPSTORE s, KMX_WORD &n) const;
+
+private:
+  static const size_t MaxElementLength = 3;
+
+  struct StoreIndex {
+    PKMX_WCHAR source = nullptr;              // dpString the index was built from
+    std::vector<KMX_DWORD> offsets;           // code unit offset of each element, then of the nul
+    std::unordered_map<uint64_t, KMX_DWORD> firstIndex;
+    KMX_DWORD lengths = 0;                    // bit n set if there is an element of n code units
+    std::vector<uint64_t> bmp;                // single code unit elements, empty if not built
+  };
+
+  std::vector<StoreIndex> m_stores;
+
+  void BuildStore(KMX_DWORD store, LPSTORE s);
+  void MarkReferences(LPKEYBOARD kbd, PKMX_WCHAR p, std::vector<bool> &referenced) const;
+  StoreIndex const *Get(KMX_DWORD store, LPSTORE s) const;
+};
+
+} // namespace kmx
+} // namespace core
+} // namespace km
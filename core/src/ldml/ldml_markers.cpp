@@ -97,8 +97,16 @@ void add_back_markers(std::u32string &str, const std::u32string &src, marker_map
   }
   // need to reconstitute.
   marker_map map2(map);  // make a copy of the map
-  // clear the string
+  // clear the string. We build it back to front, by appending and then
+  // reversing, as prepending to it each time would be quadratic.
   str.clear();
+  str.reserve(src.length());
+  std::u32string marker_str;
+  auto prepend_reversed_marker = [&](marker_num marker) {
+    marker_str.clear();
+    prepend_marker(marker_str, marker, encoding);
+    str.append(marker_str.rbegin(), marker_str.rend());
+  };
   // iterator over the marker map
   auto marki = map2.rbegin();
   // number of markers left to processnfd
@@ -108,7 +116,7 @@ void add_back_markers(std::u32string &str, const std::u32string &src, marker_map
   // add any end-of-text markers
   while(marki != map2.rend() && marki->ch == MARKER_BEFORE_EOT) {
     if (!marki->end) {
-      prepend_marker(str, marki->marker, encoding);
+      prepend_reversed_marker(marki->marker);
       processed_markers++;
     }
     marki->processed = true;  // mark as done
@@ -118,7 +126,7 @@ void add_back_markers(std::u32string &str, const std::u32string &src, marker_map
   // go from end to beginning of string
   for (auto p = src.rbegin(); p != src.rend(); p++) {
     const auto ch = *p;
-    str.insert(0, 1, ch);  // prepend
+    str.push_back(ch);  // str is built backwards, and reversed at the end
 
     // remove all processed entries, outside of an iterator
     while (!map2.empty() && map2.back().processed) {
@@ -132,12 +140,13 @@ void add_back_markers(std::u32string &str, const std::u32string &src, marker_map
         if (i->end) {
           break;
         } else {
-          prepend_marker(str, i->marker, encoding);
+          prepend_reversed_marker(i->marker);
           processed_markers++;
         }
       }
     }
   }
+  std::reverse(str.begin(), str.end());
   assert(max_markers == processed_markers);  // assert that we consumed all marks
 }
 
@@ -167,13 +176,20 @@ marker_num parse_next_marker(std::u32string::const_iterator &i, const std::u32st
     return LDML_MARKER_NO_INDEX;
   }
   const auto &lookfor_str = (encoding == regex_sentinel) ? REGEX_PREFIX : RAW_PREFIX;
-  std::u32string rest(i, end);
-  if (rest.length() <= lookfor_str.length()) { // <= because we need at least 1 char for the rest of the marker payload
+  // Note: this is called for every char of the string, so it must not copy
+  // the rest of the string, or scanning becomes quadratic.
+  if (*i != lookfor_str[0]) {
+    // the common case: not even the start of a marker
+    i++;
+    return LDML_MARKER_NO_INDEX;
+  }
+  const size_t rest_length = end - i;
+  if (rest_length <= lookfor_str.length()) { // <= because we need at least 1 char for the rest of the marker payload
     // input too short
     i++;
     return LDML_MARKER_NO_INDEX;
   }
-  if (0 != rest.compare(0, lookfor_str.length(), lookfor_str)) {
+  if (!std::equal(lookfor_str.begin(), lookfor_str.end(), i)) {
     // advance past initial char
     i++;
     return LDML_MARKER_NO_INDEX; // prefix mismatch
@@ -189,7 +205,6 @@ marker_num parse_next_marker(std::u32string::const_iterator &i, const std::u32st
 
   assert(encoding == regex_sentinel);
 
-  // TODO-LDML: could change this from iterator to using 'rest'
   if (*i == U'\\') {
     // single marker
     if (++i == end) {
@@ -218,8 +233,7 @@ marker_num parse_next_marker(std::u32string::const_iterator &i, const std::u32st
     assert(marker_no >= LDML_MARKER_MIN_INDEX && marker_no <= LDML_MARKER_MAX_INDEX);
     return marker_no;
   } else if (*i == REGEX_ANY_MATCH.at(0)) {  // '['
-    std::u32string rest2(i, end); // TODO-LDML: could use 'rest' above
-    if (rest2.length() < REGEX_ANY_MATCH.length()) {
+    if ((size_t)(end - i) < REGEX_ANY_MATCH.length()) {
       // not enough left so it can't match, so continue
       return LDML_MARKER_NO_INDEX;
     }
@@ -237,6 +251,44 @@ bool normalize_nfd_markers(std::u32string &str, marker_encoding encoding) {
   return normalize_nfd_markers_segment(str, m, encoding);
 }
 
+/** @returns true if str[i] is any part of a plain_sentinel marker */
+static bool
+is_marker_part(const std::u32string &str, size_t i) {
+  for (size_t m = (i < 2) ? 0 : i - 2; m <= i; m++) {
+    if (str[m] == LDML_UC_SENTINEL && m + 1 < str.length() && str[m + 1] == LDML_MARKER_CODE) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool normalize_nfd_markers_tail(std::u32string &str, size_t from) {
+  if (from >= str.length()) {
+    return true; // nothing new
+  }
+
+  UErrorCode status = U_ZERO_ERROR;
+  const icu::Normalizer2 *nfd = icu::Normalizer2::getNFDInstance(status);
+  if (!UASSERT_SUCCESS(status)) {
+    return false;
+  }
+
+  // back up to a character, not in a marker, that has a boundary before it.
+  // The text before that character is not affected by what follows.
+  size_t start = from;
+  while (start > 0 && (is_marker_part(str, start) || !nfd->hasBoundaryBefore(str[start]))) {
+    start--;
+  }
+
+  std::u32string tail = str.substr(start);
+  if (!normalize_nfd_markers(tail)) {
+    return false;
+  }
+  str.resize(start);
+  str.append(tail);
+  return true;
+}
+
 void
 prepend_marker(std::u32string &str, marker_num marker, marker_encoding encoding) {
   if (encoding == plain_sentinel) {
@@ -362,6 +414,7 @@ add_pending_markers(
 std::u32string
 remove_markers(const std::u32string &str, marker_map *markers, marker_encoding encoding) {
   std::u32string out;
+  out.reserve(str.length());
   marker_list last_markers;
   UErrorCode status = U_ZERO_ERROR;
   const icu::Normalizer2 *nfd = icu::Normalizer2::getNFDInstance(status);
@@ -81,6 +81,12 @@ bool normalize_nfd(std::u16string &str);
  **/
 bool normalize_nfd_markers_segment(std::u32string &str, marker_map &markers, marker_encoding encoding = plain_sentinel);
 bool normalize_nfd_markers(std::u32string &str, marker_encoding encoding = plain_sentinel);
+/** Normalize the end of a u32string inplace to NFD, retaining markers, where
+ * the text before `from` is already NFD. Only the text after the last
+ * normalization boundary at or before `from` is normalized.
+ * @return false on failure
+ **/
+bool normalize_nfd_markers_tail(std::u32string &str, size_t from);
 
 // /** Normalize a u32string inplace to NFC, retaining markers.
 //  * @param markers will be populated with marker chars
@@ -5,7 +5,6 @@
   Authors:      Marc Durdin (MD)
 */
 
-#include <fstream>
 #include <algorithm>
 #include "ldml/ldml_processor.hpp"
 #include "ldml/ldml_transforms.hpp"
@@ -37,7 +36,7 @@ namespace km {
 namespace core {
 
 
-ldml_processor::ldml_processor(path const & kb_path, const std::vector<uint8_t> &data)
+ldml_processor::ldml_processor(path const & kb_path, blob const & data, ldml::compile_mode mode)
 : abstract_processor(
     keyboard_attributes(kb_path.stem(), KM_CORE_LMDL_PROCESSOR_VERSION, kb_path.parent(), {})
   ), _valid(false), transforms(), bksp_transforms(), keys(), normalization_disabled(false)
@@ -64,34 +63,13 @@ ldml_processor::ldml_processor(path const & kb_path, const std::vector<uint8_t>
     return;
   }
 
-  // Now, if we have keys, use them.
-  if (kplus.key2 != nullptr) {
-    // read all keys into array
-    for (KMX_DWORD i=0; i<kplus.key2->kmapCount; i++) {
-      std::u16string str;
-      auto kmapEntry = kplus.key2Helper.getKmap(i);
-      assert(kmapEntry != nullptr);
-      // now look up the key
-      auto keyEntry = kplus.key2Helper.getKeys(kmapEntry->key);
-      assert(keyEntry != nullptr);
-
-      if (keyEntry->flags & LDML_KEYS_KEY_FLAGS_EXTEND) {
-        if (nullptr == kplus.strs) {
-          DebugLog("for keys: kplus.strs == nullptr"); // need a string table to get strings
-          assert(false);
-          return;
-        }
-        str = kplus.strs->get(keyEntry->to);
-      } else {
-        str = keyEntry->get_to_string();
-      }
-      keys.add((km_core_virtual_key)kmapEntry->vkey, (uint16_t)kmapEntry->mod, str);
-    }
-  } // else: no keys! but still valid. Just, no keys.
+  if (!load_keys(kplus, keys)) {
+    return;
+  }
 
   // load transforms
   if (kplus.tran != nullptr && kplus.tran->groupCount > 0) {
-    transforms.reset(km::core::ldml::transforms::load(kplus, kplus.tran, kplus.tranHelper));
+    transforms.reset(km::core::ldml::transforms::load(kplus, kplus.tran, kplus.tranHelper, mode));
     if (!transforms) {
       DebugLog("Failed to load tran transforms");
       return; // failed to load
@@ -100,7 +78,7 @@ ldml_processor::ldml_processor(path const & kb_path, const std::vector<uint8_t>
 
   // load bksp transforms
   if (kplus.bksp != nullptr && kplus.bksp->groupCount > 0) {
-    bksp_transforms.reset(km::core::ldml::transforms::load(kplus, kplus.bksp, kplus.bkspHelper));
+    bksp_transforms.reset(km::core::ldml::transforms::load(kplus, kplus.bksp, kplus.bkspHelper, mode));
     if (!bksp_transforms) {
       DebugLog("Failed to load bksp transforms");
       return; // failed to load
@@ -111,34 +89,46 @@ ldml_processor::ldml_processor(path const & kb_path, const std::vector<uint8_t>
       normalization_disabled = true;
     }
   }
+  // resolve all key lookups once, now that we know whether to normalize
+  keys.build(!normalization_disabled);
   // Only valid if we reach here
   DebugLog("_valid = true");
   _valid = true;
 }
 
-bool ldml_processor::is_kmxplus_file(path const & kb_path, std::vector<uint8_t>& data) {
-// TODO-LDML: we should refactor all the core components to delegate file loading
-//            to the Engine, which requires an API change, but this makes delivery
-//            of keyboard files more flexible under more WASM.
-
-  std::ifstream file(static_cast<std::string>(kb_path), std::ios::binary | std::ios::ate);
-  if(!file.good()) {
-    return false;
-  }
-  const std::streamsize size = file.tellg();
-  if(size >= KMX_MAX_ALLOWED_FILE_SIZE) {
-    return false;
-  }
+bool ldml_processor::load_keys(kmx::kmx_plus const & kplus, ldml::vkeys & keys) {
+  // Now, if we have keys, use them.
+  if (kplus.key2 != nullptr) {
+    // read all keys into array
+    for (KMX_DWORD i=0; i<kplus.key2->kmapCount; i++) {
+      std::u16string str;
+      auto kmapEntry = kplus.key2Helper.getKmap(i);
+      assert(kmapEntry != nullptr);
+      // now look up the key
+      auto keyEntry = kplus.key2Helper.getKeys(kmapEntry->key);
+      assert(keyEntry != nullptr);
 
-  file.seekg(0, std::ios::beg);
+      if (keyEntry->flags & LDML_KEYS_KEY_FLAGS_EXTEND) {
+        if (nullptr == kplus.strs) {
+          DebugLog("for keys: kplus.strs == nullptr"); // need a string table to get strings
+          assert(false);
+          return false;
+        }
+        str = kplus.strs->get(keyEntry->to);
+      } else {
+        str = keyEntry->get_to_string();
+      }
+      keys.add((km_core_virtual_key)kmapEntry->vkey, (uint16_t)kmapEntry->mod, str);
+    }
+  } // else: no keys! but still valid. Just, no keys.
+  return true;
+}
 
-  data.resize((size_t)size);
-  if(!file.read((char *) data.data(), size)) {
+bool ldml_processor::is_kmxplus_file(blob const & data) {
+  if(data.size() < sizeof(kmx::COMP_KEYBOARD)) {
     return false;
   }
 
-  file.close();
-
   const kmx::PCOMP_KEYBOARD comp_keyboard = (kmx::PCOMP_KEYBOARD)data.data();
 
   if(comp_keyboard->dwIdentifier != KMX_DWORD(FILEID_COMPILED)) {
@@ -217,6 +207,22 @@ ldml_processor::process_event(
   }
 }
 
+bool
+ldml_processor::process_no_op_event(
+    km_core_state *state,
+    km_core_virtual_key /* vk */,
+    uint16_t /* modifier_state */,
+    uint8_t is_key_down,
+    uint16_t /* event_flags */
+) {
+  // key-ups have no actions, see process_key_up
+  if (is_key_down) {
+    return false;
+  }
+  state->set_no_op_actions(false);
+  return true;
+}
+
 void
 ldml_processor::process_key_up(ldml_event_state &ldml_state)
     const {
@@ -270,44 +276,50 @@ void ldml_event_state::emit_backspace() {
 void
 ldml_processor::process_key_down(ldml_event_state &ldml_state) const {
   // Look up the key
-  bool found = false;
-  const std::u16string key_str = keys.lookup(ldml_state.get_vk(), ldml_state.get_modifier_state(), found);
+  const std::u32string *key_str = keys.find(ldml_state.get_vk(), ldml_state.get_modifier_state());
 
-  if (!found) {
+  if (key_str == nullptr) {
     // no key was found, so pass the keystroke on to the Engine
     ldml_state.emit_passthrough_keystroke();
-  } else if (!key_str.empty()) {
-    process_key_string(ldml_state, key_str);
+  } else if (!key_str->empty()) {
+    process_key_string(ldml_state, *key_str);
   } // else no action: It's a gap or gap-like key.
 }
 
 void
-ldml_processor::process_key_string(ldml_event_state &ldml_state, const std::u16string &key_str) const {
+ldml_processor::process_key_string(ldml_event_state &ldml_state, const std::u32string &key_str) const {
   // We know that key_str is not empty per the caller.
   assert(!key_str.empty());
 
-  // we convert the keys str to UTF-32 here instead of using the emit_text() overload
-  // so that we don't have to reconvert it inside the transform code.
-  std::u32string key_str32 = kmx::u16string_to_u32string(key_str);
-  (void)process_output(ldml_state, key_str32, transforms.get());
+  // key outputs are already UTF-32 (and NFD), so that we don't have to
+  // reconvert them inside the transform code.
+  (void)process_output(ldml_state, key_str, transforms.get());
 }
 
 size_t ldml_processor::process_output(ldml_event_state &ldml_state, const std::u32string &key_str, ldml::transforms *with_transforms) const {
   // previous context string
   std::u32string old_ctxt;
   (void)ldml_state.context_to_string(old_ctxt, true);
-  // new context string (NFD)
-  std::u32string new_ctxt = old_ctxt;
-  // add the newly added key output to new_ctxt
-  new_ctxt.append(key_str);
 
   // Note:
   //  The normalize functions will assert() and DebugLog() if there is a problem,
   //  so we do not need to assert their status here unless we're going to do something
   //  different with control flow.
-  if (!normalization_disabled) {
+  bool context_nfd = normalization_disabled || ldml_state.context_is_nfd();
+  if (!context_nfd) {
+    // the context was changed from outside, so check all of it, once
+    const std::u32string raw_ctxt = old_ctxt;
     (void)ldml::normalize_nfd_markers(old_ctxt);
-    (void)ldml::normalize_nfd_markers(new_ctxt);
+    context_nfd = (old_ctxt == raw_ctxt);
+  }
+
+  // new context string (NFD)
+  std::u32string new_ctxt = old_ctxt;
+  // add the newly added key output to new_ctxt
+  new_ctxt.append(key_str);
+  if (!normalization_disabled) {
+    // old_ctxt is NFD, so only the end of new_ctxt can change
+    (void)ldml::normalize_nfd_markers_tail(new_ctxt, old_ctxt.length());
   }
 
   /** how many chars of the new_ctxt to replace? This is our return value. */
@@ -322,6 +334,12 @@ size_t ldml_processor::process_output(ldml_event_state &ldml_state, const std::u
     ldml_state.emit_difference(old_ctxt, new_ctxt);
   }
 
+  if (context_nfd) {
+    // the context was NFD, and emit_difference() only replaced its end with
+    // the end of new_ctxt
+    ldml_state.set_context_nfd();
+  }
+
   return new_ctxt_matched;
 }
 
@@ -335,10 +353,11 @@ size_t ldml_processor::apply_transforms(std::u32string &new_ctxt, ldml::transfor
 
   // drop last 'matchedContext':
   new_ctxt.resize(new_ctxt.length() - new_ctxt_matched);
-  // TODO-LDML: should be able to do a normalization-safe append here. Instead, we append and re-normalize.
+  const size_t unchanged = new_ctxt.length();
   new_ctxt.append(transform_output);
   if (!normalization_disabled) {
-    (void)ldml::normalize_nfd_markers(new_ctxt);
+    // the unchanged part is NFD already
+    (void)ldml::normalize_nfd_markers_tail(new_ctxt, unchanged);
   }
   // new_ctxt is now up-to-date and ready to apply.
   return new_ctxt_matched;
@@ -353,12 +372,22 @@ km_core_keyboard_key  * ldml_processor::get_key_list() const {
   return key_list;
 }
 
+std::unique_ptr<processor_state>
+ldml_processor::create_state() const {
+  return std::unique_ptr<processor_state>(new ldml_processor_state());
+}
+
+processor_state *
+ldml_processor_state::clone() const {
+  return new ldml_processor_state(*this);
+}
+
 km_core_keyboard_imx  * ldml_processor::get_imx_list() const {
   km_core_keyboard_imx* imx_list = new km_core_keyboard_imx(KM_CORE_KEYBOARD_IMX_END);
   return imx_list;
 }
 
-km_core_context_item * ldml_processor::get_intermediate_context() {
+km_core_context_item * ldml_processor::get_intermediate_context(km_core_state * _kmn_unused(state)) {
   km_core_context_item *citems = new km_core_context_item(KM_CORE_CONTEXT_ITEM_END);
   return citems;
 }
@@ -518,22 +547,45 @@ size_t
 ldml_event_state::context_to_string(std::u32string &str, bool include_markers) {
     str.clear();
     auto &cp          = state->context();
-    size_t ctxlen     = 0;  // TODO-LDML: not used by callers?
-    uint8_t last_type = KM_CORE_BT_UNKNOWN;
-    for (auto c = cp.rbegin(); c != cp.rend(); c++, ctxlen++) {
-      last_type = c->type;
-      if (last_type == KM_CORE_BT_CHAR) {
-        str.insert(0, 1, c->character);
-      } else if (last_type == KM_CORE_BT_MARKER) {
+    // find the start of the run of chars and markers at the end
+    auto start = cp.end();
+    while (start != cp.begin()) {
+      auto type = (start - 1)->type;
+      if (type != KM_CORE_BT_CHAR && type != KM_CORE_BT_MARKER) {
+        break;
+      }
+      start--;
+    }
+    // then append forwards, rather than prepending each item
+    str.reserve((cp.end() - start) * (include_markers ? 3 : 1));
+    for (auto c = start; c != cp.end(); c++) {
+      if (c->type == KM_CORE_BT_CHAR) {
+        str.push_back(c->character);
+      } else {
         assert(km::core::kmx::is_valid_marker(c->marker));
         if (include_markers) {
-          ldml::prepend_marker(str, c->marker);
+          str.push_back(LDML_UC_SENTINEL);
+          str.push_back(LDML_MARKER_CODE);
+          str.push_back(c->marker);
         }
-      } else {
-        break;
       }
     }
-    return ctxlen; // consumed the entire context buffer.
+    return cp.end() - start; // consumed the entire context buffer.
+}
+
+bool
+ldml_event_state::context_is_nfd() const {
+  auto ps = static_cast<ldml_processor_state const *>(state->processor_state());
+  return ps && ps->context_nfd && ps->context_revision == state->context().revision;
+}
+
+void
+ldml_event_state::set_context_nfd() {
+  auto ps = static_cast<ldml_processor_state *>(state->processor_state());
+  if (ps) {
+    ps->context_nfd      = true;
+    ps->context_revision = state->context().revision;
+  }
 }
 
 static const km_core_option_item NULL_OPTIONS[] = {KM_CORE_OPTIONS_END};
@@ -15,6 +15,7 @@
 #include <memory>
 #include "keyman_core.h"
 #include "processor.hpp"
+#include "blob.hpp"
 #include "option.hpp"
 #include "ldml_vkeys.hpp"
 #include "ldml_transforms.hpp"
@@ -26,17 +27,42 @@ namespace core {
 
 class ldml_event_state;
 
+/** per-state data of the LDML processor */
+class ldml_processor_state : public processor_state {
+public:
+  // The state's context is known to be NFD while nothing but this processor
+  // has changed it. `context_revision` is the revision of the state's context
+  // when that was last established.
+  bool     context_nfd = false;
+  uint32_t context_revision = 0;
+
+  processor_state * clone() const override;
+};
+
 /** our actual processor */
 class ldml_processor : public abstract_processor {
   public:
     ldml_processor(
       path const & kb_path,
-      const std::vector<uint8_t> & data
+      blob const & data,
+      ldml::compile_mode mode = ldml::compile_mode::serial
     );
 
+    /**
+     * Load the keys of a keyboard, as the constructor does
+     * @returns false if the keys could not be loaded
+     */
+    static bool load_keys(
+      kmx::kmx_plus const & kplus,
+      ldml::vkeys & keys
+    );
+
+    /**
+     * Checks the header of keyboard data to see if it is a KMXPlus file;
+     * the data is fully validated by the constructor.
+     */
     static bool is_kmxplus_file(
-      path const & kb_path,
-      std::vector<uint8_t>& data
+      blob const & data
     );
 
     km_core_status
@@ -48,11 +74,21 @@ class ldml_processor : public abstract_processor {
       uint16_t event_flags
     ) override;
 
+    bool
+    process_no_op_event(
+      km_core_state *state,
+      km_core_virtual_key vk,
+      uint16_t modifier_state,
+      uint8_t is_key_down,
+      uint16_t event_flags
+    ) override;
+
     virtual km_core_attr const & attributes() const override;
     km_core_status               validate() const override;
 
     char16_t const *
     lookup_option(
+      state const & _kmn_unused(state),
       km_core_option_scope _kmn_unused(scope),
       std::u16string const & _kmn_unused(key)
     ) const override {
@@ -61,6 +97,7 @@ class ldml_processor : public abstract_processor {
 
     option
     update_option(
+      state & _kmn_unused(state),
       km_core_option_scope _kmn_unused(scope),
       std::u16string const & _kmn_unused(key),
       std::u16string const & _kmn_unused(value)
@@ -75,12 +112,14 @@ class ldml_processor : public abstract_processor {
       km_core_action_item const* action_item
     ) override;
 
-    km_core_context_item * get_intermediate_context() override;
+    km_core_context_item * get_intermediate_context(km_core_state *state) override;
 
     km_core_keyboard_key  * get_key_list() const override;
 
     km_core_keyboard_imx  * get_imx_list() const override;
 
+    std::unique_ptr<processor_state> create_state() const override;
+
     inline bool
     supports_normalization() const override {
       return !normalization_disabled;
@@ -94,7 +133,7 @@ class ldml_processor : public abstract_processor {
     void process_key_down(ldml_event_state &ldml_state) const;
 
     /** process a typed key */
-    void process_key_string(ldml_event_state &ldml_state, const std::u16string &key_str) const;
+    void process_key_string(ldml_event_state &ldml_state, const std::u32string &key_str) const;
 
     /** process a backspace */
     void process_backspace(ldml_event_state &ldml_state) const;
@@ -180,6 +219,12 @@ public:
     */
    size_t context_to_string(std::u32string &str, bool include_markers = true);
 
+   /** @returns true if the context is known to be NFD, with markers */
+   bool context_is_nfd() const;
+
+   /** note that the context is now known to be NFD, with markers */
+   void set_context_nfd();
+
  private:
    km_core_virtual_key vk;
    uint16_t modifier_state;
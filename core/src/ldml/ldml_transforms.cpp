@@ -9,7 +9,10 @@
 #include "ldml_markers.hpp"
 #include "debuglog.h"
 #include <algorithm>
+#include <atomic>
 #include <string>
+#include <system_error>
+#include <thread>
 #include "kmx/kmx_xstring.h"
 #include <assert.h>
 #include "ldml_utils.hpp"
@@ -35,7 +38,11 @@ namespace ldml {
 #endif
 
 element::element(const SimpleUSet &new_u, KMX_DWORD new_flags)
-    : chr(), uset(new_u), flags((new_flags & ~LDML_ELEM_FLAGS_TYPE) | LDML_ELEM_FLAGS_TYPE_USET) {
+    : element(std::make_shared<const SimpleUSet>(new_u), new_flags) {
+}
+
+element::element(std::shared_ptr<const SimpleUSet> new_u, KMX_DWORD new_flags)
+    : chr(), uset(std::move(new_u)), flags((new_flags & ~LDML_ELEM_FLAGS_TYPE) | LDML_ELEM_FLAGS_TYPE_USET) {
 }
 
 element::element(km_core_usv ch, KMX_DWORD new_flags)
@@ -77,17 +84,28 @@ element::get_flags() const {
 bool
 element::matches(km_core_usv ch) const {
   if (is_uset()) {
-    return uset.contains(ch);
+    return uset->contains(ch);
   } else {
     return chr == ch;
   }
 }
 
+void
+element::add_to(icu::UnicodeSet &set) const {
+  if (is_uset()) {
+    for (const auto &range : uset->get_ranges()) {
+      set.add((UChar32)range.start, (UChar32)range.end);
+    }
+  } else {
+    set.add((UChar32)chr);
+  }
+}
+
 void
 element::dump() const {
   if (is_uset()) {
     DebugLog("element order=%d USET", (int)get_order());
-    uset.dump();
+    uset->dump();
   } else {
     DebugLog("element order=%d U+%04X", (int)get_order(), (int)chr);
   }
@@ -128,11 +146,12 @@ reorder_sort_key::operator>(const reorder_sort_key &other) const {
   return (compare(other) > 0);
 }
 
-std::deque<reorder_sort_key>
+std::vector<reorder_sort_key>
 reorder_sort_key::from(const std::u32string &str) {
   // construct a 'baseline' sort key, that is, in the absence of
   // any match rules.
-  std::deque<reorder_sort_key> keylist;
+  std::vector<reorder_sort_key> keylist;
+  keylist.reserve(str.length());
   auto s           = str.begin();  // str iterator
   reorder_weight c = 0;            // str index
   for (auto e = str.begin(); e < str.end(); e++, s++, c++) {
@@ -155,7 +174,13 @@ reorder_sort_key::dump() const {
 
 size_t
 element_list::match_end(const std::u32string &str) const {
-  if (str.length() < size()) {
+  return match_end(str, 0, str.length());
+}
+
+size_t
+element_list::match_end(const std::u32string &str, size_t begin, size_t end) const {
+  assert(begin <= end && end <= str.length());
+  if (end - begin < size()) {
     // input string too short, can't possibly match.
     // This assumes each element is a single char, no string elements.
     return 0;
@@ -163,7 +188,7 @@ element_list::match_end(const std::u32string &str) const {
   // s: iterate from end to front of string
   // For example, if str = 'abcd', we try to match 'd', then 'c', then 'b', then 'a'
   // starting with the end of the element list.
-  auto s = str.rbegin();
+  auto s = str.rbegin() + (str.length() - end);
   // e: end to front on elements.
   // we know the # of elements is <= length of string,
   // so we don't need to check the string's boundaries
@@ -193,10 +218,10 @@ element_list::load(const kmx::kmx_plus &kplus, kmx::KMXPLUS_ELEM id) {
     } else if (type == LDML_ELEM_FLAGS_TYPE_USET) {
       // need to load a SimpleUSet
       auto u = kplus.usetHelper.getUset(e.element);
-      if (!u.valid()) {
+      if (!u->valid()) {
         DebugLog("Error, invalid UnicodeSet at element %d", (int)i);
-        u.dump();
-        assert(u.valid());
+        u->dump();
+        assert(u->valid());
         return false;
       }
       emplace_back(u, flags);
@@ -213,8 +238,8 @@ element_list::load(const kmx::kmx_plus &kplus, kmx::KMXPLUS_ELEM id) {
   return true;
 }
 
-std::deque<reorder_sort_key> &
-element_list::update_sort_key(size_t offset, std::deque<reorder_sort_key> &key) const {
+std::vector<reorder_sort_key> &
+element_list::update_sort_key(size_t offset, std::vector<reorder_sort_key> &key) const {
   /** string index */
   size_t c = 0;
   bool have_last_base                = false;
@@ -280,10 +305,10 @@ reorder_entry::reorder_entry(const element_list &new_elements, const element_lis
 }
 
 size_t
-reorder_entry::match_end(std::u32string &str, size_t offset, size_t len) const {
-  auto substr      = str.substr(offset, len);
+reorder_entry::match_end(const std::u32string &str, size_t offset, size_t len) const {
+  const size_t end = offset + len;
   // first, see if the elements match. If not, this entry doesn't apply
-  size_t match_len = elements.match_end(substr);
+  size_t match_len = elements.match_end(str, offset, end);
   if (match_len == 0) {
     return 0;
   }
@@ -291,10 +316,8 @@ reorder_entry::match_end(std::u32string &str, size_t offset, size_t len) const {
   // Now we need to check if there is a "before=" element string that
   // is also a precondition.
   if (!before.empty()) {
-    // does not match before offset
-    std::u32string prefix = substr.substr(0, substr.length() - match_len);
-    // make sure the 'before' is present
-    if (before.match_end(prefix) == 0) {
+    // make sure the 'before' is present, just before the match
+    if (before.match_end(str, offset, end - match_len) == 0) {
       return 0;  // break out.
     }
   }
@@ -324,6 +347,58 @@ reorder_entry::operator>(const reorder_entry &other) const {
   return (compare(other) > 0);
 }
 
+reorder_group::reorder_group() : list(), fEndIndex(), fIndexed(false) {
+  // until buildIndex() is called, try every entry
+  fStartChars.add(0, 0x10FFFF);
+}
+
+void
+reorder_group::buildIndex() {
+  fStartChars.clear();
+  fEndIndex.clear();
+  // the chars that each entry can end with, and the boundaries of their ranges
+  std::vector<icu::UnicodeSet> endChars(list.size());
+  std::vector<km_core_usv> bounds;
+  for (size_t i = 0; i < list.size(); i++) {
+    const auto &elements = list[i].elements;
+    if (elements.empty()) {
+      continue;  // can't match
+    }
+    elements.front().add_to(fStartChars);
+    elements.back().add_to(endChars[i]);
+    for (int32_t r = 0; r < endChars[i].getRangeCount(); r++) {
+      bounds.push_back(endChars[i].getRangeStart(r));
+      bounds.push_back(endChars[i].getRangeEnd(r) + 1);
+    }
+  }
+  std::sort(bounds.begin(), bounds.end());
+  bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+  // between two boundaries, each entry matches either all chars or none
+  for (size_t b = 0; b + 1 < bounds.size(); b++) {
+    end_range range{bounds[b], bounds[b + 1] - 1, {}};
+    for (size_t i = 0; i < list.size(); i++) {
+      if (endChars[i].contains((UChar32)range.start)) {
+        range.entries.push_back(i);
+      }
+    }
+    if (!range.entries.empty()) {
+      fEndIndex.emplace_back(std::move(range));
+    }
+  }
+  fIndexed = true;
+}
+
+const std::vector<size_t> *
+reorder_group::entriesEndingWith(km_core_usv ch) const {
+  auto range = std::upper_bound(fEndIndex.begin(), fEndIndex.end(), ch, [](km_core_usv c, const end_range &r) {
+    return c < r.start;
+  });
+  if (range == fEndIndex.begin() || ch > (--range)->end) {
+    return nullptr;
+  }
+  return &range->entries;
+}
+
 bool
 reorder_group::apply(std::u32string &str) const {
   /** did we apply anything */
@@ -331,31 +406,67 @@ reorder_group::apply(std::u32string &str) const {
   /** did we match anything */
   bool some_match = false;
 
+  // every match starts with one of the start chars, so without any of them
+  // (such as when typing Latin text) there is nothing to do. Marker chars
+  // are scanned too, which can only make us do the full work.
+  if (std::none_of(str.begin(), str.end(), [this](char32_t ch) { return fStartChars.contains((UChar32)ch); })) {
+    DebugTran("Skip: No reorder start chars.");
+    return false;
+  }
+
   // markers need to 'pass through' reorders. remove and re-add if needed
+  const bool has_markers = (str.find(LDML_UC_SENTINEL) != std::u32string::npos);
   marker_map markers;
-  std::u32string out = remove_markers(str, markers, plain_sentinel);
+  std::u32string out = has_markers ? remove_markers(str, markers, plain_sentinel) : str;
 
   // get a baseline sort key
   auto sort_keys = reorder_sort_key::from(out);
 
-  // apply ALL reorders in the group.
-  for (const auto &r : list) {
-    // work backward from end of string forward
-    // That is, see if "abc" matches "abc" or "ab" or "a"
-    for (size_t s = out.length(); s > 0; s--) {
-      size_t submatch = r.match_end(out, 0, s);
+  /** every entry, if there is no index */
+  std::vector<size_t> all_entries;
+  if (!fIndexed) {
+    for (size_t i = 0; i < list.size(); i++) {
+      all_entries.push_back(i);
+    }
+  }
+
+  // find ALL reorder matches in the group, only trying the entries that can
+  // end with each char.
+  // work backward from end of string forward
+  // That is, see if "abc" matches "abc" or "ab" or "a"
+  struct reorder_match {
+    size_t entry;
+    size_t start;
+  };
+  std::vector<reorder_match> matches;
+  for (size_t s = out.length(); s > 0; s--) {
+    const std::vector<size_t> *entries = fIndexed ? entriesEndingWith(out[s - 1]) : &all_entries;
+    if (entries == nullptr) {
+      continue;
+    }
+    for (size_t i : *entries) {
+      size_t submatch = list[i].match_end(out, 0, s);
       if (submatch != 0) {
-#if KMXPLUS_DEBUG_TRANSFORM
-        DebugTran("Matched: %S (off=%d, len=%d)", str.c_str(), 0, s);
-        r.elements.dump();
-#endif
-        // update the sort key
-        size_t sub_match_start = s - submatch;
-        r.elements.update_sort_key(sub_match_start, sort_keys);
-        some_match = true; // record that there was a match
+        matches.push_back({i, s - submatch});
       }
     }
   }
+  // later entries take precedence, so update the sort key entry by entry,
+  // each from the end of the string forward, as trying each entry in turn
+  // along the whole string would
+  std::sort(matches.begin(), matches.end(), [](const reorder_match &a, const reorder_match &b) {
+    return a.entry < b.entry || (a.entry == b.entry && a.start > b.start);
+  });
+  for (const auto &match : matches) {
+    const auto &r = list[match.entry];
+#if KMXPLUS_DEBUG_TRANSFORM
+    DebugTran("Matched: %S (off=%d)", str.c_str(), match.start);
+    r.elements.dump();
+#endif
+    // update the sort key
+    r.elements.update_sort_key(match.start, sort_keys);
+    some_match = true; // record that there was a match
+  }
   if (!some_match) {
     // get out if nothing matched.
     // the sortkey won't be "interesting", and the sort
@@ -393,7 +504,7 @@ reorder_group::apply(std::u32string &str) const {
   // Here there is only a single range to sort [0,4]
 
   /** pointer to the beginning of the current run. */
-  std::deque<reorder_sort_key>::iterator run_start = sort_keys.begin();
+  std::vector<reorder_sort_key>::iterator run_start = sort_keys.begin();
   for(auto e = run_start; e != sort_keys.end(); e++) {
     // find the actual beginning base: primary weight = 0 and tertiary = 0.
     // (tertiary chars will have primary=0 BUT will have tertiary nonzero.)
@@ -433,22 +544,484 @@ reorder_group::apply(std::u32string &str) const {
     r.dump();
   }
 #endif
-  add_back_markers(str, out, markers, plain_sentinel);
+  if (has_markers) {
+    add_back_markers(str, out, markers, plain_sentinel);
+  } else {
+    str.swap(out);
+  }
   return true; // updated
 }
 
+/** convert a UTF-32 string to an ICU UTF-16 string */
+static icu::UnicodeString
+to_unicode_string(const std::u32string &str) {
+  return icu::UnicodeString::fromUTF32(reinterpret_cast<const UChar32 *>(str.data()), (int32_t)str.length());
+}
+
+/** @returns a + b for lookbehind lengths, where UNBOUNDED stays so */
+static int32_t
+add_lookbehind(int32_t a, int32_t b) {
+  return (a > transform_entry::UNBOUNDED - b) ? transform_entry::UNBOUNDED : a + b;
+}
+
+/**
+ * Reads just enough of the ICU regex syntax of a transform pattern to find
+ * the code points that a match can end with, how far back from the end a
+ * match can reach, or whether the pattern is a plain literal string.
+ * Anything else it gives up on.
+ */
+class pattern_parser {
+public:
+  pattern_parser(const icu::UnicodeString &pattern) : p(pattern), len(pattern.length()), pos(0), depth(0) {
+  }
+
+  /**
+   * @param chars on return, every code point if the pattern was not understood
+   * @param width on return, the longest lookbehind of a match, in code points,
+   * or transform_entry::UNBOUNDED
+   */
+  void parse(icu::UnicodeSet &chars, int32_t &width) {
+    bool nullable;
+    if (!parseAlternation(chars, nullable, width) || pos < len) {
+      chars.clear().add(0, 0x10FFFF);
+      width = transform_entry::UNBOUNDED;
+    }
+  }
+
+  /** @returns true if the pattern only matches the string literal */
+  bool parseLiteral(std::u32string &literal) {
+    literal.clear();
+    while (pos < len) {
+      UChar32 c = p.char32At(pos);
+      if (c == u'\\') {
+        if (++pos >= len) {
+          return false;
+        }
+        c = p.char32At(pos);
+        if (c == u'u' || c == u'U' || c == u'x') {
+          if (!parseHex(c == u'u' ? 4 : c == u'U' ? 8 : 2, c) || U_IS_SURROGATE(c)) {
+            return false;
+          }
+        } else if (c < 0x80 && !(c >= u'0' && c <= u'9') && !(c >= u'a' && c <= u'z') && !(c >= u'A' && c <= u'Z')) {
+          // quoted punctuation
+          pos++;
+        } else {
+          return false;
+        }
+      } else if (c < 0x80 && std::char_traits<char>::find("^$.|?*+()[]{}", 13, (char)c)) {
+        return false;
+      } else {
+        pos += U16_LENGTH(c);
+      }
+      literal.push_back((char32_t)c);
+    }
+    return !literal.empty();
+  }
+
+private:
+  const icu::UnicodeString &p;
+  const int32_t len;
+  int32_t pos;
+  /** nesting level of groups */
+  int32_t depth;
+
+
+  /**
+   * Parse alternatives up to the next unmatched ')' or the end
+   * @param chars final code points of a non-empty match
+   * @param nullable set if a match can be empty
+   * @param width longest lookbehind of a match
+   */
+  bool parseAlternation(icu::UnicodeSet &chars, bool &nullable, int32_t &width) {
+    chars.clear();
+    nullable = false;
+    width = 0;
+    icu::UnicodeSet seqChars;
+    bool seqNullable = true;
+    int32_t seqWidth = 0;
+    while (pos < len && p.charAt(pos) != u')') {
+      if (p.charAt(pos) == u'|') {
+        if (depth == 0) {
+          // the '$' that we add only anchors the last alternative
+          return false;
+        }
+        pos++;
+        chars.addAll(seqChars);
+        nullable = nullable || seqNullable;
+        width = std::max(width, seqWidth);
+        seqChars.clear();
+        seqNullable = true;
+        seqWidth = 0;
+        continue;
+      }
+      icu::UnicodeSet atomChars;
+      bool atomNullable = false;
+      int32_t atomWidth = 0;
+      if (!parseAtom(atomChars, atomNullable, atomWidth) || !parseQuantifier(atomNullable, atomWidth)) {
+        return false;
+      }
+      seqWidth = add_lookbehind(seqWidth, atomWidth);
+      if (atomNullable) {
+        // the sequence can also end with whatever came before this atom
+        seqChars.addAll(atomChars);
+      } else {
+        seqChars = atomChars;
+        seqNullable = false;
+      }
+    }
+    chars.addAll(seqChars);
+    nullable = nullable || seqNullable;
+    width = std::max(width, seqWidth);
+    return true;
+  }
+
+  bool parseAtom(icu::UnicodeSet &chars, bool &nullable, int32_t &width) {
+    const UChar32 c = p.char32At(pos);
+    width = 1;
+    switch (c) {
+    case u'(':
+      return parseGroup(chars, nullable, width);
+    case u'[':
+      return parseSet(chars);
+    case u'\\':
+      return parseEscape(chars, nullable, width);
+    case u'.':
+      pos++;
+      chars.add(0, 0x10FFFF);
+      return true;
+    case u'^':
+      // needs the real start of the text
+      pos++;
+      nullable = true;
+      width = transform_entry::UNBOUNDED;
+      return true;
+    case u'$':
+      pos++;
+      nullable = true;
+      width = 0;
+      return true;
+    case u'*':
+    case u'+':
+    case u'?':
+    case u'{':
+      return false;
+    default:
+      pos += U16_LENGTH(c);
+      chars.add(c);
+      return true;
+    }
+  }
+
+  /** parse a number of repeats, which may be empty, @returns UNBOUNDED if too large */
+  int32_t parseCount() {
+    int32_t count = 0;
+    while (pos < len && p.charAt(pos) >= u'0' && p.charAt(pos) <= u'9') {
+      count = add_lookbehind(std::min(count, transform_entry::UNBOUNDED / 10) * 10, p.charAt(pos) - u'0');
+      pos++;
+    }
+    return count;
+  }
+
+  bool parseQuantifier(bool &nullable, int32_t &width) {
+    if (pos >= len) {
+      return true;
+    }
+    const char16_t c = p.charAt(pos);
+    if (c == u'?') {
+      pos++;
+      nullable = true;
+    } else if (c == u'*' || c == u'+') {
+      pos++;
+      nullable = nullable || c == u'*';
+      width = (width == 0) ? 0 : transform_entry::UNBOUNDED;
+    } else if (c == u'{') {
+      // {n}, {n,} or {n,m}: the minimum decides if it can be empty, and the
+      // maximum its width
+      const int32_t start = ++pos;
+      const int32_t min = parseCount();
+      if (pos == start) {
+        return false;
+      }
+      int32_t max = min;
+      if (pos < len && p.charAt(pos) == u',') {
+        pos++;
+        const int32_t maxStart = pos;
+        max = parseCount();
+        if (pos == maxStart) {
+          max = transform_entry::UNBOUNDED;
+        }
+      }
+      if (pos >= len || p.charAt(pos) != u'}') {
+        return false;
+      }
+      pos++;
+      nullable = nullable || min == 0;
+      if (width != 0) {
+        width = (max >= transform_entry::UNBOUNDED / width) ? transform_entry::UNBOUNDED : width * max;
+      }
+    } else {
+      return true;
+    }
+    // lazy or possessive
+    if (pos < len && (p.charAt(pos) == u'?' || p.charAt(pos) == u'+')) {
+      pos++;
+    }
+    return true;
+  }
+
+  bool parseGroup(icu::UnicodeSet &chars, bool &nullable, int32_t &width) {
+    pos++;  // '('
+    bool lookaround = false;
+    bool lookahead = false;
+    if (pos < len && p.charAt(pos) == u'?') {
+      const char16_t c  = pos + 1 < len ? p.charAt(pos + 1) : 0;
+      const char16_t c2 = pos + 2 < len ? p.charAt(pos + 2) : 0;
+      if (c == u':' || c == u'>') {
+        pos += 2;
+      } else if (c == u'=' || c == u'!') {
+        pos += 2;
+        lookaround = lookahead = true;
+      } else if (c == u'<' && (c2 == u'=' || c2 == u'!')) {
+        pos += 3;
+        lookaround = true;
+      } else {
+        // flags and named groups
+        return false;
+      }
+    }
+    depth++;
+    const bool ok = parseAlternation(chars, nullable, width);
+    depth--;
+    if (!ok || pos >= len || p.charAt(pos) != u')') {
+      return false;
+    }
+    pos++;
+    if (lookaround) {
+      // zero width
+      chars.clear();
+      nullable = true;
+    }
+    if (lookahead) {
+      // can only look at text that the rest of the match covers. A lookbehind
+      // keeps its width, as it looks further back.
+      width = 0;
+    }
+    return true;
+  }
+
+  bool parseSet(icu::UnicodeSet &chars) {
+    // UnicodeSet syntax matches regex sets, apart from set operators, the
+    // '{string}' and '$' extensions, and class escapes, which we leave alone
+    icu::ParsePosition end(pos);
+    UErrorCode status = U_ZERO_ERROR;
+    chars.applyPattern(p, end, 0, nullptr, status);
+    if (U_FAILURE(status) || end.getIndex() <= pos) {
+      return false;
+    }
+    bool escaped = false;
+    for (int32_t i = pos; i < end.getIndex(); i++) {
+      const char16_t c = p.charAt(i);
+      const char16_t prev = p.charAt(i - 1);
+      if (escaped) {
+        escaped = false;
+        // UnicodeSet reads regex class escapes such as \d as the letter
+        // itself, so only the escapes that mean the same to both are followed
+        if (((c >= u'a' && c <= u'z') || (c >= u'A' && c <= u'Z')) &&
+            c != u'u' && c != u'U' && c != u'x' && c != u'N' && c != u'p' && c != u'P') {
+          return false;
+        }
+        continue;
+      }
+      if (c == u'\\') {
+        escaped = true;
+        continue;
+      }
+      if (c == u'$' || ((c == u'&' || c == u'-' || c == u'~') && prev == c) ||
+          (c == u'{' && prev != u'x' && prev != u'p' && prev != u'P' && prev != u'N')) {
+        return false;
+      }
+    }
+    pos = end.getIndex();
+    return true;
+  }
+
+  bool parseEscape(icu::UnicodeSet &chars, bool &nullable, int32_t &width) {
+    if (++pos >= len) {
+      return false;
+    }
+    const UChar32 c = p.char32At(pos);
+    switch (c) {
+    case u'u':
+    case u'U':
+    case u'x': {
+      UChar32 value;
+      if (!parseHex(c == u'u' ? 4 : c == u'U' ? 8 : 2, value)) {
+        return false;
+      }
+      if (U_IS_SURROGATE(value)) {
+        // may pair up with a neighbouring escape
+        chars.add(0, 0x10FFFF);
+      } else {
+        chars.add(value);
+      }
+      return true;
+    }
+    case u'p':
+    case u'P': {
+      const int32_t start = pos - 1;
+      int32_t end = pos + 2;
+      if (pos + 1 < len && p.charAt(pos + 1) == u'{') {
+        end = p.indexOf(u'}', pos + 1) + 1;
+      }
+      if (end <= pos || end > len) {
+        return false;
+      }
+      icu::UnicodeString pattern(u'[');
+      pattern.append(p, start, end - start).append(u']');
+      UErrorCode status = U_ZERO_ERROR;
+      chars.applyPattern(pattern, status);
+      pos = end;
+      return U_SUCCESS(status);
+    }
+    case u't': pos++; chars.add(0x09); return true;
+    case u'n': pos++; chars.add(0x0A); return true;
+    case u'f': pos++; chars.add(0x0C); return true;
+    case u'r': pos++; chars.add(0x0D); return true;
+    case u'a': pos++; chars.add(0x07); return true;
+    case u'e': pos++; chars.add(0x1B); return true;
+    case u'b':
+    case u'B':
+      // zero width, but looks at the char before
+      pos++;
+      nullable = true;
+      return true;
+    case u'A':
+    case u'G':
+      // zero width, but needs the real start of the text
+      pos++;
+      nullable = true;
+      width = transform_entry::UNBOUNDED;
+      return true;
+    case u'z':
+    case u'Z':
+      // zero width
+      pos++;
+      nullable = true;
+      width = 0;
+      return true;
+    case u'Q':
+    case u'N':
+    case u'c':
+    case u'k':
+      return false;
+    default:
+      break;
+    }
+    if (c >= u'0' && c <= u'9') {
+      // back reference or octal, which could match anything or nothing
+      while (pos < len && p.charAt(pos) >= u'0' && p.charAt(pos) <= u'9') {
+        pos++;
+      }
+      chars.add(0, 0x10FFFF);
+      nullable = true;
+      width = transform_entry::UNBOUNDED;
+      return true;
+    }
+    if ((c >= u'a' && c <= u'z') || (c >= u'A' && c <= u'Z')) {
+      // \d, \w, \s, \X and friends
+      pos++;
+      chars.add(0, 0x10FFFF);
+      if (c == u'X' || c == u'R') {
+        // more than one char
+        width = transform_entry::UNBOUNDED;
+      }
+      return true;
+    }
+    if (c >= 0x80) {
+      return false;
+    }
+    // quoted punctuation
+    pos++;
+    chars.add(c);
+    return true;
+  }
+
+  /** parse \uhhhh, \Uhhhhhhhh, \xhh or \x{h...} with pos on the letter */
+  bool parseHex(int32_t digits, UChar32 &value) {
+    pos++;
+    int32_t end = pos + digits;
+    const bool braced = digits == 2 && pos < len && p.charAt(pos) == u'{';
+    if (braced) {
+      end = p.indexOf(u'}', ++pos);
+      if (end < 0) {
+        return false;
+      }
+    }
+    if (end > len || end == pos) {
+      return false;
+    }
+    value = 0;
+    for (; pos < end; pos++) {
+      const char16_t c = p.charAt(pos);
+      int32_t v;
+      if (c >= u'0' && c <= u'9') {
+        v = c - u'0';
+      } else if (c >= u'a' && c <= u'f') {
+        v = c - u'a' + 10;
+      } else if (c >= u'A' && c <= u'F') {
+        v = c - u'A' + 10;
+      } else {
+        return false;
+      }
+      value = value * 16 + v;
+      if (value > 0x10FFFF) {
+        return false;
+      }
+    }
+    if (braced) {
+      pos++;
+    }
+    return true;
+  }
+};
+
+void
+transform_entry::findFinalChars(const icu::UnicodeString &pattern, icu::UnicodeSet &chars) {
+  int32_t width;
+  pattern_parser(pattern).parse(chars, width);
+}
+
+int32_t
+transform_entry::findLookbehind(const icu::UnicodeString &pattern) {
+  icu::UnicodeSet chars;
+  int32_t width;
+  pattern_parser(pattern).parse(chars, width);
+  return width;
+}
+
+bool
+transform_entry::parseLiteral(const icu::UnicodeString &pattern, std::u32string &literal) {
+  return pattern_parser(pattern).parseLiteral(literal);
+}
+
 transform_entry::transform_entry(const transform_entry &other)
-    : fFrom(other.fFrom), fTo(other.fTo), fFromPattern(nullptr), fMapFromStrId(other.fMapFromStrId),
-      fMapToStrId(other.fMapToStrId), fMapFromList(other.fMapFromList), fMapToList(other.fMapToList),
-      normalization_disabled(other.normalization_disabled) {
+    : fFrom(other.fFrom), fTo(other.fTo), fToU16(other.fToU16), fPatternU16(other.fPatternU16), fFromPattern(nullptr),
+      fCompileOnce(), fFinalChars(other.fFinalChars),
+      fIsLiteral(other.fIsLiteral), fLookbehind(other.fLookbehind), fLiteral(other.fLiteral), fMatcher(nullptr),
+      fMatcherLock(), fMapFromStrId(other.fMapFromStrId), fMapToStrId(other.fMapToStrId),
+      fMapFromList(other.fMapFromList), fMapToList(other.fMapToList), fMapToListU16(other.fMapToListU16),
+      fMapFromIndex(other.fMapFromIndex), normalization_disabled(other.normalization_disabled) {
   if (other.fFromPattern) {
-    // clone pattern
+    // clone pattern, otherwise we compile our own when needed
     fFromPattern.reset(other.fFromPattern->clone());
   }
 }
 
 transform_entry::transform_entry(const std::u32string &from, const std::u32string &to)
-    : fFrom(from), fTo(to), fFromPattern(nullptr), fMapFromStrId(), fMapToStrId(), fMapFromList(), fMapToList(), normalization_disabled(false) {
+    : fFrom(from), fTo(to), fToU16(to_unicode_string(to)), fPatternU16(), fFromPattern(nullptr), fCompileOnce(),
+      fFinalChars(), fIsLiteral(false),
+      fLookbehind(UNBOUNDED), fLiteral(), fMatcher(nullptr), fMatcherLock(),
+      fMapFromStrId(), fMapToStrId(), fMapFromList(), fMapToList(), fMapToListU16(), fMapFromIndex(), normalization_disabled(false) {
   assert(!fFrom.empty());
 
   init();
@@ -462,7 +1035,10 @@ transform_entry::transform_entry(
     const kmx::kmx_plus &kplus,
     bool &valid,
     bool norm_disabled)
-    : fFrom(from), fTo(to), fFromPattern(nullptr), fMapFromStrId(mapFrom), fMapToStrId(mapTo), normalization_disabled(norm_disabled) {
+    : fFrom(from), fTo(to), fToU16(to_unicode_string(to)), fPatternU16(), fFromPattern(nullptr), fCompileOnce(),
+      fFinalChars(), fIsLiteral(false),
+      fLookbehind(UNBOUNDED), fLiteral(), fMatcher(nullptr), fMatcherLock(),
+      fMapFromStrId(mapFrom), fMapToStrId(mapTo), normalization_disabled(norm_disabled) {
   if (!valid)
     return; // exit early
   assert(!fFrom.empty()); // TODO-LDML: should not happen?
@@ -504,6 +1080,16 @@ transform_entry::transform_entry(
     // did we get the expected items?
     assert(fMapFromList.size() == fromLength);
     assert(fMapToList.size()   == toLength);
+    for (const auto &str : fMapToList) {
+      fMapToListU16.emplace_back(to_unicode_string(str));
+    }
+    // index the from list, so that matches don't search it. emplace()
+    // keeps the first index of a repeated item.
+    fMapFromIndex.reserve(fMapFromList.size());
+    int32_t index = 0;
+    for (auto str = fMapFromList.begin(); str < fMapFromList.end(); str++, index++) {
+      fMapFromIndex.emplace(to_unicode_string(*str), index);
+    }
   }
 }
 
@@ -519,27 +1105,71 @@ transform_entry::init() {
     normalize_nfd_markers(from2, regex_sentinel);
   }
   std::u16string patstr = km::core::kmx::u32string_to_u16string(from2);
-  UErrorCode status           = U_ZERO_ERROR;
   /* const */ icu::UnicodeString patustr = icu::UnicodeString(patstr.data(), (int32_t)patstr.length());
+  pattern_parser(patustr).parse(fFinalChars, fLookbehind);
+  // the '$' that we add also matches before a final line terminator, which
+  // can be the two code points CR LF
+  fLookbehind = add_lookbehind(fLookbehind, 2);
+  // A literal needs no regex to match it, as long as the replacement has no
+  // group references or escapes for the regex to expand
+  fIsLiteral = fMapFromStrId == 0 && fTo.find_first_of(U"$\\") == std::u32string::npos &&
+               parseLiteral(patustr, fLiteral);
   // add '$' to match to end
   patustr.append(u'$'); // TODO-LDML: may need to escape some markers. Marker #91 will look like a `[` to the pattern
-  fFromPattern.reset(icu::RegexPattern::compile(patustr, 0, status));
-  return (UASSERT_SUCCESS(status));
+  fPatternU16 = patustr;
+  return true;
+}
+
+bool
+transform_entry::compile() const {
+  std::call_once(fCompileOnce, [this]() {
+    if (!fFromPattern) {
+      UErrorCode status = U_ZERO_ERROR;
+      fFromPattern.reset(icu::RegexPattern::compile(fPatternU16, 0, status));
+      if (!UASSERT_SUCCESS(status)) {
+        fFromPattern.reset();
+      }
+    }
+  });
+  return fFromPattern != nullptr;
 }
 
 size_t
-transform_entry::apply(const std::u32string &input, std::u32string &output) const {
-  assert(fFromPattern);
-  // TODO-LDML: Really? can't go from u32 to UnicodeString?
-  // TODO-LDML: Also, we could cache the u16 string at the transformGroup level or higher.
+transform_entry::apply(const icu::UnicodeString &matchustr, std::u32string &output) const {
+  if (!compile()) {
+    DebugLog("transform pattern failed to compile");
+    return 0;
+  }
   UErrorCode status = U_ZERO_ERROR;
-  const std::u16string matchstr = km::core::kmx::u32string_to_u16string(input);
-  icu::UnicodeString matchustr  = icu::UnicodeString(matchstr.data(), (int32_t)matchstr.length());
-  // TODO-LDML: create a new Matcher every time. These could be cached and reset.
-  std::unique_ptr<icu::RegexMatcher> matcher(fFromPattern->matcher(matchustr, status));
+  // Reuse our matcher, unless another thread is using it right now
+  std::unique_lock<std::mutex> lock(fMatcherLock, std::try_to_lock);
+  std::unique_ptr<icu::RegexMatcher> ownMatcher;
+  icu::RegexMatcher *matcher;
+  if (lock.owns_lock()) {
+    if (fMatcher) {
+      fMatcher->reset(matchustr);
+    } else {
+      fMatcher.reset(fFromPattern->matcher(matchustr, status));
+    }
+    matcher = fMatcher.get();
+  } else {
+    ownMatcher.reset(fFromPattern->matcher(matchustr, status));
+    matcher = ownMatcher.get();
+  }
   if (!UASSERT_SUCCESS(status)) {
     return 0; // TODO-LDML: return error
   }
+  // Only try matches that start within our lookbehind of the end
+  if (fLookbehind != UNBOUNDED) {
+    const int32_t length = matchustr.length();
+    const int32_t start  = matchustr.moveIndex32(length, -fLookbehind);
+    if (start > 0) {
+      matcher->region(start, length, status);
+      if (!UASSERT_SUCCESS(status)) {
+        return 0; // TODO-LDML: return error
+      }
+    }
+  }
 
   if (!matcher->find(status)) { // i.e. matches somewhere, in this case at end of str
     return 0; // no match
@@ -565,13 +1195,11 @@ transform_entry::apply(const std::u32string &input, std::u32string &output) cons
   // now, do the replace.
 
   /** this is the 'to' or other replacement string.*/
-  icu::UnicodeString rustr;
+  const icu::UnicodeString *rustr;
   if (fMapFromStrId == 0) {
     // Normal case: not a map.
     // This replace will apply $1, $2 etc.
-    // Convert the fTo into u16 TODO-LDML (we could cache this?)
-    const std::u16string rstr = km::core::kmx::u32string_to_u16string(fTo);
-    rustr  = icu::UnicodeString(rstr.data(), (int32_t)rstr.length());
+    rustr = &fToU16;
   } else {
     // Set map case: mapping from/to
 
@@ -582,37 +1210,24 @@ transform_entry::apply(const std::u32string &input, std::u32string &output) cons
       // TODO-LDML: could be a malformed from pattern
       return 0; // TODO-LDML: return error
     }
-    // now, how long is group1 in UTF-32, hmm?
-    UErrorCode preflightStatus = U_ZERO_ERROR; // throwaway status
-    auto group1Len             = group1.toUTF32(nullptr, 0, preflightStatus);
-    char32_t *s                = new char32_t[group1Len + 1];
-    assert(s != nullptr); // TODO-LDML: OOM
-    // convert
-    group1.toUTF32((UChar32 *)s, group1Len + 1, status);
-    if (!UASSERT_SUCCESS(status)) {
-      return 0; // TODO-LDML: memory issue
-    }
-    std::u32string match32(s, group1Len); // taken from just group1
-    // clean up buffer
-    delete [] s;
-
     // Now we're ready to do the actual mapping.
 
     // 1., we need to find the index in the source set.
-    auto matchIndex = findIndexFrom(match32);
+    auto matchIndex = findIndexFrom(group1);
     assert(matchIndex != -1L); // TODO-LDML: not matching shouldn't happen, the regex wouldn't have matched.
     // we already asserted on load that the from and to sets have the same cardinality.
 
-    // 2. get the target string, convert to utf-16
+    // 2. get the target string, already in utf-16
     // we use the same matchIndex that was just found
-    const std::u16string rstr = km::core::kmx::u32string_to_u16string(fMapToList.at(matchIndex));
-
-    // 3. update the UnicodeString for replacement
-    rustr  = icu::UnicodeString(rstr.data(), (int32_t)rstr.length());
+    rustr = &fMapToListU16.at(matchIndex);
     // and we return to the regular code flow.
   }
   // here we replace the match output. No normalization, yet.
-  icu::UnicodeString entireOutput = matcher->replaceFirst(rustr, status);
+  // appendReplacement() works from the match we have, where replaceFirst()
+  // would reset the matcher and search the whole input again.
+  icu::UnicodeString entireOutput;
+  matcher->appendReplacement(entireOutput, *rustr, status);
+  matcher->appendTail(entireOutput);
   if (!UASSERT_SUCCESS(status)) {
     // TODO-LDML: could fail here due to bad input (syntax err)
     return 0;
@@ -649,11 +1264,27 @@ transform_entry::apply(const std::u32string &input, std::u32string &output) cons
   return matchLen;
 }
 
-int32_t transform_entry::findIndexFrom(const std::u32string &match) const {
-  return findIndex(match, fMapFromList);
+size_t
+transform_entry::applyLiteral(std::u32string &output) const {
+  assert(fIsLiteral);
+  output = fTo;
+  // same as the regex path, a marker-safe normalize
+  if (!output.empty() && !normalization_disabled && !normalize_nfd_markers(output)) {
+    DebugLog("normalize_nfd_markers(output) failed");
+    return 0; // TODO-LDML: normalization failed.
+  }
+  return fLiteral.length();
 }
 
-int32_t transform_entry::findIndex(const std::u32string &match, const std::deque<std::u32string> list) {
+int32_t transform_entry::findIndexFrom(const icu::UnicodeString &match) const {
+  const auto index = fMapFromIndex.find(match);
+  if (index == fMapFromIndex.end()) {
+    return -1; // not found
+  }
+  return index->second;
+}
+
+int32_t transform_entry::findIndex(const std::u32string &match, const std::deque<std::u32string> &list) {
   int32_t index = 0;
   for(auto e = list.begin(); e < list.end(); e++, index++) {
     if (match == *e) {
@@ -664,9 +1295,19 @@ int32_t transform_entry::findIndex(const std::u32string &match, const std::deque
 }
 
 any_group::any_group(const transform_group &g) : type(any_group_type::transform), transform(g), reorder() {
+  transform.buildIndex();
 }
 
 any_group::any_group(const reorder_group &g) : type(any_group_type::reorder), transform(), reorder(g) {
+  reorder.buildIndex();
+}
+
+int32_t
+any_group::getLookbehind() const {
+  if (type == any_group_type::transform) {
+    return transform.getLookbehind();
+  }
+  return transform_entry::UNBOUNDED;
 }
 
 size_t
@@ -710,12 +1351,9 @@ any_group::apply_transform(std::u32string &input, std::u32string &output, size_t
 
 size_t
 any_group::apply_reorder(std::u32string &input, std::u32string &output, size_t matched) const {
-  std::u32string str2 = input;
-  if (reorder.apply(str2)) {
-    output.resize(0);
-    output.append(str2);
-    input.resize(0);
-    input.append(str2);
+  // reorder.apply() only changes input if it returns true
+  if (reorder.apply(input)) {
+    output.assign(input);
     // Consider the entire string as 'matched'.
     // The calling chain will determine which characters actually changed.
     matched = output.length();
@@ -723,20 +1361,97 @@ any_group::apply_reorder(std::u32string &input, std::u32string &output, size_t m
   return matched;
 }
 
-transforms::transforms(bool norm_disabled) : transform_groups(), normalization_disabled(norm_disabled) {
+transforms::transforms(bool norm_disabled) : transform_groups(), normalization_disabled(norm_disabled), lookbehind(0) {
 }
 
 void
 transforms::addGroup(const transform_group &s) {
   transform_groups.emplace_back(s);
+  lookbehind = add_lookbehind(lookbehind, transform_groups.back().getLookbehind());
 }
 
 void
 transforms::addGroup(const reorder_group &s) {
   transform_groups.emplace_back(s);
+  lookbehind = add_lookbehind(lookbehind, transform_groups.back().getLookbehind());
+}
+
+reverse_trie::reverse_trie() : nodes(1) {
+}
+
+void
+reverse_trie::clear() {
+  nodes.resize(1);
+  nodes[0].children.clear();
+  nodes[0].value = -1;
+}
+
+void
+reverse_trie::add(const std::u32string &str, int32_t value) {
+  size_t n = 0;
+  for (auto ch = str.rbegin(); ch != str.rend(); ch++) {
+    auto child = nodes[n].children.find(*ch);
+    if (child != nodes[n].children.end()) {
+      n = child->second;
+    } else {
+      nodes[n].children.emplace(*ch, nodes.size());
+      n = nodes.size();
+      nodes.emplace_back();
+    }
+  }
+  if (nodes[n].value < 0 || value < nodes[n].value) {
+    nodes[n].value = value;
+  }
+}
+
+int32_t
+reverse_trie::findLowest(const std::u32string &input) const {
+  int32_t lowest = -1;
+  size_t n = 0;
+  for (auto ch = input.rbegin(); ch != input.rend(); ch++) {
+    auto child = nodes[n].children.find(*ch);
+    if (child == nodes[n].children.end()) {
+      break;
+    }
+    n = child->second;
+    if (nodes[n].value >= 0 && (lowest < 0 || nodes[n].value < lowest)) {
+      lowest = nodes[n].value;
+    }
+  }
+  return lowest;
+}
+
+transform_group::transform_group() : fLookbehind(transform_entry::UNBOUNDED) {
+  // until buildIndex() is called, try every entry
+  fFinalChars.add(0, 0x10FFFF);
+}
+
+void
+transform_group::buildIndex() {
+  fFinalChars.clear();
+  fLookbehind = 0;
+  fLiterals.clear();
+  int32_t index = 0;
+  for (auto transform = begin(); transform < end(); transform++, index++) {
+    fFinalChars.addAll(transform->getFinalChars());
+    fLookbehind = std::max(fLookbehind, transform->getLookbehind());
+    if (transform->isLiteral()) {
+      fLiterals.add(transform->getLiteral(), index);
+    }
+  }
+}
+
+/** @returns the number of threads for compile_mode::parallel */
+static unsigned
+compile_threads() {
+  // a few threads are enough to take most of the time off the caller
+  return std::max(1u, std::min(4u, std::thread::hardware_concurrency()));
 }
 
-transform_group::transform_group() {
+/** @returns true for code points before which '$' also matches */
+static bool
+is_line_terminator(char32_t ch) {
+  return (ch >= 0x0A && ch <= 0x0D) || ch == 0x85 || ch == 0x2028 || ch == 0x2029;
 }
 
 /**
@@ -744,15 +1459,42 @@ transform_group::transform_group() {
  */
 size_t
 transform_group::apply(const std::u32string &input, std::u32string &output) const {
-  size_t subMatched = 0;
-  for (auto transform = begin(); (subMatched == 0) && (transform < end()); transform++) {
+  if (empty() || input.empty()) {
+    return 0;
+  }
+  // Skip entries whose matches cannot end with the last character. '$' also
+  // matches before a final line terminator, so then we try everything.
+  const char32_t last = input.back();
+  const bool filter = !is_line_terminator(last);
+  if (filter && !fFinalChars.contains((UChar32)last)) {
+    return 0;
+  }
+  // One walk finds the first literal entry that matches. Only the regex
+  // entries before it can still win. When not filtering, the literal
+  // entries go through the regex too, as '$' could match before the end.
+  const int32_t literal = filter ? fLiterals.findLowest(input) : -1;
+  const auto regexEnd   = literal < 0 ? end() : begin() + literal;
+  // convert once, and share the UTF-16 input between all of the entries
+  icu::UnicodeString inputU16;
+  bool converted = false;
+  for (auto transform = begin(); transform < regexEnd; transform++) {
+    if (filter && (transform->isLiteral() || !transform->canEndWith(last))) {
+      continue;
+    }
+    if (!converted) {
+      inputU16  = to_unicode_string(input);
+      converted = true;
+    }
     // TODO-LDML: non regex implementation
     // is the match area too short?
-    subMatched = transform->apply(input, output);
+    size_t subMatched = transform->apply(inputU16, output);
     if (subMatched != 0) {
       return subMatched; // matched. break out.
     }
   }
+  if (literal >= 0) {
+    return at(literal).applyLiteral(output);
+  }
   return 0; // no match
 }
 
@@ -799,8 +1541,16 @@ transforms::apply(const std::u32string &input, std::u32string &output) {
    */
   size_t matched = 0;
   output.clear();
-  /** modified copy of input, to pass to each next step */
-  std::u32string updatedInput = input;
+  /**
+   * modified copy of input, to pass to each next step. The groups cannot
+   * look further back than our lookbehind, so copy no more than that.
+   */
+  std::u32string updatedInput;
+  if ((size_t)lookbehind >= input.length()) {
+    updatedInput = input;
+  } else {
+    updatedInput.assign(input, input.length() - lookbehind, std::u32string::npos);
+  }
 
   // loop over each group of transforms
   for (auto group = transform_groups.begin(); group < transform_groups.end(); group++) {
@@ -826,6 +1576,47 @@ transforms::apply(const std::u32string &input, std::u32string &output) {
   return matched;
 }
 
+bool
+transforms::compile(unsigned threads) const {
+  std::vector<const transform_entry *> entries;
+  for (const auto &group : transform_groups) {
+    if (group.type == any_group_type::transform) {
+      for (const auto &entry : group.transform) {
+        entries.push_back(&entry);
+      }
+    }
+  }
+
+  // each thread takes the next entry until none are left
+  std::atomic<size_t> next(0);
+  std::atomic<bool> ok(true);
+  auto worker = [&entries, &next, &ok]() {
+    for (size_t i = next++; i < entries.size(); i = next++) {
+      if (!entries[i]->compile()) {
+        ok = false;
+      }
+    }
+  };
+
+  std::vector<std::thread> workers;
+#ifndef __EMSCRIPTEN__
+  threads = (unsigned)std::min<size_t>(threads, entries.size());
+  for (unsigned t = 1; t < threads; t++) {
+    try {
+      workers.emplace_back(worker);
+    } catch (const std::system_error &) {
+      // carry on with the threads we have
+      break;
+    }
+  }
+#endif
+  worker();
+  for (auto &thread : workers) {
+    thread.join();
+  }
+  return ok;
+}
+
 bool
 transforms::apply(std::u32string &str) {
   // simple implementation for tests
@@ -843,7 +1634,8 @@ transforms *
 transforms::load(
     const kmx::kmx_plus &kplus,
     const core::kmx::COMP_KMXPLUS_TRAN *tran,
-    const core::kmx::COMP_KMXPLUS_TRAN_Helper &tranHelper) {
+    const core::kmx::COMP_KMXPLUS_TRAN_Helper &tranHelper,
+    compile_mode mode) {
   bool valid = true;
   if (tran == nullptr) {
     DebugLog("for tran: tran is null");
@@ -934,9 +1726,13 @@ transforms::load(
   assert(valid);
   if (!valid) {
     return nullptr;
-  } else {
-    return transforms.release();
   }
+  // compile now, after the groups have been copied into place
+  if (mode != compile_mode::lazy && !transforms->compile(mode == compile_mode::parallel ? compile_threads() : 1)) {
+    DebugLog("transform patterns failed to compile");
+    return nullptr;
+  }
+  return transforms.release();
 }
 
 }  // namespace ldml
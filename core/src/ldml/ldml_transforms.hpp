@@ -9,14 +9,18 @@
 
 #include "kmx/kmx_plus.h"
 #include "kmx/kmx_xstring.h"
+#include <cstdint>
 #include <deque>
 #include <map>
+#include <mutex>
 #include <string>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 #include "debuglog.h"
 
 #include "core_icu.h"
+#include "unicode/parsepos.h"
 #include "unicode/uniset.h"
 #include "unicode/usetiter.h"
 #include "unicode/regex.h"
@@ -47,8 +51,10 @@ enum any_group_type {
  */
 class element {
 public:
-  /** construct from a SimpleUSet */
+  /** construct from a SimpleUSet, which is copied */
   element(const SimpleUSet &u, KMX_DWORD flags);
+  /** construct from a SimpleUSet shared with other elements */
+  element(std::shared_ptr<const SimpleUSet> u, KMX_DWORD flags);
   /** construct from a single char */
   element(km_core_usv ch, KMX_DWORD flags);
   /** @returns true if a SimpleUSet type */
@@ -65,13 +71,15 @@ public:
   KMX_DWORD get_flags() const;
   /** @returns true if matches this character*/
   bool matches(km_core_usv ch) const;
+  /** add the characters this element matches to a set */
+  void add_to(icu::UnicodeSet &set) const;
   /** debugging: dump this element via DebugLog() */
   void dump() const;
 
 private:
   // TODO-LDML: support multi-char strings? (Not needed currently)
   const km_core_usv chr;
-  const SimpleUSet uset;
+  const std::shared_ptr<const SimpleUSet> uset;
   const KMX_DWORD flags;
 };
 
@@ -85,6 +93,9 @@ typedef std::deque<std::u32string> string_list;
  */
 class transform_entry {
 public:
+  /** a lookbehind with no limit */
+  static const int32_t UNBOUNDED = INT32_MAX;
+
   transform_entry(const transform_entry &other);
   /** simpler constructor for tests */
   transform_entry(
@@ -100,31 +111,158 @@ public:
       bool &valid,
       bool normalization_disabled);
 
+  /**
+   * Compile the regex pattern, unless that has been done already. Entries
+   * compile on first use if this is not called. May be called from any
+   * thread.
+   * @returns false if the pattern does not compile
+   */
+  bool compile() const;
+
   /**
    * If matching, apply the match to the output string
-   * @param input input string to match
+   * @param input input string to match, in UTF-16. Must outlive the call.
    * @param output output string
-   * @returns length of 'input' which was matched
+   * @returns length of 'input' which was matched, in UTF-32 code units
    */
-  size_t apply(const std::u32string &input, std::u32string &output) const;
+  size_t apply(const icu::UnicodeString &input, std::u32string &output) const;
+
+  /**
+   * @returns false if a match of this entry cannot end with ch, in which
+   * case apply() need not be called for input ending in ch
+   */
+  bool canEndWith(char32_t ch) const {
+    return fFinalChars.contains((UChar32)ch);
+  }
+
+  /** @returns the code points that a match can end with */
+  const icu::UnicodeSet &getFinalChars() const {
+    return fFinalChars;
+  }
+
+  /**
+   * @returns true if this entry matches a plain string, and replaces it with
+   * a plain string, so that it can be matched without the regex
+   */
+  bool isLiteral() const {
+    return fIsLiteral;
+  }
+
+  /** @returns the string matched by a literal entry */
+  const std::u32string &getLiteral() const {
+    return fLiteral;
+  }
+
+  /**
+   * @returns how many code points at the end of the input a match can
+   * depend on, or UNBOUNDED
+   */
+  int32_t getLookbehind() const {
+    return fLookbehind;
+  }
+
+  /**
+   * Apply a literal entry, once the input is known to end with its literal
+   * @param output output string
+   * @returns length of the literal
+   */
+  size_t applyLiteral(std::u32string &output) const;
 
 private:
   const std::u32string fFrom;
   const std::u32string fTo;
-  std::unique_ptr<icu::RegexPattern> fFromPattern;
+  /** fTo as UTF-16, ready for appendReplacement() */
+  icu::UnicodeString fToU16;
+  /** the pattern for fFromPattern, normalized and with '$' added */
+  icu::UnicodeString fPatternU16;
+  /** compiled by compile(), under fCompileOnce */
+  mutable std::unique_ptr<icu::RegexPattern> fFromPattern;
+  mutable std::once_flag fCompileOnce;
+  /** code points that a match of fFromPattern can end with */
+  icu::UnicodeSet fFinalChars;
+  /** true if fFromPattern only matches fLiteral, and fTo has no references */
+  bool fIsLiteral;
+  /** see getLookbehind() */
+  int32_t fLookbehind;
+  std::u32string fLiteral;
+
+  /**
+   * Matcher for fFromPattern, reset onto each input instead of being
+   * allocated per call. The keyboard may be shared by states on different
+   * threads, so a caller that cannot take fMatcherLock uses its own matcher.
+   */
+  mutable std::unique_ptr<icu::RegexMatcher> fMatcher;
+  mutable std::mutex fMatcherLock;
 
   const KMX_DWORD fMapFromStrId;
   const KMX_DWORD fMapToStrId;
   std::deque<std::u32string> fMapFromList;
   std::deque<std::u32string> fMapToList;
-  /** Internal function to setup pattern string @returns true on success */
+  /** fMapToList as UTF-16 */
+  std::deque<icu::UnicodeString> fMapToListU16;
+
+  struct unicode_string_hash {
+    size_t operator()(const icu::UnicodeString &str) const { return (size_t)str.hashCode(); }
+  };
+  /** index of each item in fMapFromList (the first, if repeated), keyed in UTF-16 like regex groups */
+  std::unordered_map<icu::UnicodeString, int32_t, unicode_string_hash> fMapFromIndex;
+  /** Internal function to setup pattern string, without compiling it @returns true on success */
   bool init();
   bool normalization_disabled;
   /** @returns the index of the item in the fMapFromList list, or -1 */
-  int32_t findIndexFrom(const std::u32string &match) const;
+  int32_t findIndexFrom(const icu::UnicodeString &match) const;
 public:
   /** @returns the index of the item in the list, or -1 */
-  static int32_t findIndex(const std::u32string &match, const std::deque<std::u32string> list);
+  static int32_t findIndex(const std::u32string &match, const std::deque<std::u32string> &list);
+  /**
+   * Find the code points that a match of a transform pattern, before the
+   * trailing '$' is added, can end with. Where the pattern uses syntax that
+   * is not understood, this is every code point.
+   * @param pattern the pattern, as passed to the regex compiler
+   * @param chars on return, the set of final code points
+   */
+  static void findFinalChars(const icu::UnicodeString &pattern, icu::UnicodeSet &chars);
+  /**
+   * Find how far back from its end a match of a transform pattern, before
+   * the trailing '$' is added, can look, counting any lookbehind. Where the
+   * pattern uses syntax that is not understood, or has unlimited repeats,
+   * this is UNBOUNDED.
+   * @param pattern the pattern, as passed to the regex compiler
+   * @returns the number of code points, or UNBOUNDED
+   */
+  static int32_t findLookbehind(const icu::UnicodeString &pattern);
+  /**
+   * @param pattern the pattern, as passed to the regex compiler
+   * @param literal on return, the string matched, if the result is true
+   * @returns true if the pattern matches only a single plain string
+   */
+  static bool parseLiteral(const icu::UnicodeString &pattern, std::u32string &literal);
+};
+
+/**
+ * Strings stored back to front, so that one walk back from the end of an
+ * input finds all of the strings that the input ends with.
+ */
+class reverse_trie {
+public:
+  reverse_trie();
+
+  /** add a string; where it is already present, the lower value is kept */
+  void add(const std::u32string &str, int32_t value);
+
+  /** @returns the lowest value of all of the strings that input ends with, or -1 */
+  int32_t findLowest(const std::u32string &input) const;
+
+  void clear();
+
+private:
+  struct node {
+    std::map<char32_t, size_t> children;
+    /** value of the string ending here, or -1 */
+    int32_t value = -1;
+  };
+  /** nodes[0] is the root */
+  std::vector<node> nodes;
 };
 
 /**
@@ -141,6 +279,21 @@ public:
    * @returns length of 'input' which was matched
    */
   size_t apply(const std::u32string &input, std::u32string &output) const;
+
+  /** rebuild the final code points and the literal trie, after adding entries */
+  void buildIndex();
+
+  /** @returns the longest lookbehind of the entries, see transform_entry::getLookbehind() */
+  int32_t getLookbehind() const {
+    return fLookbehind;
+  }
+
+private:
+  /** union of the final code points of the entries */
+  icu::UnicodeSet fFinalChars;
+  int32_t fLookbehind;
+  /** literal entries, by their index in the group */
+  reverse_trie fLiterals;
 };
 
 /** a single char, categorized according to reorder rules*/
@@ -158,7 +311,7 @@ struct reorder_sort_key {
   bool operator>(const reorder_sort_key &other) const;
 
   /** create a 'baseline' sort key, with each character having primary weight 0 */
-  static std::deque<reorder_sort_key> from(const std::u32string &str);
+  static std::vector<reorder_sort_key> from(const std::u32string &str);
 
   /** TODO-LDML: for debugging. */
   void dump() const;
@@ -173,13 +326,19 @@ public:
   size_t match_end(const std::u32string &str) const;
 
   /**
-   * Update the deque (see reorder_sort_key::from()) with the weights from this element list
+   * Match against the chars of str in [begin, end), without copying them
+   * @returns 0 if no match, or number of chars before end matched
+   */
+  size_t match_end(const std::u32string &str, size_t begin, size_t end) const;
+
+  /**
+   * Update the sort key (see reorder_sort_key::from()) with the weights from this element list
    * starting at the beginning of this element list
-   * @param offset start at this offset in the deque. Still starts at the first element
-   * @param key key deque to update
+   * @param offset start at this offset in the key. Still starts at the first element
+   * @param key key to update
    * @returns the key parameter
   */
-  std::deque<reorder_sort_key> &update_sort_key(size_t offset, std::deque<reorder_sort_key> &key) const;
+  std::vector<reorder_sort_key> &update_sort_key(size_t offset, std::vector<reorder_sort_key> &key) const;
 
   /** construct from KMX+ elem id*/
   bool
@@ -201,7 +360,7 @@ public:
    * @param offset start matching at this offset
    * @return 0 if no match otherwise length matched
    */
-  size_t match_end(std::u32string &str, size_t offset, size_t len) const;
+  size_t match_end(const std::u32string &str, size_t offset, size_t len) const;
 
   /** @returns -1, 0, 1 depending on ordering */
   int compare(const reorder_entry &other) const;
@@ -219,9 +378,30 @@ typedef std::deque<reorder_entry> reorder_list;
 /** subtype that's a list of reorders */
 struct reorder_group {
 public:
+  reorder_group();
   reorder_list list;
   /** apply this reordering. Return true if changed. */
   bool apply(std::u32string &str) const;
+
+  /** rebuild the start characters and the entry index, after adding entries */
+  void buildIndex();
+
+private:
+  /** a range of chars, and the entries whose last element matches all of them */
+  struct end_range {
+    km_core_usv start;
+    km_core_usv end;
+    std::vector<size_t> entries;
+  };
+
+  /** @returns the entries that can match ending with ch, or nullptr if none */
+  const std::vector<size_t> *entriesEndingWith(km_core_usv ch) const;
+
+  /** chars that the first element of some entry matches */
+  icu::UnicodeSet fStartChars;
+  /** disjoint ranges sorted by start; empty until buildIndex() is called */
+  std::vector<end_range> fEndIndex;
+  bool fIndexed;
 };
 
 /** container for either a transform or a reorder group */
@@ -233,12 +413,33 @@ public:
   transform_group transform;
   reorder_group reorder;
   size_t apply(std::u32string &input, std::u32string &output, size_t matched) const;
+  /**
+   * @returns how many code points at the end of the input this group can
+   * depend on, or transform_entry::UNBOUNDED. Reorders sort whole runs of
+   * text, so they are unbounded.
+   */
+  int32_t getLookbehind() const;
 
 private:
   size_t apply_transform(std::u32string &input, std::u32string &output, size_t matched) const;
   size_t apply_reorder(std::u32string &input, std::u32string &output, size_t matched) const;
 };
 
+/**
+ * How transforms::load() compiles the regex patterns of transform entries
+ */
+enum class compile_mode {
+  /** compile every pattern while loading, on the calling thread */
+  serial,
+  /** compile every pattern while loading, spread over a few threads */
+  parallel,
+  /**
+   * compile each pattern when it is first needed. A pattern that fails to
+   * compile then never matches, rather than failing the load.
+   */
+  lazy,
+};
+
 /**
  * A list of any_groups
  */
@@ -251,6 +452,8 @@ class transforms {
 private:
   group_list transform_groups;
   bool normalization_disabled;
+  /** the total of the group lookbehinds, see getLookbehind() */
+  int32_t lookbehind;
 public:
   transforms(bool normalization_disabled);
 
@@ -278,12 +481,30 @@ public:
    */
   bool apply(std::u32string &str);
 
+  /**
+   * @returns how many code points at the end of the input apply() looks at,
+   * or transform_entry::UNBOUNDED. Each group matches at most once, so this
+   * is the sum over the groups, which covers groups that see the output of
+   * earlier ones.
+   */
+  int32_t getLookbehind() const {
+    return lookbehind;
+  }
+
+  /**
+   * Compile the patterns of all transform entries now
+   * @param threads the number of threads to compile on, including the caller
+   * @returns false if any pattern does not compile
+   */
+  bool compile(unsigned threads) const;
+
 public:
   /** load from a kmx_plus data section, either tran or bksp */
   static transforms *
   load(const kmx::kmx_plus &kplus,
        const core::kmx::COMP_KMXPLUS_TRAN *tran,
-       const core::kmx::COMP_KMXPLUS_TRAN_Helper &tranHelper);
+       const core::kmx::COMP_KMXPLUS_TRAN_Helper &tranHelper,
+       compile_mode mode = compile_mode::serial);
 };
 
 
@@ -6,14 +6,16 @@
 */
 
 #include "ldml_vkeys.hpp"
+#include "ldml_markers.hpp"
 #include "kmx_file.h"
+#include "kmx/kmx_xstring.h"
 #include <ldml/keyman_core_ldml.h>
 
 namespace km {
 namespace core {
 namespace ldml {
 
-vkeys::vkeys() : vkey_to_string() {
+vkeys::vkeys() : vkey_to_index(), strings(), outputs(), flat(false), vk_row(), table() {
 }
 
 void
@@ -21,19 +23,114 @@ vkeys::add(km_core_virtual_key vk, uint16_t modifier_state, std::u16string outpu
   // construct key
   const vkey_id id(vk, modifier_state);
   // assign the string
-  vkey_to_string[id] = output;
+  const auto key = vkey_to_index.find(id);
+  if (key != vkey_to_index.end()) {
+    strings[key->second] = output;
+  } else {
+    vkey_to_index[id] = (int32_t)strings.size();
+    strings.emplace_back(output);
+  }
+  // any table is now stale
+  flat = false;
 }
 
 static const uint16_t BOTH_ALT  = LALTFLAG  | RALTFLAG;
 static const uint16_t BOTH_CTRL = LCTRLFLAG | RCTRLFLAG;
 
+/** the modifiers that LDML keys may have, and so the columns of the table */
+static const uint16_t TABLE_MODS =
+    BOTH_CTRL | BOTH_ALT | K_SHIFTFLAG | K_CTRLFLAG | K_ALTFLAG | CAPITALFLAG;
+/** columns per row: one per combination of TABLE_MODS, then one for other modifiers */
+static const size_t TABLE_OTHER   = 0x100;
+static const size_t TABLE_COLUMNS = TABLE_OTHER + 1;
+
+/** @return the column for a modifier state with no modifiers outside TABLE_MODS */
+static inline size_t
+table_column(uint16_t modifier_state) {
+  return (modifier_state & 0x7F) | ((modifier_state & CAPITALFLAG) >> 1);
+}
+
+void
+vkeys::build(bool normalize) {
+  outputs.clear();
+  outputs.reserve(strings.size());
+  for (const auto &str : strings) {
+    outputs.emplace_back(kmx::u16string_to_u32string(str));
+    if (normalize) {
+      (void)normalize_nfd_markers(outputs.back());
+    }
+  }
+
+  // assign a row to each vkey, with row 0 for vkeys without outputs
+  flat = true;
+  vk_row.clear();
+  uint16_t rows = 1;
+  for (const auto &key : vkey_to_index) {
+    const km_core_virtual_key vk = key.first.first;
+    if ((key.first.second & ~TABLE_MODS) || rows == UINT16_MAX) {
+      // not representable in the table, find() will resolve each lookup
+      flat = false;
+      break;
+    }
+    if (vk >= vk_row.size()) {
+      vk_row.resize(vk + 1, 0);
+    }
+    if (vk_row[vk] == 0) {
+      vk_row[vk] = rows++;
+    }
+  }
+
+  if (!flat) {
+    vk_row.clear();
+    table.clear();
+    return;
+  }
+
+  table.assign(rows * TABLE_COLUMNS, -1);
+  for (size_t i = 0; i < vk_row.size(); i++) {
+    if (vk_row[i] == 0) {
+      continue;
+    }
+    const km_core_virtual_key vk = (km_core_virtual_key)i;
+    int32_t *row = &table[vk_row[vk] * TABLE_COLUMNS];
+    for (uint16_t mods = 0; mods <= TABLE_MODS; mods++) {
+      if (!(mods & ~TABLE_MODS)) {
+        row[table_column(mods)] = resolve(vk, mods);
+      }
+    }
+    // no key has any other modifier, so with one only the "other" layer can match
+    row[TABLE_OTHER] = lookup(vkey_id(vk, LDML_KEYS_MOD_OTHER));
+  }
+}
+
 std::u16string
 vkeys::lookup(km_core_virtual_key vk, uint16_t modifier_state, bool &found) const {
+  const int32_t index = resolve(vk, modifier_state);
+  found = (index >= 0);
+  return found ? strings[index] : std::u16string();
+}
+
+const std::u32string *
+vkeys::find(km_core_virtual_key vk, uint16_t modifier_state) const {
+  int32_t index;
+  if (!flat) {
+    index = resolve(vk, modifier_state);
+  } else if (vk >= vk_row.size()) {
+    return nullptr;
+  } else {
+    const size_t column = (modifier_state & ~TABLE_MODS) ? TABLE_OTHER : table_column(modifier_state);
+    index = table[vk_row[vk] * TABLE_COLUMNS + column];
+  }
+  return (index < 0 || (size_t)index >= outputs.size()) ? nullptr : &outputs[index];
+}
+
+int32_t
+vkeys::resolve(km_core_virtual_key vk, uint16_t modifier_state) const {
   const vkey_id id(vk, modifier_state);
 
   // try exact match first
-  std::u16string ret = lookup(id, found);
-  if (found) {
+  int32_t ret = lookup(id);
+  if (ret >= 0) {
     return ret;
   }
 
@@ -43,8 +140,8 @@ vkeys::lookup(km_core_virtual_key vk, uint16_t modifier_state, bool &found) cons
   // look for a layer with "alt" (either)
   if (have_alt) {
     const vkey_id id_alt(vk, (modifier_state & ~(BOTH_ALT)) | K_ALTFLAG);
-    ret = lookup(id_alt, found);
-    if (found) {
+    ret = lookup(id_alt);
+    if (ret >= 0) {
       return ret;
     }
   }
@@ -52,8 +149,8 @@ vkeys::lookup(km_core_virtual_key vk, uint16_t modifier_state, bool &found) cons
   // look for a layer with "ctrl" (either)
   if (have_ctrl) {
     const vkey_id id_ctrl(vk, (modifier_state & ~(BOTH_CTRL)) | K_CTRLFLAG);
-    ret = lookup(id_ctrl, found);
-    if (found) {
+    ret = lookup(id_ctrl);
+    if (ret >= 0) {
       return ret;
     }
   }
@@ -61,8 +158,8 @@ vkeys::lookup(km_core_virtual_key vk, uint16_t modifier_state, bool &found) cons
   // look for a layer with "alt ctrl" (either)
   if (have_ctrl && have_alt) {
     const vkey_id id_ctrl_alt(vk, (modifier_state & ~(BOTH_ALT | BOTH_CTRL)) | K_CTRLFLAG | K_ALTFLAG);
-    ret = lookup(id_ctrl_alt, found);
-    if (found) {
+    ret = lookup(id_ctrl_alt);
+    if (ret >= 0) {
       return ret;
     }
   }
@@ -70,24 +167,22 @@ vkeys::lookup(km_core_virtual_key vk, uint16_t modifier_state, bool &found) cons
   // look for a layer with "other"
   {
     const vkey_id id_default(vk, (LDML_KEYS_MOD_OTHER));
-    ret = lookup(id_default, found);
-    if (found) {
+    ret = lookup(id_default);
+    if (ret >= 0) {
       return ret;
     }
   }
 
-  // default: return failure. found=false.
-  return ret;
+  // default: return failure.
+  return -1;
 }
 
-std::u16string
-vkeys::lookup(const vkey_id& id, bool &found) const {
-  const auto key = vkey_to_string.find(id);
-  if (key == vkey_to_string.end()) {
-    found = false;
-    return std::u16string();  // TODO-LDML: optimize object construction?
+int32_t
+vkeys::lookup(const vkey_id& id) const {
+  const auto key = vkey_to_index.find(id);
+  if (key == vkey_to_index.end()) {
+    return -1;
   }
-  found = true;
   return key->second;
 }
 
@@ -29,7 +29,19 @@ typedef std::pair<km_core_virtual_key, uint16_t> vkey_id;
  */
 class vkeys {
 private:
-  std::map<vkey_id, std::u16string> vkey_to_string;
+  /** index of each key's output in `strings` and `outputs` */
+  std::map<vkey_id, int32_t> vkey_to_index;
+  /** key outputs, as loaded */
+  std::vector<std::u16string> strings;
+  /** key outputs in UTF-32 (and NFD if requested), filled in by `build()` */
+  std::vector<std::u32string> outputs;
+
+  /** true if `table` resolves every lookup */
+  bool flat;
+  /** row of each vkey in `table`, or 0 (all not found) for vkeys without outputs */
+  std::vector<uint16_t> vk_row;
+  /** output index for each row and modifier index, or -1 if not found */
+  std::vector<int32_t> table;
 
 public:
   vkeys();
@@ -39,6 +51,13 @@ public:
    */
   void add(km_core_virtual_key vk, uint16_t modifier_state, std::u16string output);
 
+  /**
+   * Resolve the modifier fallbacks of all keys once, into a table used by
+   * `find()`. Call after the last `add()`.
+   * @param normalize if true, outputs are normalized to NFD
+   */
+  void build(bool normalize);
+
   /**
    * Lookup a vkey, returns an empty string if not found
    * @param found on exit: true if found
@@ -46,13 +65,28 @@ public:
   std::u16string
   lookup(km_core_virtual_key vk, uint16_t modifier_state, bool &found) const;
 
+  /**
+   * Lookup a vkey without allocating. Requires `build()`.
+   * @return the UTF-32 output, or nullptr if not found
+   */
+  const std::u32string *
+  find(km_core_virtual_key vk, uint16_t modifier_state) const;
+
 private:
+  /**
+   * Resolve a lookup, with the fallbacks for either-side alt and ctrl and
+   * for "other" modifiers
+   * @return the output index, or -1 if not found
+   */
+  int32_t
+  resolve(km_core_virtual_key vk, uint16_t modifier_state) const;
+
   /**
    * Non-recursive internal lookup of a specific ID
-   * @param found on exit: true if found
+   * @return the output index, or -1 if not found
    */
-  std::u16string
-  lookup(const vkey_id &id, bool &found) const;
+  int32_t
+  lookup(const vkey_id &id) const;
 };
 
 }  // namespace ldml
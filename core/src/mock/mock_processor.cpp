@@ -84,14 +84,16 @@ namespace km {
     {
     }
 
-    char16_t const * mock_processor::lookup_option(km_core_option_scope scope,
+    char16_t const * mock_processor::lookup_option(state const &,
+                                    km_core_option_scope scope,
                                     std::u16string const & key) const
     {
       auto i = _options.find(char16_t(scope) + key);
       return i != _options.end() ? i->second.c_str() : nullptr;
     }
 
-    option mock_processor::update_option(km_core_option_scope scope,
+    option mock_processor::update_option(state &,
+                       km_core_option_scope scope,
                        std::u16string const & key,
                        std::u16string const & value)
     {
@@ -161,7 +163,8 @@ namespace km {
         case KM_CORE_VKEY_F2:
         {
           state->actions().push_persist(
-            update_option(KM_CORE_OPT_KEYBOARD,
+            update_option(*state,
+                        KM_CORE_OPT_KEYBOARD,
                         u"__test_point",
                         u"F2 pressed test save."));
           break;
@@ -220,7 +223,7 @@ namespace km {
       return imx_list;
     }
 
-    km_core_context_item * mock_processor::get_intermediate_context() {
+    km_core_context_item * mock_processor::get_intermediate_context(km_core_state * _kmn_unused(state)) {
       km_core_context_item *citems = new km_core_context_item(KM_CORE_CONTEXT_ITEM_END);
       return citems;
     }
@@ -41,12 +41,14 @@ namespace core
 
     char16_t const *
     lookup_option(
+      state const &,
       km_core_option_scope,
       std::u16string const & key
     ) const override;
 
     option
     update_option(
+      state &,
       km_core_option_scope,
       std::u16string const & key,
       std::u16string const & value
@@ -59,7 +61,7 @@ namespace core
       km_core_action_item const* action_item
     ) override;
 
-    km_core_context_item * get_intermediate_context() override;
+    km_core_context_item * get_intermediate_context(km_core_state *state) override;
 
     km_core_keyboard_key  * get_key_list() const override;
 
@@ -8,6 +8,7 @@
 
 #pragma once
 
+#include <memory>
 #include <string>
 #include <unordered_map>
 
@@ -18,6 +19,25 @@
 namespace km {
 namespace core
 {
+  class state;
+
+  /**
+   * Data that a keyboard processor keeps for each state, such as the working
+   * buffers and option values of its engine. A processor that keeps its
+   * per-state data here, and does not modify itself while processing events,
+   * can process events for different states on different threads.
+   */
+  class processor_state
+  {
+  public:
+    virtual ~processor_state() { };
+
+    /**
+     * Makes a copy of this data for a cloned state.
+     */
+    virtual processor_state * clone() const = 0;
+  };
+
   class abstract_processor
   {
     std::unordered_map<std::u16string, std::u16string>  _persisted;
@@ -45,6 +65,27 @@ namespace core
       uint16_t event_flags
     ) = 0;
 
+    /**
+     * Handles an event that the keyboard cannot act on, such as a key-up or a
+     * bare modifier key, without running the keyboard, if this processor can
+     * tell from the event alone that it is such an event. The event must
+     * leave the contexts and options as they are, and the state's actions
+     * are set with state::set_no_op_actions.
+     *
+     * @return  true if the event was handled, false if it needs to be
+     *          processed by process_event
+     */
+    virtual bool
+    process_no_op_event(
+      km_core_state* _kmn_unused(state),
+      km_core_virtual_key _kmn_unused(vk),
+      uint16_t _kmn_unused(modifier_state),
+      uint8_t _kmn_unused(is_key_down),
+      uint16_t _kmn_unused(event_flags)
+    ) {
+      return false;
+    }
+
     virtual km_core_status
     external_event(
       km_core_state* _kmn_unused(state),
@@ -57,14 +98,27 @@ namespace core
     virtual km_core_attr const & attributes() const = 0;
     virtual km_core_status       validate() const = 0;
 
+    /**
+     * Creates the per-state data for a new state on this keyboard.
+     *
+     * @return  the data, owned by the state, or nullptr if this processor
+     *          keeps no per-state data
+     */
+    virtual std::unique_ptr<processor_state>
+    create_state() const {
+      return nullptr;
+    }
+
     virtual char16_t const *
     lookup_option(
+      state const &,
       km_core_option_scope,
       std::u16string const & key
     ) const = 0;
 
     virtual option
     update_option(
+      state &,
       km_core_option_scope,
       std::u16string const & key,
       std::u16string const & value
@@ -99,10 +153,13 @@ namespace core
    * Returns the core context as an array of
    * km_core_context_items. Caller is responsible for freeing
    * the memory
+   * @param  state  An opaque pointer to a state object
    * @return km_core_context_item*
    */
     virtual km_core_context_item *
-    get_intermediate_context() = 0;
+    get_intermediate_context(
+      km_core_state * state
+    ) = 0;
 
    /**
     * Returns the list of keys that belong to the keyboard rules. The matching dispose
@@ -8,11 +8,19 @@
 #include "state.hpp"
 #include "action.hpp"
 #include "processor.hpp"
+#include "kmx/kmx_xstring.h"
 #include <keyman/keyman_core_api_consts.h>
+#include <algorithm>
 #include <cstring>
 
 using namespace km::core;
 
+namespace {
+  // The arrays of the actions struct for an event that changes nothing
+  km_core_usv const no_output[] = {0};
+  km_core_option_item no_persist_options[] = {KM_CORE_OPTIONS_END};
+}
+
 void actions::push_persist(option const &opt) {
   assert(empty() || back().type != KM_CORE_IT_END);
   _option_items_stack.emplace_back(opt);
@@ -38,7 +46,7 @@ void actions::push_capslock(bool turnOn) {
 
 
 state::state(km::core::abstract_processor & ap, km_core_option_item const *env)
-  : _processor(ap)
+  : _processor(ap), _processor_state(ap.create_state())
 {
   // The app context will never have markers, because it is an exact
   // copy of the context passed in from the application, in whatever
@@ -46,7 +54,8 @@ state::state(km::core::abstract_processor & ap, km_core_option_item const *env)
   _app_ctxt.has_markers = false;
   for (; env && env->key != nullptr; env++) {
     //assert(env->scope == KM_CORE_OPT_ENVIRONMENT); // todo do we need scope? or can we find a way to eliminate it?
-    ap.update_option(env->scope
+    ap.update_option(*this,
+                     env->scope
                         ? km_core_option_scope(env->scope)
                         : KM_CORE_OPT_ENVIRONMENT,
                      env->key,
@@ -57,6 +66,24 @@ state::state(km::core::abstract_processor & ap, km_core_option_item const *env)
   memset(const_cast<km_core_actions*>(&_action_struct), 0, sizeof(km_core_actions));
 }
 
+state::state(state const & other)
+  : _ctxt(other._ctxt),
+    _app_ctxt(other._app_ctxt),
+    _app_ctxt_synced(other._app_ctxt_synced),
+    _app_ctxt_synced_revision(other._app_ctxt_synced_revision),
+    _ctxt_synced_revision(other._ctxt_synced_revision),
+    _processor(other._processor),
+    _processor_state(other._processor_state ? other._processor_state->clone() : nullptr),
+    _actions(other._actions),
+    _debug_items(other._debug_items),
+    _imx_callback(other._imx_callback),
+    _imx_object(other._imx_object)
+{
+  // The action struct points to the results of the last event on the other
+  // state, so it is not shared
+  memset(const_cast<km_core_actions*>(&_action_struct), 0, sizeof(km_core_actions));
+}
+
 void state::imx_register_callback(
   km_core_keyboard_imx_platform imx_callback_fp,
   void *callback_object
@@ -81,40 +108,164 @@ void state::imx_callback(uint32_t imx_id) {
   _imx_callback(static_cast<km_core_state *>(this), imx_id, _imx_object);
 }
 
+bool state::app_context_mirror_valid() const noexcept {
+  return _app_ctxt_mirror.valid &&
+    _app_ctxt_mirror.app_revision == _app_ctxt.revision &&
+    _app_ctxt_mirror.cached_revision == _ctxt.revision;
+}
+
+void state::sync_app_context_mirror() noexcept {
+  _app_ctxt_mirror.valid = true;
+  _app_ctxt_mirror.app_revision = _app_ctxt.revision;
+  _app_ctxt_mirror.cached_revision = _ctxt.revision;
+}
+
+bool state::app_context_synced() const noexcept {
+  return _app_ctxt_synced &&
+    _app_ctxt_synced_revision == _app_ctxt.revision &&
+    _ctxt_synced_revision == _ctxt.revision;
+}
+
+void state::sync_app_context() noexcept {
+  _app_ctxt_synced = true;
+  _app_ctxt_synced_revision = _app_ctxt.revision;
+  _ctxt_synced_revision = _ctxt.revision;
+}
+
+/**
+ * Applies the output of the last event to the mirror, as it has been applied
+ * to the app context: the last code_points_to_delete code points are removed
+ * and then the output is appended.
+ */
+void state::update_app_context_mirror() {
+  auto &mirror = _app_ctxt_mirror;
+  auto &text = mirror.text;
+
+  for (auto n = _action_struct.code_points_to_delete; n > 0; n--) {
+    if (text.empty()) {
+      // The app context holds more than the mirror, so the two have diverged
+      invalidate_app_context_mirror();
+      return;
+    }
+    auto len = text.length() - 1;
+    if (len > 0 && Uni_IsSurrogate2(text[len]) && Uni_IsSurrogate1(text[len - 1])) {
+      len--;
+    }
+    text.resize(len);
+    mirror.code_points--;
+  }
+
+  for (auto p = _action_struct.output; p && *p; p++) {
+    if (Uni_IsBMP(*p)) {
+      text.push_back(static_cast<char16_t>(*p));
+    } else {
+      text.push_back(Uni_UTF32ToSurrogate1(*p));
+      text.push_back(Uni_UTF32ToSurrogate2(*p));
+    }
+    mirror.code_points++;
+  }
+
+  sync_app_context_mirror();
+}
+
 state::~state() {
-  km::core::actions_dispose(this->_action_struct);
+}
+
+void state::set_no_op_actions(bool emit_keystroke) {
+  _actions.clear();
+  if (emit_keystroke) {
+    _actions.push_emit_keystroke();
+  }
+  _actions.commit();
+
+  // As the contexts are not changed, the app context and its mirror remain
+  // in step with the cached context
+  _action_struct.code_points_to_delete = 0;
+  _action_struct.output = no_output;
+  _action_struct.persist_options = no_persist_options;
+  _action_struct.do_alert = KM_CORE_FALSE;
+  _action_struct.emit_keystroke = emit_keystroke ? KM_CORE_TRUE : KM_CORE_FALSE;
+  _action_struct.new_caps_lock_state = KM_CORE_CAPS_UNCHANGED;
+  _action_struct.deleted_context = no_output;
+}
+
+void state::snapshot(state_snapshot & snapshot) const {
+  snapshot._processor = &_processor;
+  snapshot._ctxt = _ctxt;
+  snapshot._app_ctxt = _app_ctxt;
+  snapshot._app_ctxt_mirror = _app_ctxt_mirror;
+  snapshot._app_ctxt_synced = _app_ctxt_synced;
+  snapshot._app_ctxt_synced_revision = _app_ctxt_synced_revision;
+  snapshot._ctxt_synced_revision = _ctxt_synced_revision;
+  snapshot._processor_state.reset(_processor_state ? _processor_state->clone() : nullptr);
+}
+
+bool state::restore(state_snapshot const & snapshot) {
+  if (snapshot._processor != &_processor) {
+    return false;
+  }
+
+  // The contexts are copied into the storage they already have. The
+  // revisions are restored along with the contexts, so the app context mirror
+  // and the processor's data remain valid for them.
+  _ctxt = snapshot._ctxt;
+  _app_ctxt = snapshot._app_ctxt;
+  _app_ctxt_mirror = snapshot._app_ctxt_mirror;
+  _app_ctxt_synced = snapshot._app_ctxt_synced;
+  _app_ctxt_synced_revision = snapshot._app_ctxt_synced_revision;
+  _ctxt_synced_revision = snapshot._ctxt_synced_revision;
+
+  // The processor's data is cloned again, so that the snapshot can be
+  // restored any number of times. Rules can change KMX option stores, so
+  // there is no cheaper way to tell whether it has changed.
+  _processor_state.reset(snapshot._processor_state ? snapshot._processor_state->clone() : nullptr);
+  return true;
 }
 
 void state::apply_actions_and_merge_app_context() {
   auto action_items = this->_actions.data();
 
-  km::core::actions_dispose(this->_action_struct);
+  // The app context and its mirror can follow the event only if they matched
+  // the cached context before the event. Keyboard processors change the
+  // cached context without bumping its revision, so this can still be checked
+  // here.
+  bool const context_invalidated =
+    std::any_of(_actions.begin(), _actions.end(), [](action const &a) {
+      return a.type == KM_CORE_IT_INVALIDATE_CONTEXT;
+    });
+  bool const mirror_valid = app_context_mirror_valid() && !context_invalidated;
+  bool const app_context_synced = this->app_context_synced() && !context_invalidated;
+  invalidate_app_context_mirror();
 
-  action_item_list_to_actions_object(action_items, &this->_action_struct);
+  if(!action_item_list_to_actions_object(action_items, &this->_action_struct, this->_action_buffers)) {
+    memset(&this->_action_struct, 0, sizeof(km_core_actions));
+    return;
+  }
 
-  // We keep a copy of the app context before normalization, as the
-  // code_points_to_delete value can be updated by normalization, but by the
-  // time we get it back from actions_normalize or
-  // actions_update_app_context_nfu,  app_context has already been updated to
-  // remove the necessary codepoints
+  // actions_normalize and actions_update_app_context_nfu update the
+  // app_context, and set the deleted_context from the code points they remove
+  // from it, as the code_points_to_delete value can be updated by
+  // normalization
   km::core::context& app_context = this->app_context();
   km::core::context const& cached_context = this->context();
-  km::core::context app_context_for_deletion;
-  std::copy(app_context.begin(), app_context.end(), std::back_inserter(app_context_for_deletion));
 
   if(this->processor().supports_normalization()) {
     // Normalize to NFC for those keyboard processors that support it
-    if(!km::core::actions_normalize(&cached_context, &app_context, this->_action_struct)) {
-      km::core::actions_dispose(this->_action_struct);
+    if(!km::core::actions_normalize(&cached_context, &app_context, this->_action_struct, &this->_action_buffers)) {
+      memset(&this->_action_struct, 0, sizeof(km_core_actions));
       return;
     }
   } else {
-    // For all other keyboard processors, we just copy the cached_context to the app_context
-    if(!km::core::actions_update_app_context_nfu(&cached_context, &app_context)) {
-      km::core::actions_dispose(this->_action_struct);
+    // For all other keyboard processors, we just apply the same changes to
+    // the app_context as were applied to the cached_context
+    if(!km::core::actions_update_app_context_nfu(&cached_context, &app_context, this->_action_struct, app_context_synced, &this->_action_buffers)) {
+      memset(&this->_action_struct, 0, sizeof(km_core_actions));
       return;
     }
+    sync_app_context();
   }
 
-  this->_action_struct.deleted_context = km::core::get_deleted_context(app_context_for_deletion, this->_action_struct.code_points_to_delete);
-}
\ No newline at end of file
+  if (mirror_valid) {
+    update_app_context_mirror();
+  }
+}
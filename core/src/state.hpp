@@ -9,6 +9,8 @@
 #pragma once
 
 #include <cassert>
+#include <memory>
+#include <string>
 #include <vector>
 
 #include "keyman_core.h"
@@ -22,6 +24,7 @@ namespace core
 {
 //Forward declarations
 class abstract_processor;
+class processor_state;
 
 using action = km_core_action_item;
 
@@ -119,14 +122,75 @@ void actions::clear() {
 
 
 
+/**
+ * Storage for the arrays of a km_core_actions struct. A state keeps one and
+ * reuses it for each event, so that once the vectors have grown to fit,
+ * building the actions struct does not allocate.
+ */
+struct actions_buffers {
+  std::vector<km_core_context_item> items;
+  std::vector<km_core_usv>          output;
+  std::vector<km_core_usv>          deleted_context;
+  std::vector<km_core_option_item>  persist_options;
+  // Owns the keys and values pointed to by persist_options
+  std::vector<option>               options;
+};
+
+/**
+ * The text last passed to km_core_state_context_set_if_needed, kept up to date
+ * with the output of each event. While the mirror is valid, the app context
+ * holds this text, and the cached context holds the same text in the form the
+ * keyboard processor wants, so that being passed the same text again can be
+ * recognised by comparing strings, without rebuilding or normalizing either
+ * context.
+ */
+struct context_mirror {
+  std::u16string text;
+  size_t   code_points = 0;
+  bool     valid = false;
+  // The revisions of the contexts when the mirror was last brought up to date
+  uint32_t app_revision = 0,
+           cached_revision = 0;
+};
+
+/**
+ * The parts of a state that processing an event can change, other than the
+ * actions and debug items describing the event. Saved by state::snapshot so
+ * that events can be processed speculatively, and their effects discarded
+ * with state::restore.
+ */
+class state_snapshot
+{
+  friend class state;
+
+  core::abstract_processor const *       _processor = nullptr;
+  core::context                          _ctxt;
+  core::context                          _app_ctxt;
+  core::context_mirror                   _app_ctxt_mirror;
+  bool                                   _app_ctxt_synced = false;
+  uint32_t                               _app_ctxt_synced_revision = 0,
+                                         _ctxt_synced_revision = 0;
+  std::unique_ptr<core::processor_state> _processor_state;
+};
+
 class state
 {
 protected:
     core::context              _ctxt;
     core::context              _app_ctxt;
+    core::context_mirror       _app_ctxt_mirror;
+    // The revisions of both contexts when the app context last held the same
+    // text as the end of the cached context, or vice versa
+    bool                       _app_ctxt_synced = true;
+    uint32_t                   _app_ctxt_synced_revision = 0,
+                               _ctxt_synced_revision = 0;
     core::abstract_processor & _processor;
+    std::unique_ptr<core::processor_state> _processor_state;
     core::actions              _actions;
     km_core_actions            _action_struct;
+    // The arrays of _action_struct point into these, which are reused for
+    // each event
+    core::actions_buffers      _action_buffers;
     core::debug_items          _debug_items;
     km_core_keyboard_imx_platform _imx_callback;
     void *_imx_object;
@@ -134,7 +198,7 @@ protected:
 public:
     state(core::abstract_processor & kb, km_core_option_item const *env);
 
-    state(state const &) = default;
+    state(state const &);
     state(state const &&) = delete;
 
     ~state();
@@ -145,9 +209,29 @@ public:
     core::context       &  app_context() noexcept            { return _app_ctxt; }
     core::context const &  app_context() const noexcept      { return _app_ctxt; }
 
+    core::context_mirror       & app_context_mirror() noexcept       { return _app_ctxt_mirror; }
+    core::context_mirror const & app_context_mirror() const noexcept { return _app_ctxt_mirror; }
+
+    // True if the mirror is valid, and neither context has been changed
+    // through the context API since it was last brought up to date
+    bool app_context_mirror_valid() const noexcept;
+    // Records that both contexts match the mirror as it now stands
+    void sync_app_context_mirror() noexcept;
+    void invalidate_app_context_mirror() noexcept { _app_ctxt_mirror.valid = false; }
+
+    // True if the app context holds the same text as the cached context, so
+    // that the output of an event can be applied to it directly. Only
+    // meaningful for keyboard processors that do not normalize.
+    bool app_context_synced() const noexcept;
+    // Records that the app context holds the same text as the cached context
+    void sync_app_context() noexcept;
+
     core::abstract_processor const & processor() const noexcept { return _processor; }
     core::abstract_processor &       processor() noexcept { return _processor; }
 
+    core::processor_state const * processor_state() const noexcept { return _processor_state.get(); }
+    core::processor_state *       processor_state() noexcept { return _processor_state.get(); }
+
     core::actions        & actions() noexcept        { return _actions; }
     core::actions const  & actions() const noexcept  { return _actions; }
 
@@ -174,6 +258,21 @@ public:
       km_core_actions const &actions
     );
     void apply_actions_and_merge_app_context();
+    // Sets the actions for an event that changes nothing, other than passing
+    // on the keystroke if `emit_keystroke`, in place of processing it and
+    // calling apply_actions_and_merge_app_context
+    void set_no_op_actions(bool emit_keystroke);
+
+    // Saves the contexts, and the keyboard processor's data for this state,
+    // into `snapshot`
+    void snapshot(state_snapshot & snapshot) const;
+    // Returns this state to `snapshot`, which must have been taken from a
+    // state of the same keyboard processor. The actions and debug items of
+    // the last event are left as they are.
+    bool restore(state_snapshot const & snapshot);
+
+  private:
+    void update_app_context_mirror();
   };
 } // namespace core
 } // namespace km
@@ -184,3 +283,7 @@ struct km_core_state : public km::core::state
   km_core_state(Args&&... args) : km::core::state(std::forward<Args>(args)...)
   {}
 };
+
+struct km_core_snapshot : public km::core::state_snapshot
+{
+};
@@ -36,6 +36,12 @@ namespace
     {KM_CORE_CT_END, {0,}, {0}}
   };
 
+  bool context_equals(km_core_context *ctxt, std::u16string const &expected) {
+    auto s = km::core::get_context_as_string(ctxt);
+    bool result = s && expected == s;
+    delete [] s;
+    return result;
+  }
 
 }
 
@@ -137,5 +143,43 @@ int main(int, char * [])
   km_core_context_items_dispose(tmp_ctxt);
   km_core_context_items_dispose(ctxt1);
 
+  // A context grows past its initial size, and keeps every item.
+  std::u16string long_text;
+  for (int i = 0; i < 300; i++) {
+    long_text.push_back(u'a' + i % 26);
+  }
+  km_core_context long_ctxt;
+  try_status(context_items_from_utf16(long_text.c_str(), &ctxt1));
+  try_status(km_core_context_set(&long_ctxt, ctxt1));
+  km_core_context_items_dispose(ctxt1);
+  if(km_core_context_length(&long_ctxt) != 300) return __LINE__;
+  try_status(km_core_context_get(&long_ctxt, &tmp_ctxt));
+  if(km_core_context_item_list_size(tmp_ctxt) != 300) return __LINE__;
+  km_core_context_items_dispose(tmp_ctxt);
+  if(!context_equals(&long_ctxt, long_text)) return __LINE__;
+
+  // Wrap around the end of the buffer in both directions.
+  km_core_context ring_ctxt;
+  try_status(context_items_from_utf16(long_text.substr(0, 256).c_str(), &ctxt1));
+  try_status(context_append(&ring_ctxt, ctxt1));
+  km_core_context_items_dispose(ctxt1);
+  try_status(context_shrink(&ring_ctxt, 253, false));
+  try_status(context_items_from_utf16(u"xy", &ctxt1));
+  try_status(context_append(&ring_ctxt, ctxt1));
+  km_core_context_items_dispose(ctxt1);
+  if(!context_equals(&ring_ctxt, u"tuvxy")) return __LINE__;
+  try_status(context_shrink(&ring_ctxt, 5, false));
+  try_status(context_items_from_utf16(u"abc", &ctxt1));
+  try_status(context_prepend(&ring_ctxt, ctxt1));
+  km_core_context_items_dispose(ctxt1);
+  try_status(context_items_from_utf16(u"def", &ctxt1));
+  try_status(context_append(&ring_ctxt, ctxt1));
+  km_core_context_items_dispose(ctxt1);
+  if(!context_equals(&ring_ctxt, u"abcdef")) return __LINE__;
+  try_status(context_shrink(&ring_ctxt, 2));
+  if(!context_equals(&ring_ctxt, u"abcd")) return __LINE__;
+  if(ring_ctxt.back().character != U'd') return __LINE__;
+  if((ring_ctxt.end() - 3)->character != (ring_ctxt.rbegin() + 2)->character) return __LINE__;
+
   return 0;
 }
@@ -4,11 +4,17 @@
   Create Date:  30 Oct 2018
   Authors:      Tim Eves (TSE)
 */
+#include <algorithm>
+#include <fstream>
+#include <iterator>
 #include <string>
+#include <vector>
 
 #include "keyman_core.h"
 #include "path.hpp"
 
+#include "../emscripten_filesystem.h"
+
 //#include "keyboard.hpp"
 
 namespace
@@ -19,7 +25,76 @@ namespace
 #define   try_status(expr) \
 {auto __s = (expr); if (__s != KM_CORE_STATUS_OK) return 100*__LINE__+__s;}
 
-int main(int, char *[])
+// Loads a keyboard from a copy of its file contents, and checks that it
+// behaves the same as the same keyboard loaded from the file
+int test_load_from_blob(km::core::path const & kmx_path)
+{
+  km_core_keyboard * file_kb = nullptr;
+  km_core_keyboard * blob_kb = nullptr;
+  km_core_keyboard_attrs const * file_attrs = nullptr;
+  km_core_keyboard_attrs const * blob_attrs = nullptr;
+
+  std::vector<uint8_t> data;
+  {
+    std::ifstream file(static_cast<std::string>(kmx_path), std::ios::binary);
+    if (!file.good())
+      return __LINE__;
+    data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+  }
+
+  try_status(km_core_keyboard_load(kmx_path.c_str(), &file_kb));
+  try_status(km_core_keyboard_load_from_blob(kmx_path.c_str(), data.data(), data.size(), &blob_kb));
+
+  // The keyboard must not depend on the caller's buffer
+  std::fill(data.begin(), data.end(), 0);
+
+  try_status(km_core_keyboard_get_attrs(file_kb, &file_attrs));
+  try_status(km_core_keyboard_get_attrs(blob_kb, &blob_attrs));
+  if (std::u16string(file_attrs->id) != blob_attrs->id)
+    return __LINE__;
+  if (std::u16string(file_attrs->version_string) != blob_attrs->version_string)
+    return __LINE__;
+  if (blob_attrs->folder_path != kmx_path.parent())
+    return __LINE__;
+
+  km_core_state * state = nullptr;
+  km_core_option_item env[] = {KM_CORE_OPTIONS_END};
+  try_status(km_core_state_create(blob_kb, env, &state));
+  km_core_state_dispose(state);
+
+  km_core_keyboard_dispose(file_kb);
+  km_core_keyboard_dispose(blob_kb);
+
+  // Garbage and empty buffers are rejected
+  std::vector<uint8_t> garbage(1024, 0x55);
+  if (km_core_keyboard_load_from_blob(kmx_path.c_str(), garbage.data(), garbage.size(), &blob_kb) != KM_CORE_STATUS_INVALID_KEYBOARD)
+    return __LINE__;
+  if (km_core_keyboard_load_from_blob(kmx_path.c_str(), garbage.data(), 0, &blob_kb) != KM_CORE_STATUS_INVALID_ARGUMENT)
+    return __LINE__;
+
+  return 0;
+}
+
+// The load flags only change how LDML keyboards are prepared, so other
+// keyboards load the same with any of them
+int test_load_with_flags(km::core::path const & kmx_path)
+{
+  uint32_t const all_flags[] = {KM_CORE_KEYBOARD_LOAD_DEFAULT, KM_CORE_KEYBOARD_LOAD_PARALLEL,
+                                KM_CORE_KEYBOARD_LOAD_LAZY, KM_CORE_KEYBOARD_LOAD_PARALLEL | KM_CORE_KEYBOARD_LOAD_LAZY};
+  for (uint32_t flags : all_flags) {
+    km_core_keyboard * kb = nullptr;
+    km_core_keyboard_attrs const * attrs = nullptr;
+    try_status(km_core_keyboard_load_with_flags(kmx_path.c_str(), flags, &kb));
+    try_status(km_core_keyboard_get_attrs(kb, &attrs));
+    if (attrs->folder_path != kmx_path.parent())
+      return __LINE__;
+    km_core_keyboard_dispose(kb);
+  }
+
+  return 0;
+}
+
+int main(int argc, char *argv[])
 {
   km_core_keyboard * test_kb = nullptr;
   km_core_keyboard_attrs const * kb_attrs = nullptr;
@@ -38,5 +113,22 @@ int main(int, char *[])
   km_core_keyboard_key_list_dispose(kb_key_list);
   km_core_keyboard_imx_list_dispose(kb_imx_list);
 
+  if (argc > 1) {
+    auto arg_color = std::string(argv[1]) == "--color";
+    if (argc > (arg_color ? 2 : 1)) {
+#ifdef __EMSCRIPTEN__
+      km::core::path kmx_dir = get_wasm_file_path(argv[arg_color ? 2 : 1]);
+#else
+      km::core::path kmx_dir = argv[arg_color ? 2 : 1];
+#endif
+      int result = test_load_from_blob(km::core::path::join(kmx_dir, "k_000___null_keyboard.kmx"));
+      if (result)
+        return result;
+      result = test_load_with_flags(km::core::path::join(kmx_dir, "k_000___null_keyboard.kmx"));
+      if (result)
+        return result;
+    }
+  }
+
   return 0;
 }
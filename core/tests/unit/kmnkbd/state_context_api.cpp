@@ -428,6 +428,89 @@ test_context_set_if_needed__surrogate_pairs_cached_context_longer_and_markers()
   teardown();
 }
 
+bool
+is_identical_app_context(km_core_cp const *app_context) {
+  km_core_cp *str = km::core::get_context_as_string(km_core_state_app_context(test_state));
+  bool result = std::u16string(app_context) == str;
+  delete[] str;
+  return result;
+}
+
+void
+test_context_set_if_needed__text_added_and_removed() {
+  setup("k_000___null_keyboard.kmx", u"", false);
+  assert_equal_status(km_core_state_context_set_if_needed(test_state, u"is a test"), KM_CORE_CONTEXT_STATUS_UPDATED);
+  assert_equal_status(km_core_state_context_set_if_needed(test_state, u"is a test"), KM_CORE_CONTEXT_STATUS_UNCHANGED);
+
+  assert_equal_status(km_core_state_context_set_if_needed(test_state, u"This is a test"), KM_CORE_CONTEXT_STATUS_UPDATED);
+  assert(is_identical_context(u"This is a test"));
+  assert(is_identical_app_context(u"This is a test"));
+  assert_equal_status(km_core_state_context_set_if_needed(test_state, u"This is a test"), KM_CORE_CONTEXT_STATUS_UNCHANGED);
+
+  assert_equal_status(km_core_state_context_set_if_needed(test_state, u"a test"), KM_CORE_CONTEXT_STATUS_UPDATED);
+  assert(is_identical_context(u"a test"));
+  assert(is_identical_app_context(u"a test"));
+
+  assert_equal_status(km_core_state_context_set_if_needed(test_state, u"a tent"), KM_CORE_CONTEXT_STATUS_UPDATED);
+  assert(is_identical_context(u"a tent"));
+  assert(is_identical_app_context(u"a tent"));
+
+  // A context set through the context API is not missed
+  try_status(set_context_from_string(km_core_state_context(test_state), u"a test"));
+  assert_equal_status(km_core_state_context_set_if_needed(test_state, u"a tent"), KM_CORE_CONTEXT_STATUS_UPDATED);
+  assert(is_identical_context(u"a tent"));
+  teardown();
+}
+
+void
+test_context_set_if_needed__text_added_and_removed_nfd() {
+  setup("/a/dummy/keyboard.mock", u"", false);
+  assert_equal_status(km_core_state_context_set_if_needed(test_state, u"b\u1ec7"), KM_CORE_CONTEXT_STATUS_UPDATED);
+  assert(is_identical_context(u"be\u0323\u0302"));
+
+  assert_equal_status(km_core_state_context_set_if_needed(test_state, u"\u1ec7b\u1ec7"), KM_CORE_CONTEXT_STATUS_UPDATED);
+  assert(is_identical_context(u"e\u0323\u0302be\u0323\u0302"));
+  assert(is_identical_app_context(u"\u1ec7b\u1ec7"));
+  assert_equal_status(km_core_state_context_set_if_needed(test_state, u"\u1ec7b\u1ec7"), KM_CORE_CONTEXT_STATUS_UNCHANGED);
+
+  assert_equal_status(km_core_state_context_set_if_needed(test_state, u"\u1ec7"), KM_CORE_CONTEXT_STATUS_UPDATED);
+  assert(is_identical_context(u"e\u0323\u0302"));
+  assert(is_identical_app_context(u"\u1ec7"));
+
+  // The text added reorders with the text that was already there
+  assert_equal_status(km_core_state_context_set_if_needed(test_state, u"\u0323x"), KM_CORE_CONTEXT_STATUS_UPDATED);
+  assert_equal_status(km_core_state_context_set_if_needed(test_state, u"e\u0302\u0323x"), KM_CORE_CONTEXT_STATUS_UPDATED);
+  assert(is_identical_context(u"e\u0323\u0302x"));
+  assert(is_identical_app_context(u"e\u0302\u0323x"));
+  teardown();
+}
+
+void
+test_context_set_if_needed__unpaired_surrogates() {
+  setup("k_000___null_keyboard.kmx", u"", false);
+  assert_equal_status(km_core_state_context_set_if_needed(test_state, u"is a test"), KM_CORE_CONTEXT_STATUS_UPDATED);
+
+  // A lone high surrogate in the text added at the start
+  std::u16string text = u"x is a test";
+  text.insert(0, 1, u'\xD83D');
+  assert_equal_status(km_core_state_context_set_if_needed(test_state, text.c_str()), KM_CORE_CONTEXT_STATUS_CLEARED);
+  assert(is_identical_context(u""));
+  assert(is_identical_app_context(u""));
+
+  // Whichever way the context is compared, the same text is rejected
+  assert_equal_status(km_core_state_context_set_if_needed(test_state, u"is a test"), KM_CORE_CONTEXT_STATUS_UPDATED);
+  setup("k_000___null_keyboard.kmx", u"is a test");
+  assert_equal_status(km_core_state_context_set_if_needed(test_state, text.c_str()), KM_CORE_CONTEXT_STATUS_CLEARED);
+  assert(is_identical_context(u""));
+  assert(is_identical_app_context(u""));
+
+  // A lone low surrogate at the start is the end of a pair cut off by the app
+  text.replace(0, 1, 1, u'\xDE00');
+  assert_equal_status(km_core_state_context_set_if_needed(test_state, text.c_str()), KM_CORE_CONTEXT_STATUS_UPDATED);
+  assert(is_identical_context(u"x is a test"));
+  teardown();
+}
+
 void
 test_context_set_if_needed() {
   // Scenarios from #10100:
@@ -460,6 +543,11 @@ test_context_set_if_needed() {
   test_context_set_if_needed__surrogate_pairs_cached_context_longer();
   test_context_set_if_needed__surrogate_pairs_app_context_longer_and_markers();
   test_context_set_if_needed__surrogate_pairs_cached_context_longer_and_markers();
+  // 8. text added to and removed from the start of the last app context
+  test_context_set_if_needed__text_added_and_removed();
+  test_context_set_if_needed__text_added_and_removed_nfd();
+  // 9. unpaired surrogates in the app context
+  test_context_set_if_needed__unpaired_surrogates();
 }
 
 void
@@ -474,6 +562,190 @@ test_context_clear() {
 
 //-------------------------------------------------------------------------------------
 
+std::u32string
+press(km_core_virtual_key vk) {
+  try_status(km_core_process_event(test_state, vk, 0, 1, 0));
+  std::u32string output;
+  for (auto p = km_core_state_get_actions(test_state)->output; p && *p; p++) {
+    output += *p;
+  }
+  return output;
+}
+
+void
+test_context_changed_between_events() {
+  // k_020: [K_7] outputs 'c' dk(7) 'd' 'e', and [K_BKSP] outputs ' ok' after
+  // 'c' dk(7) 'd', or ' fail' after 'c' 'd'
+  setup("k_020___deadkeys_and_backspace.kmx", u"");
+
+  assert(press(KM_CORE_VKEY_7) == U"cde");
+  assert(press(KM_CORE_VKEY_BKSP) == U"");
+  assert(press(KM_CORE_VKEY_BKSP) == U" ok");
+
+  // The keyboard must see a context set between events
+  km_core_context_item const cd[] = {
+      {KM_CORE_CT_CHAR, {0}, {'c'}},
+      {KM_CORE_CT_CHAR, {0}, {'d'}},
+      KM_CORE_CONTEXT_ITEM_END};
+  try_status(km_core_context_set(km_core_state_context(test_state), cd));
+  assert(press(KM_CORE_VKEY_BKSP) == U" fail");
+
+  // ... and a cleared context
+  km_core_context_clear(km_core_state_context(test_state));
+  assert(press(KM_CORE_VKEY_BKSP) == U"");
+
+  // A context longer than the keyboard can see, with deadkeys falling off the
+  // start of it
+  for (int i = 0; i < 40; i++) {
+    assert(press(KM_CORE_VKEY_7) == U"cde");
+  }
+  assert(press(KM_CORE_VKEY_BKSP) == U"");
+  assert(press(KM_CORE_VKEY_BKSP) == U" ok");
+
+  teardown();
+}
+
+void
+test_context_set_if_needed_after_events() {
+  // k_020: as above
+  setup("k_020___deadkeys_and_backspace.kmx", u"", false);
+  assert_equal_status(km_core_state_context_set_if_needed(test_state, u"ab"), KM_CORE_CONTEXT_STATUS_UPDATED);
+
+  // The app passes back the output of each event, which leaves the cached
+  // context, and the deadkey in it, as it is
+  assert(press(KM_CORE_VKEY_7) == U"cde");
+  assert_equal_status(km_core_state_context_set_if_needed(test_state, u"abcde"), KM_CORE_CONTEXT_STATUS_UNCHANGED);
+  assert(press(KM_CORE_VKEY_BKSP) == U"");
+  assert_equal_status(km_core_state_context_set_if_needed(test_state, u"abcd"), KM_CORE_CONTEXT_STATUS_UNCHANGED);
+  assert(press(KM_CORE_VKEY_BKSP) == U" ok");
+  assert_equal_status(km_core_state_context_set_if_needed(test_state, u"ab ok"), KM_CORE_CONTEXT_STATUS_UNCHANGED);
+  assert(is_identical_app_context(u"ab ok"));
+
+  // ... but not if the app has changed the text in the meantime
+  assert(press(KM_CORE_VKEY_7) == U"cde");
+  assert_equal_status(km_core_state_context_set_if_needed(test_state, u"ab okcd"), KM_CORE_CONTEXT_STATUS_UPDATED);
+  assert(press(KM_CORE_VKEY_BKSP) == U" fail");
+
+  teardown();
+}
+
+void
+test_context_unchanged_by_no_op_events() {
+  // k_020: as above
+  setup("k_020___deadkeys_and_backspace.kmx", u"", false);
+  assert_equal_status(km_core_state_context_set_if_needed(test_state, u"ab"), KM_CORE_CONTEXT_STATUS_UPDATED);
+  assert(press(KM_CORE_VKEY_7) == U"cde");
+
+  // A key-up passes on the keystroke, and a bare modifier key does nothing
+  // at all; neither touches the context
+  try_status(km_core_process_event(test_state, KM_CORE_VKEY_7, 0, 0, 0));
+  km_core_actions const *actions = km_core_state_get_actions(test_state);
+  assert(actions->emit_keystroke && actions->code_points_to_delete == 0 && *actions->output == 0);
+  assert(*actions->deleted_context == 0 && actions->persist_options->scope == 0);
+  size_t num_items = 0;
+  assert(km_core_state_action_items(test_state, &num_items)->type == KM_CORE_IT_EMIT_KEYSTROKE && num_items == 2);
+
+  for (uint8_t is_key_down : {1, 0}) {
+    try_status(km_core_process_event(test_state, KM_CORE_VKEY_SHIFT, KM_CORE_MODIFIER_SHIFT, is_key_down, 0));
+    actions = km_core_state_get_actions(test_state);
+    assert(!actions->emit_keystroke && actions->code_points_to_delete == 0 && *actions->output == 0);
+    assert(km_core_state_action_items(test_state, &num_items)->type == KM_CORE_IT_END && num_items == 1);
+  }
+
+  assert_equal_status(km_core_state_context_set_if_needed(test_state, u"abcde"), KM_CORE_CONTEXT_STATUS_UNCHANGED);
+  assert(press(KM_CORE_VKEY_BKSP) == U"");
+  assert(press(KM_CORE_VKEY_BKSP) == U" ok");
+
+  teardown();
+}
+
+//-------------------------------------------------------------------------------------
+// Snapshot tests
+//-------------------------------------------------------------------------------------
+
+void
+test_snapshot_restores_context() {
+  // k_020: as above
+  setup("k_020___deadkeys_and_backspace.kmx", u"", false);
+  assert_equal_status(km_core_state_context_set_if_needed(test_state, u"ab"), KM_CORE_CONTEXT_STATUS_UPDATED);
+  assert(press(KM_CORE_VKEY_7) == U"cde");
+  assert(press(KM_CORE_VKEY_BKSP) == U"");
+  assert_equal_status(km_core_state_context_set_if_needed(test_state, u"abcd"), KM_CORE_CONTEXT_STATUS_UNCHANGED);
+
+  km_core_snapshot *snapshot = nullptr;
+  try_status(km_core_state_snapshot(test_state, &snapshot));
+
+  // Each speculative event starts from the snapshot, deadkey and all
+  for (int i = 0; i < 2; i++) {
+    assert(press(KM_CORE_VKEY_BKSP) == U" ok");
+    assert(is_identical_app_context(u"ab ok"));
+    try_status(km_core_state_restore(test_state, snapshot));
+    assert(is_identical_context(u"abcd"));
+    assert(is_identical_app_context(u"abcd"));
+  }
+
+  // The actions of the last event are left for the caller to read
+  assert(km_core_state_get_actions(test_state)->code_points_to_delete == 2);
+
+  // The app's text has not changed, and is recognised as such
+  assert_equal_status(km_core_state_context_set_if_needed(test_state, u"abcd"), KM_CORE_CONTEXT_STATUS_UNCHANGED);
+
+  // A change to the context made through the API is undone too
+  km_core_state_context_clear(test_state);
+  try_status(km_core_state_restore(test_state, snapshot));
+  assert(press(KM_CORE_VKEY_BKSP) == U" ok");
+
+  km_core_snapshot_dispose(snapshot);
+  teardown();
+}
+
+void
+test_snapshot_restores_options() {
+  // k_021: [K_1] sets foo to '1', [K_0] sets it to '0', and [K_A] outputs
+  // 'foo.' or 'no foo.' depending on foo
+  setup("k_021___options.kmx", u"");
+
+  km_core_snapshot *snapshot = nullptr;
+  try_status(km_core_state_snapshot(test_state, &snapshot));
+  press(KM_CORE_VKEY_1);
+  assert(press(KM_CORE_VKEY_A) == U"foo.");
+  try_status(km_core_state_restore(test_state, snapshot));
+  assert(press(KM_CORE_VKEY_A) == U"no foo.");
+
+  km_core_cp const *value = nullptr;
+  try_status(km_core_state_option_lookup(test_state, KM_CORE_OPT_KEYBOARD, u"foo", &value));
+  assert(std::u16string(value) == u"0");
+
+  // A snapshot can be restored to another state of the same keyboard...
+  km_core_state *other = nullptr;
+  try_status(km_core_state_create(test_kb, test_env_opts, &other));
+  press(KM_CORE_VKEY_1);
+  km_core_snapshot_dispose(snapshot);
+  try_status(km_core_state_snapshot(test_state, &snapshot));
+  try_status(km_core_state_restore(other, snapshot));
+  try_status(km_core_state_option_lookup(other, KM_CORE_OPT_KEYBOARD, u"foo", &value));
+  assert(std::u16string(value) == u"1");
+  km_core_state_dispose(other);
+
+  // ... but not to a state of another keyboard
+  km_core_keyboard *other_kb = nullptr;
+  km::core::path path = km::core::path::join(arg_path, "k_000___null_keyboard.kmx");
+  try_status(km_core_keyboard_load(path.native().c_str(), &other_kb));
+  try_status(km_core_state_create(other_kb, test_env_opts, &other));
+  assert_equal_status(km_core_state_restore(other, snapshot), KM_CORE_STATUS_INVALID_ARGUMENT);
+  km_core_state_dispose(other);
+  km_core_keyboard_dispose(other_kb);
+
+  km_core_snapshot_dispose(snapshot);
+  teardown();
+}
+
+void
+test_snapshot() {
+  test_snapshot_restores_context();
+  test_snapshot_restores_options();
+}
+
 void test_context_debug_empty() {
   km_core_cp const *cached_context =      u"";
   setup("k_000___null_keyboard.kmx", cached_context);
@@ -551,5 +823,9 @@ main(int argc, char *argv[]) {
 
   test_context_set_if_needed();
   test_context_clear();
+  test_context_changed_between_events();
+  test_context_set_if_needed_after_events();
+  test_context_unchanged_by_no_op_events();
+  test_snapshot();
   test_context_debug();
 }
@@ -176,6 +176,10 @@ void test_actions_normalize(
  *                                      have been modified prior to that. Should
  *                                      match char-for-char what the app ends up
  *                                      with in its text buffer.
+ * @param app_context_synced            true if the app context matched the
+ *                                      cached context before the transform,
+ *                                      so that the transform can be applied
+ *                                      to it directly
  */
 void test_actions_update_app_context_nfu(
   const char *name,
@@ -187,13 +191,14 @@ void test_actions_update_app_context_nfu(
 
   const unsigned int expected_delete,
   const std::u32string expected_output,
-  const km_core_cp *expected_final_app_context
+  const km_core_cp *expected_final_app_context,
+  bool app_context_synced = true
 ) {
   std::cout << "test_actions_update_app_context_nfu: " << name << std::endl;
 
   setup(initial_app_context, final_cached_context_string, final_cached_context_items, actions_code_points_to_delete, actions_output);
 
-  assert(km::core::actions_update_app_context_nfu(km_core_state_context(test_state), km_core_state_app_context(test_state)));
+  assert(km::core::actions_update_app_context_nfu(km_core_state_context(test_state), km_core_state_app_context(test_state), test_actions, app_context_synced));
 
   std::cout << "test_actions_update_app_context_nfu: (" << name << "): delete: " << expected_delete << " output: |" << std::u32string(test_actions.output) << "|" << std::endl;
   std::u32string o(test_actions.output);
@@ -457,6 +462,37 @@ void run_actions_normalize_tests() {
     /* action del, output: */            1, U"𐒻𐒷",
     /* app_context: */                   u"𐒻𐒷"
   );
+
+  // Only the end of a long context takes part in normalization, so the app's
+  // text before the edit is left as it is, in whatever form it is in
+
+  std::u16string long_app_context, long_cached_context;
+  for(int i = 0; i < 60; i++) {
+    long_app_context += u"a\u0300ê";
+    long_cached_context += u"a\u0300e\u0302";
+  }
+
+  test_actions_normalize(
+    "Long context, with NFU text before the edit",
+    /* app context pre transform: */     (long_app_context + u"abcê").c_str(),
+    /* cached context post transform: */ (long_cached_context + u"abce\u0323\u0302").c_str(),
+    /* cached context post transform: */ nullptr,
+    /* action del, output: */            1, U"\u0323\u0302",
+    // ---- results ----
+    /* action del, output: */            1, U"ệ",
+    /* app_context: */                   (long_app_context + u"abcệ").c_str()
+  );
+
+  test_actions_normalize(
+    "Long context, backtrack into NFU text before the edit",
+    /* app context pre transform: */     (long_app_context + u"a\u0300").c_str(),
+    /* cached context post transform: */ (long_cached_context + u"a\u0316\u0300").c_str(),
+    /* cached context post transform: */ nullptr,
+    /* action del, output: */            1, U"\u0316\u0300",
+    // ---- results ----
+    /* action del, output: */            2, U"\u00e0\u0316",
+    /* app_context: */                   (long_app_context + u"\u00e0\u0316").c_str()
+  );
 }
 
 void run_actions_update_app_context_nfu_tests() {
@@ -576,6 +612,20 @@ void run_actions_update_app_context_nfu_tests() {
     /* action del, output: */            1, U"a\U0001F60E",
     /* app_context: */                   u"a\U0001F607bca\U0001F60E"
   );
+
+  // Out of step contexts
+
+  test_actions_update_app_context_nfu(
+    "App context does not match the cached context, so is replaced by it",
+    /* app context pre transform: */     u"xyz",
+    /* cached context post transform: */ u"abcdef",
+    /* cached context post transform: */ nullptr,
+    /* action del, output: */            1, U"ef",
+    // ---- results ----
+    /* action del, output: */            1, U"ef",
+    /* app_context: */                   u"abcdef",
+    /* app context synced: */            false
+  );
 }
 
 //-------------------------------------------------------------------------------------
@@ -0,0 +1,173 @@
+/*
+ * Keyman is copyright (C) SIL International. MIT License.
+ *
+ * Keyman Core - heap allocations made while typing with a KMX keyboard
+ */
+
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+
+#include "keyman_core.h"
+#include "path.hpp"
+
+#include <test_assert.h>
+#include "../emscripten_filesystem.h"
+
+namespace {
+
+// Calls to operator new are counted while set
+bool counting = false;
+size_t allocations = 0;
+
+} // namespace
+
+void *
+operator new(size_t size) {
+  if (counting) {
+    allocations++;
+  }
+  void *p = std::malloc(size ? size : 1);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void *
+operator new[](size_t size) {
+  return operator new(size);
+}
+
+void
+operator delete(void *p) noexcept {
+  std::free(p);
+}
+
+void
+operator delete[](void *p) noexcept {
+  std::free(p);
+}
+
+void
+operator delete(void *p, size_t) noexcept {
+  std::free(p);
+}
+
+void
+operator delete[](void *p, size_t) noexcept {
+  std::free(p);
+}
+
+namespace {
+
+km_core_option_item test_env_opts[] = {KM_CORE_OPTIONS_END};
+
+std::string arg_path;
+
+// k_001___basic_input_unicodei: [SHIFT K_A] outputs 'a', [SHIFT K_B] 'b',
+// and 'DE' + [SHIFT K_F] replaces the 'DE' with 'def'; other keys output
+// their characters
+const char *basic_keyboard = "k_001___basic_input_unicodei.kmx";
+
+// One keystroke, as the app would send it: the context is synced first, and
+// the output is applied to the app's text. Only the calls into Core are
+// counted.
+void
+type(km_core_state *state, std::u16string &text, km_core_virtual_key vk) {
+  counting = true;
+  assert(km_core_state_context_set_if_needed(state, text.c_str()) != KM_CORE_CONTEXT_STATUS_ERROR);
+  try_status(km_core_process_event(state, vk, KM_CORE_MODIFIER_SHIFT, 1, 0));
+  km_core_actions const *actions = km_core_state_get_actions(state);
+  counting = false;
+
+  for (unsigned int n = 0; n < actions->code_points_to_delete; n++) {
+    text.pop_back();
+  }
+  for (auto p = actions->output; *p; p++) {
+    text.push_back(static_cast<char16_t>(*p));
+  }
+  // Keep the app's text to a steady length, so that the start of the context
+  // moves as well as its end
+  if (text.length() > 100) {
+    text.erase(0, text.length() - 100);
+  }
+
+  counting = true;
+  try_status(km_core_process_event(state, vk, KM_CORE_MODIFIER_SHIFT, 0, 0));
+  counting = false;
+}
+
+void
+type_word(km_core_state *state, std::u16string &text) {
+  for (auto vk : {KM_CORE_VKEY_A, KM_CORE_VKEY_D, KM_CORE_VKEY_E, KM_CORE_VKEY_F, KM_CORE_VKEY_B, KM_CORE_VKEY_SPACE}) {
+    type(state, text, vk);
+  }
+}
+
+} // namespace
+
+void
+test_steady_state_typing() {
+  km_core_keyboard *kb = nullptr;
+  km_core_state *state = nullptr;
+  km::core::path path = km::core::path::join(arg_path, basic_keyboard);
+  try_status(km_core_keyboard_load(path.native().c_str(), &kb));
+  try_status(km_core_state_create(kb, test_env_opts, &state));
+
+  std::u16string text = u"Some text ";
+  text.reserve(200);
+
+  // Let the buffers grow to fit, and the text fill its length
+  for (int i = 0; i < 40; i++) {
+    type_word(state, text);
+  }
+  assert(text.substr(text.length() - 6) == u"adefb ");
+
+  allocations = 0;
+  for (int i = 0; i < 100; i++) {
+    type_word(state, text);
+  }
+  std::cout << "allocations in 1200 events: " << allocations << std::endl;
+  assert(allocations == 0);
+
+  km_core_state_dispose(state);
+  km_core_keyboard_dispose(kb);
+}
+
+constexpr const auto help_str = "\
+test_kmx_allocations [--color] <BASELINE_KEYBOARD_PATH>\n\
+\n\
+  --color         Force color output\n\
+  <BASELINE_KEYBOARD_PATH>   Path to the compiled baseline keyboards\n";
+
+int
+error_args() {
+  std::cerr << "test_kmx_allocations: Invalid arguments." << std::endl;
+  std::cout << help_str;
+  return 1;
+}
+
+int
+main(int argc, char *argv[]) {
+  if (argc < 2) {
+    return error_args();
+  }
+
+  auto arg_color = std::string(argv[1]) == "--color";
+  if (arg_color && argc < 3) {
+    return error_args();
+  }
+  console_color::enabled = console_color::isaterminal() || arg_color;
+
+#ifdef __EMSCRIPTEN__
+  arg_path = get_wasm_file_path(argv[arg_color ? 2 : 1]);
+#else
+  arg_path = argv[arg_color ? 2 : 1];
+#endif
+
+  test_steady_state_typing();
+
+  return 0;
+}
@@ -213,6 +213,38 @@ test_Add() {
   assert_equal(u16len(buf), MAXCONTEXT - 3);
 }
 
+void
+test_IsTruncated() {
+  KMX_Context context;
+  assert(context.IsTruncated() == FALSE);
+
+  // exactly MAXCONTEXT-1 characters fit
+  auto text = u"\uFFFF\u0008\u0001abcdefghijklmnopqrstuvwxyzabcdefghijklmnopqrstuvwxyzabcdefgh";
+  context.Set(text);
+  assert(context.IsTruncated() == FALSE);
+
+  // adding to a full context drops its start
+  context.Add(u'1');
+  assert(context.IsTruncated() == TRUE);
+
+  // deleting does not bring the start back
+  context.Delete();
+  assert(context.IsTruncated() == TRUE);
+
+  context.Reset();
+  assert(context.IsTruncated() == FALSE);
+
+  context.Set(u"abcdefghijklmnopqrstuvwxyzabcdefghijklmnopqrstuvwxyzabcdefghijkl");
+  assert(context.IsTruncated() == TRUE);
+
+  context.Set(u"abc");
+  assert(context.IsTruncated() == FALSE);
+
+  // the caller may tell us that the buffer is already the end of a longer context
+  context.Set(u"abc", TRUE);
+  assert(context.IsTruncated() == TRUE);
+}
+
 void
 test_Delete() {
   KMX_Context context;
@@ -450,6 +482,7 @@ main(int argc, char *argv[]) {
   test_CharIsSurrogatePair();
   test_Set();
   test_Add();
+  test_IsTruncated();
   test_Delete();
   test_Buf();
   test_BufMax();
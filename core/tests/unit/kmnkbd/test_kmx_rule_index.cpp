@@ -0,0 +1,95 @@
+/*
+ * Keyman is copyright (C) SIL International. MIT License.
+ *
+ * Keyman Core - KMX rule index unit tests
+ */
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "../../../src/kmx/kmx_rule_index.h"
+#include "../../../src/kmx/kmx_processevent.h"
+#include <test_assert.h>
+
+using namespace km::core::kmx;
+using namespace std;
+
+namespace {
+
+KMX_WCHAR empty[] = u"";
+
+KEY make_key(KMX_WCHAR key, KMX_DWORD shift) {
+  return KEY{key, 0, shift, empty, empty};
+}
+
+vector<KMX_DWORD> candidates(KMX_RuleIndex const &index, KMX_DWORD group, KMX_WCHAR vkey, KMX_WCHAR charCode) {
+  vector<KMX_DWORD> result;
+  KMX_DWORD rule;
+  auto c = index.Find(group, vkey, charCode);
+  while (c.Next(rule)) {
+    result.push_back(rule);
+  }
+  return result;
+}
+
+} // namespace
+
+void
+test_Find() {
+  KEY keys[] = {
+    make_key(u'a', 0),                                        // 0
+    make_key(KM_CORE_VKEY_A, K_SHIFTFLAG | ISVIRTUALKEY),     // 1
+    make_key(u'b', 0),                                        // 2
+    make_key(KM_CORE_VKEY_A, ISVIRTUALKEY),                   // 3
+    make_key(u'a', 0),                                        // 4
+    make_key(KM_CORE_VKEY_B, ISVIRTUALKEY),                   // 5
+    make_key(KM_CORE_VKEY_A, LCTRLFLAG | ISVIRTUALKEY),       // 6
+  };
+  GROUP groups[2] = {
+    {empty, keys, nullptr, nullptr, sizeof(keys) / sizeof(keys[0]), TRUE},
+    {empty, keys, nullptr, nullptr, sizeof(keys) / sizeof(keys[0]), FALSE},
+  };
+  KEYBOARD kbd = {};
+  kbd.cxGroupArray = 2;
+  kbd.dpGroupArray = groups;
+
+  KMX_RuleIndex index;
+  index.Build(&kbd);
+
+  assert(index.IsIndexed(0));
+  assert(!index.IsIndexed(1));
+  assert(!index.IsIndexed(2));
+
+  // 'a' is typed with VK_A; candidates are merged in original rule order
+  assert(candidates(index, 0, KM_CORE_VKEY_A, u'a') == (vector<KMX_DWORD>{0, 1, 3, 4, 6}));
+  // no character code, only vkey rules
+  assert(candidates(index, 0, KM_CORE_VKEY_A, 0) == (vector<KMX_DWORD>{1, 3, 6}));
+  assert(candidates(index, 0, KM_CORE_VKEY_B, u'b') == (vector<KMX_DWORD>{2, 5}));
+  assert(candidates(index, 0, KM_CORE_VKEY_C, u'c').empty());
+
+  index.Clear();
+  assert(!index.IsIndexed(0));
+}
+
+constexpr const auto help_str = "\
+test_kmx_rule_index [--color]\n\
+\n\
+  --color         Force color output\n";
+
+int
+error_args() {
+  std::cerr << "test_kmx_rule_index: Invalid arguments." << std::endl;
+  std::cout << help_str;
+  return 1;
+}
+
+int
+main(int argc, char *argv[]) {
+  auto arg_color         = argc > 1 && std::string(argv[1]) == "--color";
+  console_color::enabled = console_color::isaterminal() || arg_color;
+
+  test_Find();
+
+  return 0;
+}
@@ -0,0 +1,110 @@
+/*
+ * Keyman is copyright (C) SIL International. MIT License.
+ *
+ * Keyman Core - KMX store index unit tests
+ */
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "../../../src/kmx/kmx_store_index.h"
+#include "../../../src/kmx/kmx_processevent.h"
+#include <test_assert.h>
+
+using namespace km::core::kmx;
+using namespace std;
+
+namespace {
+
+KMX_WCHAR empty[] = u"";
+
+// Compares the index against the linear walk that it replaces
+void check_find(KMX_StoreIndex const &index, KMX_DWORD store, LPSTORE s, std::u16string chr) {
+  int expected_pos = -1, actual_pos = -1;
+  PKMX_WCHAR expected = xstrchr(s->dpString, &chr[0]);
+  if (expected) expected_pos = xstrpos(expected, s->dpString);
+  PKMX_WCHAR actual = index.Find(store, s, &chr[0], &actual_pos);
+  assert(expected == actual);
+  assert(expected_pos == actual_pos);
+}
+
+void check_at(KMX_StoreIndex const &index, KMX_DWORD store, LPSTORE s, KMX_WORD n) {
+  KMX_WORD expected_n = n, actual_n = n;
+  PKMX_WCHAR expected;
+  for (expected = s->dpString; *expected && expected_n > 0; expected = incxstr(expected), expected_n--);
+  PKMX_WCHAR actual = index.At(store, s, actual_n);
+  assert(expected == actual);
+  assert(expected_n == actual_n);
+}
+
+} // namespace
+
+void
+test_Find() {
+  // A large store with a duplicate, a deadkey and a surrogate pair, so it
+  // gets both the hash and the bitmap
+  std::u16string big = u"abcdefghijklmnopqrstuvwxyz" C_CODE_DEADKEY(u"\u0001") u"\U0001F600" u"ABCDEFGHIJKLMNOPb";
+  std::u16string small = u"xyz";
+  std::u16string ctx_any = C_CODE_ANY(u"\u0001") C_CODE_NOTANY(u"\u0002") C_CODE_INDEX(u"\u0001", u"\u0001");
+
+  STORE stores[3] = {
+    {0, empty, &big[0]},
+    {0, empty, &small[0]},
+    {0, empty, empty},
+  };
+  KEY keys[1] = {{u'a', 0, 0, empty, &ctx_any[0]}};
+  GROUP groups[1] = {{empty, keys, nullptr, nullptr, 1, TRUE}};
+  KEYBOARD kbd = {};
+  kbd.cxStoreArray = 3;
+  kbd.dpStoreArray = stores;
+  kbd.cxGroupArray = 1;
+  kbd.dpGroupArray = groups;
+
+  KMX_StoreIndex index;
+  index.Build(&kbd);
+
+  for (KMX_DWORD i = 0; i < 3; i++) {
+    check_find(index, i, &stores[i], u"a");
+    check_find(index, i, &stores[i], u"b");
+    check_find(index, i, &stores[i], u"P");
+    check_find(index, i, &stores[i], u"z");
+    check_find(index, i, &stores[i], u"!");
+    check_find(index, i, &stores[i], C_CODE_DEADKEY(u"\u0001"));
+    check_find(index, i, &stores[i], C_CODE_DEADKEY(u"\u0002"));
+    check_find(index, i, &stores[i], u"\U0001F600");
+    check_find(index, i, &stores[i], u"\U0001F601");
+    for (KMX_WORD n = 0; n < 50; n++) {
+      check_at(index, i, &stores[i], n);
+    }
+  }
+
+  // Once a store string is replaced, e.g. by set(), we must not use the index
+  std::u16string replaced = u"0123456789";
+  stores[0].dpString = &replaced[0];
+  check_find(index, 0, &stores[0], u"5");
+  check_find(index, 0, &stores[0], u"a");
+  check_at(index, 0, &stores[0], 3);
+}
+
+constexpr const auto help_str = "\
+test_kmx_store_index [--color]\n\
+\n\
+  --color         Force color output\n";
+
+int
+error_args() {
+  std::cerr << "test_kmx_store_index: Invalid arguments." << std::endl;
+  std::cout << help_str;
+  return 1;
+}
+
+int
+main(int argc, char *argv[]) {
+  auto arg_color         = argc > 1 && std::string(argv[1]) == "--color";
+  console_color::enabled = console_color::isaterminal() || arg_color;
+
+  test_Find();
+
+  return 0;
+}
@@ -0,0 +1,172 @@
+/*
+ * Keyman is copyright (C) SIL International. MIT License.
+ *
+ * Keyman Core - KMX states sharing one keyboard, across threads
+ */
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "keyman_core.h"
+#include "path.hpp"
+
+#include <test_assert.h>
+#include "../emscripten_filesystem.h"
+
+namespace {
+
+km_core_option_item test_env_opts[] = {KM_CORE_OPTIONS_END};
+
+std::string arg_path;
+
+// k_021___options: [K_1] sets foo to '1', [K_0] sets it to '0', and [K_A]
+// outputs 'foo.' or 'no foo.' depending on foo
+const char *options_keyboard = "k_021___options.kmx";
+
+std::u32string
+press(km_core_state *state, km_core_virtual_key vk) {
+  try_status(km_core_process_event(state, vk, 0, 1, 0));
+  std::u32string output;
+  for (auto p = km_core_state_get_actions(state)->output; p && *p; p++) {
+    output += *p;
+  }
+  return output;
+}
+
+km_core_keyboard *
+load_keyboard() {
+  km_core_keyboard *kb = nullptr;
+  km::core::path path = km::core::path::join(arg_path, options_keyboard);
+  try_status(km_core_keyboard_load(path.native().c_str(), &kb));
+  return kb;
+}
+
+} // namespace
+
+void
+test_option_isolation() {
+  km_core_keyboard *kb = load_keyboard();
+  km_core_state *a = nullptr, *b = nullptr, *clone = nullptr;
+  try_status(km_core_state_create(kb, test_env_opts, &a));
+  try_status(km_core_state_create(kb, test_env_opts, &b));
+
+  // Setting an option on one state must not affect the other
+  press(a, KM_CORE_VKEY_1);
+  assert(press(a, KM_CORE_VKEY_A) == U"foo.");
+  assert(press(b, KM_CORE_VKEY_A) == U"no foo.");
+
+  km_core_cp const *value = nullptr;
+  try_status(km_core_state_option_lookup(a, KM_CORE_OPT_KEYBOARD, u"foo", &value));
+  assert(std::u16string(value) == u"1");
+  try_status(km_core_state_option_lookup(b, KM_CORE_OPT_KEYBOARD, u"foo", &value));
+  assert(std::u16string(value) == u"0");
+
+  // A clone starts with the option values of its source, and then goes its
+  // own way
+  try_status(km_core_state_clone(a, &clone));
+  assert(press(clone, KM_CORE_VKEY_A) == U"foo.");
+  press(clone, KM_CORE_VKEY_0);
+  assert(press(clone, KM_CORE_VKEY_A) == U"no foo.");
+  assert(press(a, KM_CORE_VKEY_A) == U"foo.");
+
+  km_core_state_dispose(clone);
+  km_core_state_dispose(b);
+  km_core_state_dispose(a);
+  km_core_keyboard_dispose(kb);
+}
+
+// Each thread toggles its own state's option, in a different phase to its
+// neighbours, and checks every output
+void
+run_thread(km_core_state *state, int phase, int iterations) {
+  km_core_virtual_key const on = phase ? KM_CORE_VKEY_0 : KM_CORE_VKEY_1;
+  km_core_virtual_key const off = phase ? KM_CORE_VKEY_1 : KM_CORE_VKEY_0;
+  std::u32string const on_output = phase ? U"no foo." : U"foo.";
+  std::u32string const off_output = phase ? U"foo." : U"no foo.";
+
+  for (int i = 0; i < iterations; i++) {
+    press(state, on);
+    assert(press(state, KM_CORE_VKEY_A) == on_output);
+    press(state, off);
+    assert(press(state, KM_CORE_VKEY_A) == off_output);
+    km_core_context_clear(km_core_state_context(state));
+    km_core_context_clear(km_core_state_app_context(state));
+  }
+}
+
+void
+test_threads() {
+  int const iterations = 1000;
+  km_core_keyboard *kb = load_keyboard();
+
+  double base_rate = 0;
+  for (int n : {1, 2, 4, 8}) {
+    std::vector<km_core_state *> states(n);
+    for (auto &state : states) {
+      try_status(km_core_state_create(kb, test_env_opts, &state));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int t = 0; t < n; t++) {
+      threads.emplace_back(run_thread, states[t], t % 2, iterations);
+    }
+    for (auto &thread : threads) {
+      thread.join();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    // Reported rather than checked, as the speedup depends on the cores
+    // available to the test run
+    double rate = n * iterations * 4 / elapsed.count();
+    if (n == 1) base_rate = rate;
+    std::cout << n << " thread(s): " << (long)rate << " keystrokes/s, speedup "
+              << rate / base_rate << "x" << std::endl;
+
+    for (auto state : states) {
+      km_core_state_dispose(state);
+    }
+  }
+
+  km_core_keyboard_dispose(kb);
+}
+
+constexpr const auto help_str = "\
+test_kmx_threads [--color] <BASELINE_KEYBOARD_PATH>\n\
+\n\
+  --color         Force color output\n\
+  <BASELINE_KEYBOARD_PATH>   Path to the compiled baseline keyboards\n";
+
+int
+error_args() {
+  std::cerr << "test_kmx_threads: Invalid arguments." << std::endl;
+  std::cout << help_str;
+  return 1;
+}
+
+int
+main(int argc, char *argv[]) {
+  if (argc < 2) {
+    return error_args();
+  }
+
+  auto arg_color = std::string(argv[1]) == "--color";
+  if (arg_color && argc < 3) {
+    return error_args();
+  }
+  console_color::enabled = console_color::isaterminal() || arg_color;
+
+#ifdef __EMSCRIPTEN__
+  arg_path = get_wasm_file_path(argv[arg_color ? 2 : 1]);
+#else
+  arg_path = argv[arg_color ? 2 : 1];
+#endif
+
+  test_option_isolation();
+  test_threads();
+
+  return 0;
+}
@@ -0,0 +1,118 @@
+/*
+ * Keyman is copyright (C) SIL International. MIT License.
+ *
+ * Keyman Core - time taken by each phase of loading an LDML keyboard
+ */
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "../../../src/ldml/ldml_transforms.hpp"
+#include "../../../src/ldml/ldml_vkeys.hpp"
+#include "blob.hpp"
+#include "keyman_core.h"
+#include "kmx/kmx_file_validator.hpp"
+#include "kmx/kmx_plus.h"
+#include "ldml/ldml_processor.hpp"
+#include "path.hpp"
+
+#include <test_assert.h>
+
+using namespace km::core;
+
+namespace {
+
+/** loads timed for each measurement */
+const int loads = 20;
+
+/** @returns microseconds per call of `fn` */
+template <typename F>
+double
+time_per_load(F fn) {
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < loads; i++) {
+    fn();
+  }
+  std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count() / loads;
+}
+
+const char *
+mode_name(ldml::compile_mode mode) {
+  switch (mode) {
+  case ldml::compile_mode::serial:
+    return "serial";
+  case ldml::compile_mode::parallel:
+    return "parallel";
+  case ldml::compile_mode::lazy:
+    return "lazy";
+  }
+  return "?";
+}
+
+/** report each phase of the ldml_processor constructor, in each compile mode */
+void
+report(const path &kmx_path) {
+  const blob data = blob::map_file(kmx_path);
+  assert(data.size() > 0);
+  auto validator = (kmx::KMX_FileValidator *)data.data();
+  std::cout << kmx_path << std::endl;
+
+  std::cout << "  validation: " << time_per_load([&]() {
+    assert(validator->VerifyKeyboard(data.size()));
+    kmx::kmx_plus kplus(validator, data.size());
+    assert(kplus.is_valid());
+  }) << " us" << std::endl;
+
+  kmx::kmx_plus kplus(validator, data.size());
+  assert(kplus.is_valid());
+
+  std::cout << "  keys: " << time_per_load([&]() {
+    ldml::vkeys keys;
+    assert(ldml_processor::load_keys(kplus, keys));
+    keys.build(!kplus.meta->normalization_disabled());
+  }) << " us" << std::endl;
+
+  for (auto mode : {ldml::compile_mode::serial, ldml::compile_mode::parallel, ldml::compile_mode::lazy}) {
+    if (kplus.tran != nullptr && kplus.tran->groupCount > 0) {
+      std::cout << "  tran (" << mode_name(mode) << "): " << time_per_load([&]() {
+        std::unique_ptr<ldml::transforms> tr(ldml::transforms::load(kplus, kplus.tran, kplus.tranHelper, mode));
+        assert(tr != nullptr);
+      }) << " us" << std::endl;
+    }
+    if (kplus.bksp != nullptr && kplus.bksp->groupCount > 0) {
+      std::cout << "  bksp (" << mode_name(mode) << "): " << time_per_load([&]() {
+        std::unique_ptr<ldml::transforms> tr(ldml::transforms::load(kplus, kplus.bksp, kplus.bkspHelper, mode));
+        assert(tr != nullptr);
+      }) << " us" << std::endl;
+    }
+  }
+
+  for (uint32_t flags : {KM_CORE_KEYBOARD_LOAD_DEFAULT, KM_CORE_KEYBOARD_LOAD_PARALLEL, KM_CORE_KEYBOARD_LOAD_LAZY}) {
+    std::cout << "  km_core_keyboard_load_with_flags(" << flags << "): " << time_per_load([&]() {
+      km_core_keyboard *kb = nullptr;
+      assert(km_core_keyboard_load_with_flags(kmx_path.native().c_str(), flags, &kb) == KM_CORE_STATUS_OK);
+      km_core_keyboard_dispose(kb);
+    }) << " us" << std::endl;
+  }
+}
+
+}  // namespace
+
+int
+main(int argc, char *argv[]) {
+  int first_arg          = 1;
+  auto arg_color         = argc > first_arg && std::string(argv[first_arg]) == "--color";
+  console_color::enabled = console_color::isaterminal() || arg_color;
+  if (arg_color) {
+    first_arg++;
+  }
+
+  for (int i = first_arg; i < argc; i++) {
+    report(argv[i]);
+  }
+
+  return 0;
+}
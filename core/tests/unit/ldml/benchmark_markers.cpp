@@ -0,0 +1,93 @@
+/*
+ * Keyman is copyright (C) SIL International. MIT License.
+ *
+ * Keyman Core - scaling of marker scanning with context length
+ */
+
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include "../../../src/ldml/ldml_markers.hpp"
+#include "ldml/keyman_core_ldml.h"
+
+#include <test_assert.h>
+
+using namespace km::core::ldml;
+
+namespace {
+
+/** characters processed for each measurement, whatever the context length */
+const size_t chars_per_run = 2000000;
+
+/** a context of about `length` chars, with a marker every few chars */
+std::u32string
+marked_context(size_t length, marker_encoding encoding) {
+  std::u32string str;
+  marker_num marker = LDML_MARKER_MIN_INDEX;
+  while (str.length() < length) {
+    str.append(U"k\u00e8");
+    std::u32string marker_str;
+    prepend_marker(marker_str, marker, encoding);
+    str.append(marker_str);
+    str.append(U"a\u0320");
+    marker = marker % 100 + 1;
+  }
+  return str;
+}
+
+/** @returns nanoseconds per char of `fn` over a context of `length` chars */
+template <typename F>
+double
+time_per_char(size_t length, marker_encoding encoding, F fn) {
+  const std::u32string src = marked_context(length, encoding);
+  const size_t runs        = chars_per_run / src.length() + 1;
+  auto start               = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < runs; i++) {
+    fn(src);
+  }
+  std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count() / (runs * src.length());
+}
+
+/**
+ * Report the cost per char of `fn` for contexts up to 10k chars. If the cost
+ * is linear in length, the cost per char stays flat, whereas a quadratic
+ * cost per char would grow eightfold.
+ */
+template <typename F>
+void
+report(const char *name, marker_encoding encoding, F fn) {
+  double base = 0, ns = 0;
+  for (size_t length : {1250, 2500, 5000, 10000}) {
+    ns = time_per_char(length, encoding, fn);
+    if (length == 1250) base = ns;
+    std::cout << name << ": " << length << " chars, " << ns << " ns/char" << std::endl;
+  }
+  std::cout << name << ": growth in cost per char " << ns / base << "x" << std::endl;
+  // generous, as timings are noisy, but far below quadratic growth
+  assert(ns / base < 4);
+}
+
+}  // namespace
+
+int
+main(int argc, char *argv[]) {
+  auto arg_color         = argc > 1 && std::string(argv[1]) == "--color";
+  console_color::enabled = console_color::isaterminal() || arg_color;
+
+  report("remove_markers (plain)", plain_sentinel, [](const std::u32string &src) {
+    marker_map map;
+    return remove_markers(src, map, plain_sentinel);
+  });
+  report("remove_markers (regex)", regex_sentinel, [](const std::u32string &src) {
+    marker_map map;
+    return remove_markers(src, map, regex_sentinel);
+  });
+  report("normalize_nfd_markers", plain_sentinel, [](const std::u32string &src) {
+    std::u32string str = src;
+    return normalize_nfd_markers(str);
+  });
+
+  return 0;
+}
@@ -0,0 +1,123 @@
+/*
+ * Keyman is copyright (C) SIL International. MIT License.
+ *
+ * Keyman Core - cost of reorder groups per keystroke
+ */
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "../../../src/ldml/ldml_transforms.hpp"
+#include "kmx/kmx_plus.h"
+#include "ldml/keyman_core_ldml.h"
+
+#include <test_assert.h>
+
+using namespace km::core::ldml;
+using namespace km::core::kmx;
+
+namespace {
+
+/** keystrokes typed for each measurement */
+const size_t keystrokes = 200000;
+
+/** chars of context kept while typing, as for a real context */
+const size_t context_length = 64;
+
+const COMP_KMXPLUS_USET_RANGE consonants[] = {COMP_KMXPLUS_USET_RANGE(0x1000, 0x102A)};
+const COMP_KMXPLUS_USET_RANGE aa[]         = {COMP_KMXPLUS_USET_RANGE(0x102B, 0x102C)};
+const COMP_KMXPLUS_USET_RANGE upper[]      = {COMP_KMXPLUS_USET_RANGE(0x102D, 0x102E)};
+const COMP_KMXPLUS_USET_RANGE lower[]      = {COMP_KMXPLUS_USET_RANGE(0x102F, 0x1030)};
+
+void
+add(reorder_group &rg, const SimpleUSet &u, int order) {
+  element_list e;
+  e.emplace_back(u, order << LDML_ELEM_FLAGS_ORDER_BITSHIFT);
+  rg.list.emplace_back(e);
+}
+
+void
+add(reorder_group &rg, km_core_usv ch, int order, KMX_DWORD flags = 0) {
+  element_list e;
+  e.emplace_back(ch, (order << LDML_ELEM_FLAGS_ORDER_BITSHIFT) | flags);
+  rg.list.emplace_back(e);
+}
+
+/** a reorder group along the lines of a Myanmar keyboard's */
+transforms *
+myanmar_reorders() {
+  reorder_group rg;
+  add(rg, SimpleUSet(consonants, 1), 0);
+  add(rg, 0x1031, 10, LDML_ELEM_FLAGS_PREBASE);
+  add(rg, 0x103B, 20);
+  add(rg, 0x103C, 21);
+  add(rg, 0x103D, 22);
+  add(rg, 0x103E, 23);
+  add(rg, SimpleUSet(aa, 1), 40);
+  add(rg, SimpleUSet(upper, 1), 41);
+  add(rg, SimpleUSet(lower, 1), 42);
+  add(rg, 0x1032, 43);
+  add(rg, 0x1036, 44);
+  add(rg, 0x1037, 50);
+  add(rg, 0x103A, 60);
+  add(rg, 0x1038, 80);
+  {
+    // <reorder before="\u103A" from="\u1037" order="55" />
+    element_list e, before;
+    e.emplace_back(0x1037, 55 << LDML_ELEM_FLAGS_ORDER_BITSHIFT);
+    before.emplace_back(0x103A, 0);
+    rg.list.emplace_back(e, before);
+  }
+  {
+    // <reorder from="\u1039[\u1000-\u102A]" order="70 71" />
+    element_list e;
+    e.emplace_back(0x1039, 70 << LDML_ELEM_FLAGS_ORDER_BITSHIFT);
+    e.emplace_back(SimpleUSet(consonants, 1), 71 << LDML_ELEM_FLAGS_ORDER_BITSHIFT);
+    rg.list.emplace_back(e);
+  }
+  auto tr = new transforms(false);
+  tr->addGroup(rg);
+  return tr;
+}
+
+/** @returns nanoseconds per keystroke for typing `text` repeatedly */
+double
+time_per_key(transforms &tr, const std::u32string &text) {
+  std::u32string context;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < keystrokes; i++) {
+    if (context.length() >= context_length) {
+      context.erase(0, context.length() - context_length + 1);
+    }
+    context.push_back(text[i % text.length()]);
+    std::u32string output;
+    const size_t matched = tr.apply(context, output);
+    context.resize(context.length() - matched);
+    context.append(output);
+  }
+  std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count() / keystrokes;
+}
+
+}  // namespace
+
+int
+main(int argc, char *argv[]) {
+  auto arg_color         = argc > 1 && std::string(argv[1]) == "--color";
+  console_color::enabled = console_color::isaterminal() || arg_color;
+
+  std::unique_ptr<transforms> tr(myanmar_reorders());
+
+  // typed out of order, so most keystrokes reorder something
+  std::u32string myanmar = U"\u1031\u1000\u103C\u102C\u1037\u1019\u103A\u1037\u1014\u1039\u1010\u102F\u1038 ";
+  std::u32string expect  = myanmar;
+  (void)tr->apply(expect);
+  assert(expect != myanmar);
+
+  std::cout << "Myanmar reorders: " << time_per_key(*tr, myanmar) << " ns/keystroke" << std::endl;
+  std::cout << "Latin text: " << time_per_key(*tr, U"the quick brown fox ") << " ns/keystroke" << std::endl;
+
+  return 0;
+}
@@ -2,6 +2,7 @@
 #define __KMX_TEST_SOURCE_HPP__
 
 #include "path.hpp"
+#include "blob.hpp"
 
 #include <map>
 #include <memory>
@@ -121,7 +122,7 @@ class LdmlJsonTestSourceFactory {
   private:
     JsonTestMap test_map;
     // copy of the kbd data, for lookups
-    std::vector<uint8_t> rawdata;
+    km::core::blob rawdata;
     std::unique_ptr<km::core::kmx::kmx_plus> kmxplus;
 };
 
@@ -3,6 +3,7 @@
 #include "kmx/kmx_xstring.h"
 #include "../../../src/ldml/ldml_vkeys.hpp"
 #include <iostream>
+#include <vector>
 #include "ldml_test_utils.hpp"
 
 // needed for streaming operators
@@ -151,6 +152,28 @@ int test_ldml_vkeys() {
   assert_equal(vk.lookup(km::tests::get_vk(
     "K_E"), RCTRLFLAG|RALTFLAG, found), u"K_E-K_ALTFLAG|RCTRLFLAG");
 
+  // the flat table must agree with lookup() everywhere, including for
+  // modifiers that no key uses, such as num lock
+  vk.build(false);
+  for (km_core_virtual_key v = 0; v < 0x100; v++) {
+    for (uint16_t m = 0; m < 0x800; m++) {
+      const std::u16string str = vk.lookup(v, m, found);
+      const std::u32string *str32 = vk.find(v, m);
+      assert_equal(str32 != nullptr, found);
+      if (found) {
+        assert(*str32 == u16string_to_u32string(str));
+      }
+    }
+  }
+  assert(vk.find(0x1234, 0) == nullptr);
+
+  // outputs are normalized if requested
+  km::core::ldml::vkeys nfd;
+  nfd.add(km::tests::get_vk("K_A"), 0, u"\u00e9");
+  nfd.build(true);
+  assert(*nfd.find(km::tests::get_vk("K_A"), 0) == U"e\u0301");
+  assert_equal(nfd.lookup(km::tests::get_vk("K_A"), 0, found), u"\u00e9");
+
   return EXIT_SUCCESS;
 }
 
@@ -171,6 +194,37 @@ int test_uset() {
   assert_equal(uempty.contains(0x62), false);
   assert_equal(uempty.contains(0x127), false);
 
+  // unsorted, overlapping and adjacent ranges are merged
+  const COMP_KMXPLUS_USET_RANGE r1[] = {
+    {0x1F600, 0x1F64F},
+    {0x70, 0x7a}, // [p-z]
+    {0x61, 0x72}, // [a-r]
+    {0x41, 0x5a}, // [A-Z]
+    {0x5b, 0x5b}, // [\[]
+  };
+  SimpleUSet u1(&r1[0], 5);
+  assert_equal(u1.get_ranges().size(), 3);
+  assert_equal(u1.valid(), true);
+  for (km_core_usv ch = 0; ch < 0x20000; ch++) {
+    const bool expect = (ch >= 0x41 && ch <= 0x5b) || (ch >= 0x61 && ch <= 0x7a) || (ch >= 0x1F600 && ch <= 0x1F64F);
+    assert_equal(u1.contains(ch), expect);
+  }
+
+  // a set with many ranges, which gets a bitmap
+  std::vector<COMP_KMXPLUS_USET_RANGE> r2;
+  for (km_core_usv ch = 0x100; ch < 0x11000; ch += 0x100) {
+    r2.emplace_back(ch, ch + 0x10);
+  }
+  SimpleUSet u2(r2.data(), r2.size());
+  for (km_core_usv ch = 0; ch < 0x20000; ch++) {
+    const bool expect = ch >= 0x100 && ch < 0x11000 && (ch & 0xFF) <= 0x10;
+    assert_equal(u2.contains(ch), expect);
+  }
+
+  // ranges with noncharacters are invalid
+  const COMP_KMXPLUS_USET_RANGE r3[] = {{0xFDD0, 0xFDD1}};
+  assert_equal(SimpleUSet(&r3[0], 1).valid(), false);
+
   return EXIT_SUCCESS;
 }
 
@@ -4,6 +4,7 @@
 #include "kmx/kmx_xstring.h"
 #include "test_color.h"
 #include <iostream>
+#include <memory>
 #include <string>
 #include <test_assert.h>
 
@@ -487,6 +488,30 @@ test_reorder_standalone() {
         assert_equal(len, 0);
       }
     }
+    // text with no reorderable chars skips the group
+    {
+      std::u32string text = U"roast";
+      assert_equal(tr.apply(text), false);
+      zassert_string_equal(text, U"roast");
+    }
+  }
+  {
+    // matching within part of a string, as reorder_group::apply() does
+    element_list l;
+    l.emplace_back(U'b', 0);
+    l.emplace_back(U'c', 0);
+    const std::u32string str = U"abcbcd";
+    assert_equal(l.match_end(str, 0, 3), 2);
+    assert_equal(l.match_end(str, 0, 5), 2);
+    assert_equal(l.match_end(str, 0, 6), 0);
+    assert_equal(l.match_end(str, 2, 3), 0);  // too short, 'b' is out of range
+
+    element_list before;
+    before.emplace_back(U'a', 0);
+    const reorder_entry r(l, before);
+    assert_equal(r.match_end(str, 0, 3), 2);
+    assert_equal(r.match_end(str, 1, 2), 0);  // 'a' is out of range
+    assert_equal(r.match_end(str, 0, 5), 0);  // 'a' is not before the match
   }
   return EXIT_SUCCESS;
 }
@@ -639,6 +664,191 @@ test_map() {
   return EXIT_SUCCESS;
 }
 
+int
+test_final_chars() {
+  std::cout << "== " << __FUNCTION__ << std::endl;
+
+  const icu::UnicodeSet all(0, 0x10FFFF);
+  auto final_chars = [](const char16_t *pattern) {
+    icu::UnicodeSet chars;
+    transform_entry::findFinalChars(icu::UnicodeString(pattern), chars);
+    return chars;
+  };
+
+  std::cout << __FILE__ << ":" << __LINE__ << "  transform_entry::findFinalChars" << std::endl;
+  {
+    assert(final_chars(u"abc") == icu::UnicodeSet(u'c', u'c'));
+    assert(final_chars(u"ab?") == icu::UnicodeSet(u'a', u'b'));
+    assert(final_chars(u"ab*c{0,2}") == icu::UnicodeSet(u'a', u'c'));
+    assert(final_chars(u"ab+") == icu::UnicodeSet(u'b', u'b'));
+    assert(final_chars(u"a(b|c)") == icu::UnicodeSet(u'b', u'c'));
+    assert(final_chars(u"a(?:b|cd?)") == icu::UnicodeSet(u'b', u'd'));
+    assert(final_chars(u"x[a-d]") == icu::UnicodeSet(u'a', u'd'));
+    assert(final_chars(u"a(?=b)") == icu::UnicodeSet(u'a', u'a'));
+    assert(final_chars(u"e\\^") == icu::UnicodeSet(u'^', u'^'));
+    assert(final_chars(u"a\\u0062") == icu::UnicodeSet(u'b', u'b'));
+    assert(final_chars(u"\\uffff\\u0008[\\u0001-\\ud7fe]") == icu::UnicodeSet(0x0001, 0xD7FE));
+    assert(final_chars(u"\\U0001F600") == icu::UnicodeSet(0x1F600, 0x1F600));
+    // things we don't follow
+    assert(final_chars(u"a.") == all);
+    assert(final_chars(u"a|b") == all);
+    assert(final_chars(u"(?i)a") == all);
+    assert(final_chars(u"(a)\\1") == all);
+    assert(final_chars(u"a\\d") == all);
+    assert(final_chars(u"[\\d]") == all);
+    assert(final_chars(u"[\\s]") == all);
+    assert(final_chars(u"[\\w]") == all);
+    assert(final_chars(u"a[\\d]") == all);
+    assert(final_chars(u"[\\\\d]") == icu::UnicodeSet(u'\\', u'\\').add(u'd'));
+  }
+
+  std::cout << __FILE__ << ":" << __LINE__ << "  final chars agree with the regex" << std::endl;
+  {
+    const char16_t *patterns[] = {
+      u"abc", u"ab?", u"a(b|c)+", u"[^a]", u"x?(?<=a)b*", u"(ab){0}c?", u"a[b-d]{1,2}",
+      u"\\p{Lu}", u"\\x{62}|c", u"a(?!b)", u"\\bz?", u"[\\d]", u"a[\\w]",
+    };
+    const char16_t *inputs[] = {
+      u"abc", u"ab", u"a", u"b", u"ac", u"abb", u"xc", u"B", u"bz", u"z", u"ad", u"\n", u"a\n", u"a5",
+    };
+    for (auto pattern : patterns) {
+      icu::UnicodeSet chars = final_chars(pattern);
+      icu::UnicodeString anchored(pattern);
+      anchored.append(u'$');
+      UErrorCode status = U_ZERO_ERROR;
+      std::unique_ptr<icu::RegexPattern> regex(icu::RegexPattern::compile(anchored, 0, status));
+      assert(U_SUCCESS(status));
+      for (auto input : inputs) {
+        icu::UnicodeString str(input);
+        std::unique_ptr<icu::RegexMatcher> matcher(regex->matcher(str, status));
+        if (matcher->find() && matcher->end(status) > matcher->start(status) &&
+            matcher->end(status) == str.length()) {
+          // a non-empty match at the end must end with one of the final chars
+          assert(chars.contains(str.char32At(str.length() - 1)));
+        }
+      }
+    }
+  }
+
+  std::cout << __FILE__ << ":" << __LINE__ << "  groups skip entries which can't match" << std::endl;
+  {
+    transforms tr(false);
+    {
+      transform_group st;
+      st.emplace_back(std::u32string(U"a(b|c)"), std::u32string(U"X"));
+      st.emplace_back(std::u32string(U"d."), std::u32string(U"Y"));
+      tr.addGroup(st);
+    }
+    {
+      transform_group st;
+      st.emplace_back(std::u32string(U"zX"), std::u32string(U"Z"));
+      tr.addGroup(st);
+    }
+    {
+      std::u32string src(U"zac");
+      assert(tr.apply(src));
+      zassert_string_equal(src, std::u32string(U"Z"));
+    }
+    {
+      std::u32string src(U"dq");
+      assert(tr.apply(src));
+      zassert_string_equal(src, std::u32string(U"Y"));
+    }
+    {
+      std::u32string src(U"ad");
+      assert(!tr.apply(src));
+    }
+    {
+      std::u32string src;
+      assert(!tr.apply(src));
+    }
+  }
+
+  std::cout << __FILE__ << ":" << __LINE__ << "  class escapes in sets are not skipped" << std::endl;
+  {
+    transforms tr(false);
+    {
+      transform_group st;
+      st.emplace_back(std::u32string(U"[\\d]"), std::u32string(U"D"));
+      tr.addGroup(st);
+    }
+    {
+      std::u32string src(U"x5");
+      assert(tr.apply(src));
+      zassert_string_equal(src, std::u32string(U"xD"));
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
+
+int
+test_literals() {
+  std::cout << "== " << __FUNCTION__ << std::endl;
+
+  std::cout << __FILE__ << ":" << __LINE__ << "  transform_entry::parseLiteral" << std::endl;
+  {
+    std::u32string literal;
+    assert(transform_entry::parseLiteral(icu::UnicodeString(u"abc"), literal));
+    zassert_string_equal(literal, std::u32string(U"abc"));
+    assert(transform_entry::parseLiteral(icu::UnicodeString(u"e\\^\\u0062\\x{1F600}"), literal));
+    zassert_string_equal(literal, std::u32string(U"e^b\U0001F600"));
+    assert(transform_entry::parseLiteral(icu::UnicodeString(u"\\uffff\\u0008\\u0001"), literal));
+    zassert_string_equal(literal, std::u32string(U"\uffff\u0008\u0001"));
+    assert(!transform_entry::parseLiteral(icu::UnicodeString(u""), literal));
+    assert(!transform_entry::parseLiteral(icu::UnicodeString(u"a?"), literal));
+    assert(!transform_entry::parseLiteral(icu::UnicodeString(u"[ab]"), literal));
+    assert(!transform_entry::parseLiteral(icu::UnicodeString(u"a\\d"), literal));
+    assert(!transform_entry::parseLiteral(icu::UnicodeString(u"\\ud83d\\ude00"), literal));
+
+    assert(transform_entry(U"ab", U"c").isLiteral());
+    assert(!transform_entry(U"ab", U"$0c").isLiteral());
+    assert(!transform_entry(U"a(b)", U"c").isLiteral());
+  }
+
+  std::cout << __FILE__ << ":" << __LINE__ << "  reverse_trie" << std::endl;
+  {
+    reverse_trie trie;
+    assert_equal(trie.findLowest(U"abc"), -1);
+    trie.add(U"bc", 3);
+    trie.add(U"c", 5);
+    trie.add(U"abc", 1);
+    trie.add(U"c", 4);
+    trie.add(U"bc", 6);
+    assert_equal(trie.findLowest(U"abc"), 1);
+    assert_equal(trie.findLowest(U"xbc"), 3);
+    assert_equal(trie.findLowest(U"c"), 4);
+    assert_equal(trie.findLowest(U"cb"), -1);
+    assert_equal(trie.findLowest(U""), -1);
+    trie.clear();
+    assert_equal(trie.findLowest(U"abc"), -1);
+  }
+
+  std::cout << __FILE__ << ":" << __LINE__ << "  literal and regex entries keep their order" << std::endl;
+  {
+    transforms tr(false);
+    {
+      transform_group st;
+      st.emplace_back(std::u32string(U"xc"), std::u32string(U"1"));
+      st.emplace_back(std::u32string(U"[ab]c"), std::u32string(U"2"));
+      st.emplace_back(std::u32string(U"c"), std::u32string(U"3"));
+      st.emplace_back(std::u32string(U"bc"), std::u32string(U"4"));
+      st.emplace_back(std::u32string(U"ab"), std::u32string(U"<$0>"));
+      tr.addGroup(st);
+    }
+    const std::u32string cases[][2] = {
+      {U"xc", U"1"}, {U"bc", U"2"}, {U"qc", U"q3"}, {U"ab", U"<ab>"}, {U"aq", U"aq"},
+    };
+    for (const auto &c : cases) {
+      std::u32string src(c[0]);
+      tr.apply(src);
+      zassert_string_equal(src, c[1]);
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
+
 int
 test_strutils() {
   std::cout << "== " << __FUNCTION__ << std::endl;
@@ -1132,6 +1342,196 @@ test_normalize() {
   // triple diacritic + marker - reordering needed
   TEST_NFD_PLAIN(U"e\u0300\uffff\u0008\u0001\u0300\u0320\u0300", U"e\u0320\u0300\uffff\u0008\u0001\u0300\u0300")
 
+  std::cout << __FILE__ << ":" << __LINE__ << " * normalize_nfd_markers_tail" << std::endl;
+  {
+    // appending to NFD text, normalizing only the tail must give the same
+    // result as normalizing everything
+    const std::u32string prefixes[] = {
+        U"", U"a", U"e\u0320\u0300", U"\u00e9", U"e\uffff\u0008\u0001\u0300", U"e\u0300\uffff\u0008\u0001",
+        U"\u0300", U"x\uffff\u0008\u0300", U"\uffff\u0008\u0001",
+    };
+    const std::u32string suffixes[] = {
+        U"", U"b", U"\u0320", U"\u0300\u0320", U"\u00e9\u0320", U"\uffff\u0008\u0002\u0320", U"\u0320\uffff\u0008\u0002",
+        U"\uffff\u0008\u0320", U"\u1e69",
+    };
+    for (const auto &prefix : prefixes) {
+      std::u32string prefix_nfd = prefix;
+      assert(normalize_nfd_markers(prefix_nfd));
+      for (const auto &suffix : suffixes) {
+        std::u32string expect = prefix_nfd + suffix;
+        assert(normalize_nfd_markers(expect));
+        std::u32string dst = prefix_nfd + suffix;
+        assert(normalize_nfd_markers_tail(dst, prefix_nfd.length()));
+        zassert_string_equal(dst, expect);
+      }
+    }
+  }
+  return EXIT_SUCCESS;
+}
+
+int
+test_lookbehind() {
+  std::cout << "== " << __FUNCTION__ << std::endl;
+
+  const int32_t unbounded = transform_entry::UNBOUNDED;
+  auto lookbehind = [](const char16_t *pattern) {
+    return transform_entry::findLookbehind(icu::UnicodeString(pattern));
+  };
+
+  std::cout << __FILE__ << ":" << __LINE__ << "  transform_entry::findLookbehind" << std::endl;
+  {
+    assert_equal(lookbehind(u"abc"), 3);
+    assert_equal(lookbehind(u"ab?"), 2);
+    assert_equal(lookbehind(u"a{2,4}"), 4);
+    assert_equal(lookbehind(u"(ab){3}"), 6);
+    assert_equal(lookbehind(u"(?:a|bcd)"), 3);
+    assert_equal(lookbehind(u"[a-z]\\u0062."), 3);
+    assert_equal(lookbehind(u"\\U0001F600"), 1);
+    assert_equal(lookbehind(u"(?<=xy)a"), 3);
+    assert_equal(lookbehind(u"a(?=bc)"), 1);
+    assert_equal(lookbehind(u"\\ba"), 2);
+    assert_equal(lookbehind(u"\\uffff\\u0008[\\u0001-\\ud7fe]"), 3);
+    assert_equal(lookbehind(u"ab*"), unbounded);
+    assert_equal(lookbehind(u"a+"), unbounded);
+    assert_equal(lookbehind(u"a{2,}"), unbounded);
+    assert_equal(lookbehind(u"^a"), unbounded);
+    // the '$' only anchors the last alternative
+    assert_equal(lookbehind(u"a|bcd"), unbounded);
+    assert_equal(lookbehind(u"(a)\\1"), unbounded);
+    assert_equal(lookbehind(u"a{99999999999}"), unbounded);
+
+    // the entry also allows for a final line terminator
+    assert_equal(transform_entry(U"abc", U"x").getLookbehind(), 5);
+    assert_equal(transform_entry(U"a*", U"x").getLookbehind(), unbounded);
+  }
+
+  std::cout << __FILE__ << ":" << __LINE__ << "  the lookbehind of groups" << std::endl;
+  {
+    transforms tr(false);
+    assert_equal(tr.getLookbehind(), 0);
+    {
+      transform_group st;
+      st.emplace_back(std::u32string(U"ab"), std::u32string(U"x"));
+      st.emplace_back(std::u32string(U"c{1,4}"), std::u32string(U"y"));
+      tr.addGroup(st);
+    }
+    assert_equal(tr.getLookbehind(), 6);
+    {
+      transform_group st;
+      st.emplace_back(std::u32string(U"x"), std::u32string(U"z"));
+      tr.addGroup(st);
+    }
+    assert_equal(tr.getLookbehind(), 9);
+    tr.addGroup(reorder_group());
+    assert_equal(tr.getLookbehind(), unbounded);
+  }
+
+  std::cout << __FILE__ << ":" << __LINE__ << "  a long context gives the same results" << std::endl;
+  {
+    transforms tr(false);
+    {
+      transform_group st;
+      st.emplace_back(std::u32string(U"(?<=q)ab"), std::u32string(U"1"));
+      st.emplace_back(std::u32string(U"\\bcd"), std::u32string(U"2"));
+      st.emplace_back(std::u32string(U"e{2,3}"), std::u32string(U"<$0>"));
+      st.emplace_back(std::u32string(U"f"), std::u32string(U""));
+      tr.addGroup(st);
+    }
+    {
+      transform_group st;
+      st.emplace_back(std::u32string(U"gh"), std::u32string(U"3"));
+      st.emplace_back(std::u32string(U"(?<![a-z])\U0001F600"), std::u32string(U"4"));
+      tr.addGroup(st);
+    }
+    const std::u32string cases[][2] = {
+      {U"qab", U"q1"},    {U"xab", U"xab"},     {U"cd", U"2"},     {U"acd", U"acd"}, {U"eeee", U"e<eee>"},
+      {U"ghf", U"3"},     {U"g\U0001F600f", U"g\U0001F600"}, {U" \U0001F600", U" 4"}, {U"xyz", U"xyz"},
+    };
+    const std::u32string prefixes[] = {U"", U" ", std::u32string(1000, U'.')};
+    for (const auto &c : cases) {
+      for (const auto &prefix : prefixes) {
+        std::u32string src = prefix + c[0];
+        tr.apply(src);
+        zassert_string_equal(src, prefix + c[1]);
+      }
+    }
+  }
+
+  std::cout << __FILE__ << ":" << __LINE__ << "  matches before a final CR LF" << std::endl;
+  {
+    // 'a+b' has no bound, so it is searched for in the whole text
+    transforms tr(false), whole(false);
+    {
+      transform_group st;
+      st.emplace_back(std::u32string(U"ab"), std::u32string(U"1"));
+      tr.addGroup(st);
+    }
+    {
+      transform_group st;
+      st.emplace_back(std::u32string(U"a+b"), std::u32string(U"1"));
+      whole.addGroup(st);
+    }
+    const std::u32string prefixes[] = {U"", U"x", std::u32string(1000, U'.')};
+    for (const auto &prefix : prefixes) {
+      std::u32string src = prefix + U"ab\r\n";
+      std::u32string expected = src;
+      assert(whole.apply(expected));
+      assert(tr.apply(src));
+      zassert_string_equal(src, expected);
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
+
+int
+test_compile() {
+  std::cout << "== " << __FUNCTION__ << std::endl;
+
+  // several groups of entries, so that threads share out the work
+  auto make = []() {
+    std::unique_ptr<transforms> tr(new transforms(false));
+    for (int g = 0; g < 3; g++) {
+      transform_group st;
+      for (char32_t ch = U'a'; ch <= U'z'; ch++) {
+        st.emplace_back(std::u32string(1, ch) + U"([0-9]+)", std::u32string(1, ch) + U"<$1>");
+      }
+      tr->addGroup(st);
+      tr->addGroup(reorder_group());
+    }
+    return tr;
+  };
+  const std::u32string inputs[] = {U"q12", U"z9", U"9", U"a"};
+
+  std::cout << __FILE__ << ":" << __LINE__ << "  compiled and lazy entries agree" << std::endl;
+  {
+    auto lazy = make();
+    for (unsigned threads : {1u, 4u, 100u}) {
+      auto compiled = make();
+      assert(compiled->compile(threads));
+      for (const auto &input : inputs) {
+        std::u32string a = input, b = input;
+        assert_equal(compiled->apply(a), lazy->apply(b));
+        zassert_string_equal(a, b);
+      }
+    }
+    // compiling again is harmless
+    assert(lazy->compile(2));
+    std::u32string str(U"q12");
+    assert(lazy->apply(str));
+    zassert_string_equal(str, std::u32string(U"q<12>"));
+  }
+
+  std::cout << __FILE__ << ":" << __LINE__ << "  copies of compiled entries" << std::endl;
+  {
+    transform_entry entry(U"ab", U"c");
+    assert(entry.compile());
+    transform_entry copy(entry);
+    std::u32string output;
+    assert_equal(copy.apply(icu::UnicodeString(u"xab"), output), 2);
+    zassert_string_equal(output, std::u32string(U"c"));
+  }
+
   return EXIT_SUCCESS;
 }
 
@@ -1169,6 +1569,22 @@ main(int argc, const char *argv[]) {
     rc = EXIT_FAILURE;
   }
 
+  if (test_final_chars() != EXIT_SUCCESS) {
+    rc = EXIT_FAILURE;
+  }
+
+  if (test_literals() != EXIT_SUCCESS) {
+    rc = EXIT_FAILURE;
+  }
+
+  if (test_lookbehind() != EXIT_SUCCESS) {
+    rc = EXIT_FAILURE;
+  }
+
+  if (test_compile() != EXIT_SUCCESS) {
+    rc = EXIT_FAILURE;
+  }
+
   if (test_strutils() != EXIT_SUCCESS) {
     rc = EXIT_FAILURE;
   }